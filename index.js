@@ -7,6 +7,8 @@ const abi = require('./abi.js');
 const crypto = require('crypto');
 const {Looper} = require("./looper.js");
 const Retry = require("./retry.js");
+const Protocol = require("./protocol.js");
+const {NativeTransport} = require("./native.js");
 
 function difficultyToString( difficulty ) {
    let difficultyStr = difficulty.toString(16);
@@ -14,6 +16,20 @@ function difficultyToString( difficulty ) {
    return difficultyStr;
 }
 
+function parseJobWeights( str ) {
+   // "tipAddress:weight,..." to weights by lower case tip address
+   let weights = {};
+   for( let entry of str.split(",") ) {
+      if( entry.trim() === "" )
+         continue;
+      let [tipAddress, weight] = entry.split(":").map( (s) => s.trim() );
+      if( !tipAddress || !/^[0-9]+$/.test(weight || "") )
+         throw new Error("Invalid KOINOS_MINER_JOB_WEIGHTS entry: " + entry);
+      weights[tipAddress.toLowerCase()] = parseInt(weight);
+   }
+   return weights;
+}
+
 function addressToBytes( addr ) {
    // Convert a string address to bytes
    let ADDRESS_LENGTH = 42;
@@ -29,9 +45,10 @@ function addressToBytes( addr ) {
  * Keep track of the information that was used in a request, so we can use it in response processing.
  */
 class MiningRequestQueue {
-   constructor( reqStream ) {
+   constructor( transport ) {
       this.pendingRequests = [];
-      this.reqStream = reqStream;
+      this.transport = transport;
+      this.nextId = 1;
    }
 
    sendRequest(req) {
@@ -39,30 +56,34 @@ class MiningRequestQueue {
       console.log( "[JS] Ethereum Block Number: " + req.block.number );
       console.log( "[JS] Ethereum Block Hash:   " + req.block.hash );
       console.log( "[JS] Target Difficulty:     " + difficultyStr );
-      this.reqStream.write(
-         req.minerAddress + " " +
-         req.tipAddress + " " +
-         req.block.hash + " " +
-         req.block.number.toString() + " " +
-         difficultyStr + " " +
-         req.tipAmount + " " +
-         req.powHeight + " " +
-         req.threadIterations + " " +
-         req.hashLimit + " " +
-         req.nonceOffset + ";\n");
+      req.id = this.nextId++;
+      this.transport.request(req, difficultyStr);
       this.pendingRequests.push(req);
    }
 
-   getHead() {
-      if( this.pendingRequests.length === 0 )
-         return null;
-      return this.pendingRequests[0];
+   sendHint(blockHash) {
+      // Lets the miner build the word buffer for a block before it is requested
+      this.transport.hint(blockHash);
    }
 
-   popHead() {
-      if( this.pendingRequests.length === 0 )
-         return null;
-      return this.pendingRequests.shift();
+   sendWeight(req, weight) {
+      // Changes the share of a job of the set, without restarting it
+      this.transport.weight(weight, req.id);
+   }
+
+   // The request a response belongs to. Text responses carry no id, they answer the oldest request
+   getRequest(id) {
+      if( id === undefined )
+         return this.pendingRequests.length ? this.pendingRequests[0] : null;
+      return this.pendingRequests.find( (req) => req.id === id ) || null;
+   }
+
+   // Remove the request a final response (finished, nonce or preempted) belongs to
+   takeRequest(id) {
+      let req = this.getRequest(id);
+      if( req !== null )
+         this.pendingRequests.splice(this.pendingRequests.indexOf(req), 1);
+      return req;
    }
 }
 
@@ -76,10 +97,32 @@ module.exports = class KoinosMiner {
    lastProof = Date.now();
    hashes = 0;
    hashRate = 0;
+   hintedBlockHash = null;
+   minerThreads = 0;
+   // "binary" frames requests and responses, "text" is the line protocol older miners speak
+   protocol = process.env.KOINOS_MINER_PROTOCOL || "binary";
+   // "native" runs the search engine in this process when the addon is built, "daemon" shares
+   // the miner daemon listening on KOINOS_MINER_SOCKET, "process" spawns the miner
+   engine = process.env.KOINOS_MINER_ENGINE || "process";
+   // The daemon must speak the same protocol, and splits its hash rate by weight
+   socketPath = process.env.KOINOS_MINER_SOCKET || "/tmp/koinos_miner.sock";
+   weight = parseInt(process.env.KOINOS_MINER_WEIGHT || "1");
+   // Set to "1" to mine all tip addresses at once as one job set, instead of one after the
+   // other. Needs the miner process and the binary protocol, only binary responses name their job
+   jobSet = process.env.KOINOS_MINER_JOB_SET === "1";
+   // Share of the job set per tip address, as "tipAddress:weight,...". Tip addresses not
+   // listed get 1, and 0 pauses one. See setJobWeight() to change them while mining
+   jobWeights = parseJobWeights(process.env.KOINOS_MINER_JOB_WEIGHTS || "");
+   // Shares per second to ask the miner for, 0 turns share mode off. The in process
+   // engine has no share mode
+   sharesPerSecond = parseFloat(process.env.KOINOS_MINER_SHARES || "0");
+   shares = 0;
+   native = null;
+   daemon = null;
    child = null;
    contract = null;
 
-   constructor(address, tipAddresses, fromAddress, contractAddress, endpoint, tipAmount, period, gasMultiplier, gasPriceLimit, signCallback, hashrateCallback, proofCallback, errorCallback, warningCallback) {
+   constructor(address, tipAddresses, fromAddress, contractAddress, endpoint, tipAmount, period, gasMultiplier, gasPriceLimit, signCallback, hashrateCallback, proofCallback, errorCallback, warningCallback, shareCallback) {
       let self = this;
 
       this.address = address;
@@ -91,6 +134,7 @@ module.exports = class KoinosMiner {
       this.hashrateCallback = hashrateCallback;
       this.errorCallback = errorCallback;
       this.warningCallback = warningCallback;
+      this.shareCallback = shareCallback;
       this.fromAddress = fromAddress;
       this.gasMultiplier = gasMultiplier;
       this.gasPriceLimit = gasPriceLimit;
@@ -126,7 +170,7 @@ module.exports = class KoinosMiner {
       process.on('uncaughtException', function (err) {
          console.error('[JS] uncaughtException:', err.message);
          console.error(err.stack);
-         if (self.child !== null) {
+         if (self.child !== null || self.native !== null || self.daemon !== null) {
             self.stop();
          }
          let error = {
@@ -278,7 +322,10 @@ module.exports = class KoinosMiner {
       console.log("[JS] Finished!");
       this.endTime = Date.now();
       this.adjustDifficulty();
-      this.sendMiningRequest();
+      if( this.jobSet && req !== null )
+         this.sendJobRequest(req.phk);
+      else
+         this.sendMiningRequest();
    }
 
    async onRespNonce(req, nonce) {
@@ -294,6 +341,10 @@ module.exports = class KoinosMiner {
       var hours = Math.trunc(delta / 60);
       console.log( "[JS] Time to find proof: " + hours + ":" + minutes + ":" + seconds + "." + ms );
 
+      // The next proof for this tip address is at the following height, even before the
+      // transaction is mined
+      this.powHeightCache[req.phk] = Math.max(this.powHeightCache[req.phk], req.powHeight);
+
       let mineArgs = [
          [req.minerAddress,req.tipAddress],
          [10000-req.tipAmount,req.tipAmount],
@@ -323,20 +374,83 @@ module.exports = class KoinosMiner {
          data: this.contract.methods.mine(...mineArgs).encodeABI()
       });
 
-      this.rotateTipAddress();
       this.adjustDifficulty();
       this.startTime = Date.now();
-      this.sendMiningRequest();
+      if( this.jobSet ) {
+         this.sendJobRequest(req.phk);
+      }
+      else {
+         this.rotateTipAddress();
+         this.sendMiningRequest();
+      }
+   }
+
+   async onRespPreempted(req, hashes) {
+      console.log( "[JS] Search abandoned after " + hashes + " hashes" );
+      // The request that preempted this one is already queued
+      this.endTime = Date.now();
    }
 
-   async onRespHashReport( req, newHashes )
+   async onRespShare( req, nonce, result ) {
+      this.shares++;
+      if (this.shareCallback && typeof this.shareCallback === "function") {
+         this.shareCallback(req, nonce, result);
+      }
+   }
+
+   async onRespBest( req, nonce, result ) {
+      // The lowest of n uniform results is about maxHash / n
+      const maxHash = BigInt("0xFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFF");
+      console.log( "[JS] Best result: 0x" + result.toString(16) + ", as if from about " + (maxHash / (result + 1n)) + " hashes" );
+      console.log( "[JS] Shares so far: " + this.shares );
+   }
+
+   async onRespHashReport( req, newHashes, reportedRate )
    {
       let now = Date.now();
-      this.updateHashrate(newHashes - this.hashes, now - this.endTime);
+      if ( this.jobSet && req !== null && Number.isFinite(reportedRate) ) {
+         // Every job of the set is reported on its own, the miner's rate is their sum
+         req.rate = reportedRate;
+         this.updateHashrate(this.miningQueue.pendingRequests.reduce( (a, r) => a + (r.rate || 0), 0 ), 1000);
+      }
+      else if ( Number.isFinite(reportedRate) ) {
+         // The miner measures its rate over a fixed interval on completed hashes
+         this.updateHashrate(reportedRate, 1000);
+      }
+      else {
+         this.updateHashrate(newHashes - this.hashes, now - this.endTime);
+      }
       this.hashes = newHashes;
       this.endTime = now;
    }
 
+   async onMinerMessage(msg) {
+      switch( msg.type ) {
+         case "finished":
+            await this.onRespFinished(this.miningQueue.takeRequest(msg.id));
+            break;
+         case "nonce":
+            await this.onRespNonce(this.miningQueue.takeRequest(msg.id), msg.nonce);
+            break;
+         case "preempted":
+            await this.onRespPreempted(this.miningQueue.takeRequest(msg.id), msg.hashes);
+            break;
+         case "threads":
+            this.minerThreads = msg.threads;
+            console.log("[JS] Miner threads:", this.minerThreads);
+            break;
+         case "hashReport":
+            await this.onRespHashReport(this.miningQueue.getRequest(msg.id), msg.hashes, msg.rate);
+            break;
+         case "share":
+            await this.onRespShare(this.miningQueue.getRequest(msg.id), msg.nonce, msg.result);
+            break;
+         case "best":
+            await this.onRespBest(this.miningQueue.getRequest(msg.id), msg.nonce, msg.result);
+            break;
+      }
+   }
+
    async runMiner() {
       if (this.startTimeout) {
          clearTimeout(this.startTimeout);
@@ -349,33 +463,58 @@ module.exports = class KoinosMiner {
 
       this.currentPHKIndex = Math.floor(this.numTipAddresses * Math.random());
 
-      var spawn = require('child_process').spawn;
-      this.child = spawn( this.minerPath(), [this.address, this.oo_address] );
-      this.child.stdin.setEncoding('utf-8');
-      this.child.stderr.pipe(process.stdout);
-      this.miningQueue = new MiningRequestQueue(this.child.stdin);
-      this.child.stdout.on('data', async function (data) {
-         if ( self.isFinishedWithoutNonce(data) ) {
-            await self.onRespFinished(self.miningQueue.popHead());
-         }
-         else if ( self.isFinishedWithNonce(data) ) {
-            let nonce = BigInt('0x' + self.getValue(data));
-            await self.onRespNonce(self.miningQueue.popHead(), nonce);
-         }
-         else if ( self.isHashReport(data) ) {
-            let ret = self.getValue(data).split(" ");
-            let newHashes = parseInt(ret[1]);
-            await self.onRespHashReport(self.miningQueue.getHead(), newHashes);
-         }
-         else {
-            let error = {
-               kMessage: 'Unrecognized response from the C mining application.'
-            };
-            if (self.errorCallback && typeof self.errorCallback === "function") {
-               self.errorCallback(error);
-            }
+      let onMessage = function(msg) { self.onMinerMessage(msg); };
+      let onError = function(message) {
+         let error = {
+            kMessage: message
+         };
+         if (self.errorCallback && typeof self.errorCallback === "function") {
+            self.errorCallback(error);
          }
-      });
+      };
+
+      let addon = this.engine === "native" ? this.loadAddon() : null;
+      if( addon !== null ) {
+         console.log("[JS] Running the search engine in process");
+         this.native = new NativeTransport(addon, onMessage);
+         this.miningQueue = new MiningRequestQueue(this.native);
+         this.native.start();
+      }
+      else if( this.engine === "daemon" ) {
+         let binary = this.protocol === "binary";
+         var net = require('net');
+         console.log("[JS] Connecting to the miner daemon at", this.socketPath);
+         this.daemon = net.createConnection(this.socketPath);
+         this.daemon.on('error', function(e) {
+            onError("Could not reach the miner daemon at " + self.socketPath + ": " + e.message);
+         });
+         let transport = new Protocol.PipeTransport(this.daemon, binary);
+         transport.weight(this.weight);
+         this.miningQueue = new MiningRequestQueue(transport);
+
+         let decoder = binary ? new Protocol.BinaryDecoder(onMessage, onError) : new Protocol.TextDecoder(onMessage, onError);
+         this.daemon.on('data', function (data) {
+            decoder.push(data);
+         });
+      }
+      else {
+         let binary = this.protocol === "binary";
+         var spawn = require('child_process').spawn;
+         this.child = spawn( this.minerPath(), [this.address, this.oo_address, "--protocol", binary ? "binary" : "text"] );
+         if( !binary )
+            this.child.stdin.setEncoding('utf-8');
+         this.child.stderr.pipe(process.stdout);
+         this.miningQueue = new MiningRequestQueue(new Protocol.PipeTransport(this.child.stdin, binary));
+
+         let decoder = binary ? new Protocol.BinaryDecoder(onMessage, onError) : new Protocol.TextDecoder(onMessage, onError);
+         this.child.stdout.on('data', function (data) {
+            decoder.push(data);
+         });
+      }
+      if( this.jobSet && (this.child === null || this.protocol !== "binary") ) {
+         console.log("[JS] Job sets need the miner process and the binary protocol, mining tip addresses one after the other");
+         this.jobSet = false;
+      }
       self.updateBlockchainLoop.start();
       self.sendMiningRequest();
    }
@@ -386,7 +525,7 @@ module.exports = class KoinosMiner {
          return;
       }
 
-      if (this.child !== null) {
+      if (this.child !== null || this.native !== null || this.daemon !== null) {
          console.log("[JS] Miner has already started");
          return;
       }
@@ -422,6 +561,17 @@ module.exports = class KoinosMiner {
          this.child.kill('SIGINT');
          this.child = null;
       }
+      else if (this.native !== null) {
+         console.log("[JS] Stopping miner");
+         this.native.stop();
+         this.native = null;
+      }
+      else if (this.daemon !== null) {
+         // The daemon drops the job of a client that disconnects
+         console.log("[JS] Disconnecting from the miner daemon");
+         this.daemon.end();
+         this.daemon = null;
+      }
       else {
          console.log("[JS] Miner has already stopped");
       }
@@ -442,6 +592,16 @@ module.exports = class KoinosMiner {
       }
    }
 
+   loadAddon() {
+      try {
+         return require(__dirname + '/bin/koinos_miner.node');
+      }
+      catch( e ) {
+         console.log("[JS] Could not load the miner addon, falling back to the miner process:", e.message);
+         return null;
+      }
+   }
+
    minerPath() {
       var miner = __dirname + '/bin/koinos_miner';
       if ( process.platform === "win32" ) {
@@ -450,26 +610,6 @@ module.exports = class KoinosMiner {
       return miner;
    }
 
-   getValue(s) {
-      let str = s.toString();
-      return str.substring(2, str.indexOf(";"));
-   }
-
-   isFinishedWithoutNonce(s) {
-      let str = s.toString();
-      return "F:" === str.substring(0, 2);
-   }
-
-   isFinishedWithNonce(s) {
-      let str = s.toString();
-      return "N:" === str.substring(0, 2);
-   }
-
-   isHashReport(s) {
-      let str = s.toString();
-      return "H:" === str.substring(0,2);
-   }
-
    updateHashrate(d_hashes, d_time) {
       d_time = Math.max(d_time, 1);
       if ( this.hashRate > 0 ) {
@@ -490,7 +630,9 @@ module.exports = class KoinosMiner {
       this.hashRate = Math.max(this.hashRate, 1);
       var hashesPerPeriod = this.hashRate * parseInt(this.proofPeriod);
       this.difficulty = maxHash / BigInt(Math.trunc(hashesPerPeriod));
-      this.threadIterations = Math.max(this.hashRate / (2 * os.cpus().length), 1); // Per thread hash rate, sync twice a second
+      // The miner reports its team size, which follows the container's cpu quota
+      let threads = this.minerThreads > 0 ? this.minerThreads : os.cpus().length;
+      this.threadIterations = Math.max(this.hashRate / (2 * threads), 1); // Per thread hash rate, sync twice a second
       this.hashLimit = this.hashRate * 60 * 1; // Hashes for 1 minute
    }
 
@@ -546,10 +688,51 @@ module.exports = class KoinosMiner {
    }
 
    sendMiningRequest() {
-      let phk = this.getCurrentPHK();
-      let [fromAddress, address, tipAddress, one_minus_ta, ta] = phk.split(",");
       this.hashes = 0;
+      if( !this.jobSet ) {
+         this.sendJobRequest(this.getCurrentPHK());
+         return;
+      }
+
+      // The first request replaces the running jobs, the others join it on the same block
+      let phks = this.getActivePHKs();
+      for( let i=0; i<phks.length; i++ )
+         this.sendJobRequest(phks[i], i > 0);
+   }
+
+   shareTarget() {
+      // A target met sharesPerSecond times a second at the current hash rate, none
+      // until the rate is known
+      if( this.sharesPerSecond <= 0 || this.hashRate <= 1 )
+         return 0n;
+      const maxHash = BigInt("0xFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFF");
+      return maxHash / BigInt(Math.max(Math.trunc(this.hashRate / this.sharesPerSecond), 1));
+   }
+
+   jobWeight( tipAddress ) {
+      let weight = this.jobWeights[tipAddress.toLowerCase()];
+      return weight === undefined ? 1 : weight;
+   }
+
+   setJobWeight( tipAddress, weight ) {
+      // Takes effect at once on the jobs of the tip address being mined
+      if( !Number.isInteger(weight) || weight < 0 )
+         throw new Error("Invalid job weight: " + weight);
+      this.jobWeights[tipAddress.toLowerCase()] = weight;
+      if( !this.jobSet || this.miningQueue === null )
+         return;
+      for( let req of this.miningQueue.pendingRequests ) {
+         if( req.tipAddress.toLowerCase() === tipAddress.toLowerCase() )
+            this.miningQueue.sendWeight(req, weight);
+      }
+   }
+
+   sendJobRequest( phk, join = this.jobSet ) {
+      let [fromAddress, address, tipAddress, one_minus_ta, ta] = phk.split(",");
       this.miningQueue.sendRequest({
+         phk : phk,
+         join : join,
+         weight : this.jobSet ? this.jobWeight(tipAddress) : 1,
          fromAddress : fromAddress,
          minerAddress : address,
          tipAddress : tipAddress,
@@ -559,7 +742,8 @@ module.exports = class KoinosMiner {
          powHeight : this.powHeightCache[phk]+1,
          threadIterations : Math.trunc(this.threadIterations),
          hashLimit : Math.trunc(this.hashLimit),
-         nonceOffset : this.getNonceOffset()
+         nonceOffset : this.getNonceOffset(),
+         shareTarget : this.shareTarget()
          });
    }
 
@@ -569,7 +753,29 @@ module.exports = class KoinosMiner {
          this.headBlock = await this.web3.eth.getBlock("latest");
          // get several blocks behind head block so most reorgs don't invalidate mining
          let confirmedBlock = await this.web3.eth.getBlock(this.headBlock.number - 6 );
+         let previousBlock = this.recentBlock;
          this.recentBlock = confirmedBlock;
+
+         // Searching on a stale block wastes hashrate. A new request preempts the
+         // search in progress, which the miner answers with a preempted response
+         let head = this.miningQueue ? this.miningQueue.getRequest() : null;
+         if( head && previousBlock && previousBlock.hash !== confirmedBlock.hash )
+         {
+            console.log( "[JS] New block, preempting the current search" );
+            this.sendMiningRequest();
+         }
+
+         // The next block to be mined on is already known, hint it so the block
+         // change does not stall on word buffer generation
+         if( this.miningQueue )
+         {
+            let nextBlock = await this.web3.eth.getBlock(this.headBlock.number - 5 );
+            if( nextBlock && nextBlock.hash !== this.hintedBlockHash )
+            {
+               this.hintedBlockHash = nextBlock.hash;
+               this.miningQueue.sendHint(nextBlock.hash);
+            }
+         }
       }
       catch( e )
       {
@@ -0,0 +1,356 @@
+/*
+ * Node.js addon running the search engine inside the wrapper's process.
+ *
+ *    init( options )           Start the engine, returns the number of search threads.
+ *                              options: threads, cpus, smt ("all" or "core"), pin,
+ *                              bufferCount, cacheDir, cacheSize, sharedMemory, lockMemory
+ *    search( job, callback )   Search a job on a worker thread, then call
+ *                              callback( err, { status, nonce, hashes } ) with status
+ *                              "found", "finished" or "cancelled". The job holds
+ *                              32 byte big endian Buffers minerAddress, tipAddress,
+ *                              blockHash, target and nonceOffset, and numbers (or
+ *                              BigInts) blockNumber, tip, powHeight, threadIterations
+ *                              and hashLimit.
+ *    cancel()                  Stop the running or upcoming search.
+ *    hint( blockHash )         Start building the word buffer of an upcoming block.
+ *    counters()                The engine's live hash counters as a BigUint64Array,
+ *                              thread t's count at index t * counterStride.
+ */
+#define NAPI_VERSION 6
+#include <node_api.h>
+
+#include "engine.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FIELD_BYTES 32
+
+struct search_task
+{
+   napi_async_work     work;
+   napi_ref            callback;
+   struct miner_job    job;
+   enum engine_status  status;
+   struct bn           nonce;
+   uint64_t            hashes;
+};
+
+static struct miner_engine engine;
+static bool engine_ready = false;
+static bool searching = false;
+
+// Set by cancel() until the next search(), as the worker's set_job() clears the engine's flag
+static atomic_bool cancel_requested = false;
+
+// Copies of the option strings, the engine keeps pointers to them
+static char cpu_list[1024];
+static char cache_dir[1024];
+
+#define NAPI_CALL( env, call )                                     \
+   do                                                              \
+   {                                                               \
+      if( (call) != napi_ok )                                      \
+      {                                                            \
+         napi_throw_error( (env), NULL, "N-API call failed: " #call ); \
+         return NULL;                                              \
+      }                                                            \
+   } while( 0 )
+
+static napi_value throw_error( napi_env env, const char* message )
+{
+   napi_throw_error( env, NULL, message );
+   return NULL;
+}
+
+static bool has_property( napi_env env, napi_value obj, const char* name, napi_value* value )
+{
+   bool has = false;
+   if( napi_has_named_property( env, obj, name, &has ) != napi_ok || !has )
+      return false;
+   if( napi_get_named_property( env, obj, name, value ) != napi_ok )
+      return false;
+
+   napi_valuetype type;
+   napi_typeof( env, *value, &type );
+   return type != napi_undefined && type != napi_null;
+}
+
+// A number or BigInt property, returns false if it is missing or of another type
+static bool get_u64( napi_env env, napi_value obj, const char* name, uint64_t* result )
+{
+   napi_value value;
+   napi_valuetype type;
+   if( !has_property( env, obj, name, &value ) || napi_typeof( env, value, &type ) != napi_ok )
+      return false;
+
+   if( type == napi_bigint )
+   {
+      bool lossless;
+      return napi_get_value_bigint_uint64( env, value, result, &lossless ) == napi_ok && lossless;
+   }
+
+   double d;
+   if( type != napi_number || napi_get_value_double( env, value, &d ) != napi_ok || d < 0 )
+      return false;
+   *result = (uint64_t)d;
+   return true;
+}
+
+// A big endian Buffer of at most 32 bytes
+static bool buffer_to_field( napi_env env, napi_value value, struct bn* result )
+{
+   bool is_buffer = false;
+   unsigned char* data;
+   size_t length;
+
+   if( napi_is_buffer( env, value, &is_buffer ) != napi_ok || !is_buffer )
+      return false;
+   if( napi_get_buffer_info( env, value, (void**)&data, &length ) != napi_ok || length > FIELD_BYTES )
+      return false;
+
+   bignum_init( result );
+   for( size_t i = 0; i < length; i++ )
+   {
+      size_t byte = length - 1 - i;
+      result->array[i / WORD_SIZE] |= (DTYPE)data[byte] << (8 * (i % WORD_SIZE));
+   }
+   return true;
+}
+
+static bool get_field( napi_env env, napi_value obj, const char* name, struct bn* result )
+{
+   napi_value value;
+   return has_property( env, obj, name, &value ) && buffer_to_field( env, value, result );
+}
+
+static bool get_bool( napi_env env, napi_value obj, const char* name, bool* result )
+{
+   napi_value value;
+   return has_property( env, obj, name, &value ) && napi_get_value_bool( env, value, result ) == napi_ok;
+}
+
+static bool get_string( napi_env env, napi_value obj, const char* name, char* buf, size_t size )
+{
+   napi_value value;
+   size_t length;
+   return has_property( env, obj, name, &value ) && napi_get_value_string_utf8( env, value, buf, size, &length ) == napi_ok;
+}
+
+static napi_value init( napi_env env, napi_callback_info info )
+{
+   size_t argc = 1;
+   napi_value argv[1], result;
+   NAPI_CALL( env, napi_get_cb_info( env, info, &argc, argv, NULL, NULL ) );
+
+   if( engine_ready )
+      return throw_error( env, "The engine is already initialized" );
+
+   struct engine_options opts;
+   default_engine_options( &opts );
+
+   // Hashes are read through counters(), nothing may be written to the wrapper's stdout
+   opts.report_interval_ms = 0;
+
+   if( argc >= 1 )
+   {
+      uint64_t n;
+      char smt[16];
+
+      if( get_u64( env, argv[0], "threads", &n ) )
+         opts.threads = (int)n;
+      if( get_string( env, argv[0], "cpus", cpu_list, sizeof(cpu_list) ) )
+      {
+         opts.cpu_list = cpu_list;
+         opts.pin = true;
+      }
+      if( get_string( env, argv[0], "smt", smt, sizeof(smt) ) )
+      {
+         if( strcmp( smt, "core" ) && strcmp( smt, "all" ) )
+            return throw_error( env, "smt must be \"all\" or \"core\"" );
+         opts.smt = strcmp( smt, "core" ) ? SMT_ALL : SMT_CORE;
+         opts.pin = true;
+      }
+      get_bool( env, argv[0], "pin", &opts.pin );
+      if( get_u64( env, argv[0], "bufferCount", &n ) && n > 0 )
+         opts.buffer_count = (unsigned)n;
+      if( get_string( env, argv[0], "cacheDir", cache_dir, sizeof(cache_dir) ) )
+         opts.cache_dir = cache_dir;
+      if( get_u64( env, argv[0], "cacheSize", &n ) && n > 0 )
+         opts.cache_size = (unsigned)n;
+      get_bool( env, argv[0], "sharedMemory", &opts.shared_memory );
+      get_bool( env, argv[0], "lockMemory", &opts.lock_memory );
+   }
+
+   if( !init_engine( &engine, &opts ) )
+      return throw_error( env, "Could not initialize the search engine" );
+   engine_ready = true;
+
+   NAPI_CALL( env, napi_create_int32( env, engine.threads, &result ) );
+   return result;
+}
+
+static void execute_search( napi_env env, void* data )
+{
+   struct search_task* task = data;
+   (void)env;
+
+   set_job( &engine, &task->job );
+   if( atomic_load( &cancel_requested ) )
+      cancel_search( &engine );
+
+   int slot;
+   task->status = search_job( &engine, &task->nonce, &slot );
+   task->hashes = engine_hashes( &engine, 0 );
+}
+
+static void complete_search( napi_env env, napi_status status, void* data )
+{
+   struct search_task* task = data;
+   (void)status;
+   static const char* status_names[] = { "finished", "found", "cancelled" };
+   napi_value callback, global, argv[2], nonce, value;
+   unsigned char* bytes;
+
+   searching = false;
+
+   napi_get_reference_value( env, task->callback, &callback );
+   napi_get_global( env, &global );
+   napi_get_null( env, &argv[0] );
+   napi_create_object( env, &argv[1] );
+
+   napi_create_string_utf8( env, status_names[task->status], NAPI_AUTO_LENGTH, &value );
+   napi_set_named_property( env, argv[1], "status", value );
+   napi_create_double( env, (double)task->hashes, &value );
+   napi_set_named_property( env, argv[1], "hashes", value );
+
+   if( task->status == ENGINE_FOUND )
+   {
+      napi_create_buffer( env, FIELD_BYTES, (void**)&bytes, &nonce );
+      for( int i = 0; i < FIELD_BYTES; i++ )
+      {
+         int byte = FIELD_BYTES - 1 - i;
+         bytes[i] = (unsigned char)(task->nonce.array[byte / WORD_SIZE] >> (8 * (byte % WORD_SIZE)));
+      }
+      napi_set_named_property( env, argv[1], "nonce", nonce );
+   }
+
+   napi_delete_reference( env, task->callback );
+   napi_delete_async_work( env, task->work );
+   free( task );
+
+   napi_call_function( env, global, callback, 2, argv, NULL );
+}
+
+static napi_value search( napi_env env, napi_callback_info info )
+{
+   size_t argc = 2;
+   napi_value argv[2], name;
+   napi_valuetype type;
+   NAPI_CALL( env, napi_get_cb_info( env, info, &argc, argv, NULL, NULL ) );
+
+   if( !engine_ready )
+      return throw_error( env, "The engine is not initialized" );
+   if( searching )
+      return throw_error( env, "A search is already running" );
+   if( argc < 2 || napi_typeof( env, argv[1], &type ) != napi_ok || type != napi_function )
+      return throw_error( env, "search() takes a job and a callback" );
+
+   struct search_task* task = calloc( 1, sizeof(struct search_task) );
+   if( !task )
+      return throw_error( env, "Out of memory" );
+
+   struct miner_job* job = &task->job;
+   if( !get_field( env, argv[0], "minerAddress", &job->miner_address ) ||
+       !get_field( env, argv[0], "tipAddress", &job->tip_address ) ||
+       !get_field( env, argv[0], "blockHash", &job->block_hash ) ||
+       !get_field( env, argv[0], "target", &job->target ) ||
+       !get_field( env, argv[0], "nonceOffset", &job->nonce_offset ) ||
+       !get_u64( env, argv[0], "blockNumber", &job->block_num ) ||
+       !get_u64( env, argv[0], "tip", &job->tip ) ||
+       !get_u64( env, argv[0], "powHeight", &job->pow_height ) ||
+       !get_u64( env, argv[0], "threadIterations", &job->thread_iterations ) ||
+       !get_u64( env, argv[0], "hashLimit", &job->hash_limit ) )
+   {
+      free( task );
+      return throw_error( env, "Invalid job" );
+   }
+   // Ranges of no nonces would never get the search past its hash limit
+   if( !job->thread_iterations )
+   {
+      free( task );
+      return throw_error( env, "Invalid job: threadIterations must be at least 1" );
+   }
+
+   NAPI_CALL( env, napi_create_reference( env, argv[1], 1, &task->callback ) );
+   NAPI_CALL( env, napi_create_string_utf8( env, "koinos_miner.search", NAPI_AUTO_LENGTH, &name ) );
+   NAPI_CALL( env, napi_create_async_work( env, NULL, name, execute_search, complete_search, task, &task->work ) );
+
+   atomic_store( &cancel_requested, false );
+   searching = true;
+   NAPI_CALL( env, napi_queue_async_work( env, task->work ) );
+   return NULL;
+}
+
+static napi_value cancel( napi_env env, napi_callback_info info )
+{
+   (void)env; (void)info;
+   if( engine_ready )
+   {
+      atomic_store( &cancel_requested, true );
+      cancel_search( &engine );
+   }
+   return NULL;
+}
+
+static napi_value hint( napi_env env, napi_callback_info info )
+{
+   size_t argc = 1;
+   napi_value argv[1];
+   NAPI_CALL( env, napi_get_cb_info( env, info, &argc, argv, NULL, NULL ) );
+
+   if( !engine_ready )
+      return throw_error( env, "The engine is not initialized" );
+
+   struct bn seed;
+   if( argc < 1 || !buffer_to_field( env, argv[0], &seed ) )
+      return throw_error( env, "hint() takes a block hash Buffer" );
+
+   hint_seed( &engine, &seed );
+   return NULL;
+}
+
+static napi_value counters( napi_env env, napi_callback_info info )
+{
+   napi_value buffer, array;
+   (void)info;
+
+   if( !engine_ready )
+      return throw_error( env, "The engine is not initialized" );
+
+   // The counters live as long as the process, so the buffer never frees them
+   size_t bytes = engine.threads * sizeof(struct hash_counter);
+   NAPI_CALL( env, napi_create_external_arraybuffer( env, engine.reporter.counters, bytes, NULL, NULL, &buffer ) );
+   NAPI_CALL( env, napi_create_typedarray( env, napi_biguint64_array, bytes / sizeof(uint64_t), buffer, 0, &array ) );
+   return array;
+}
+
+static napi_value init_module( napi_env env, napi_value exports )
+{
+   napi_value stride;
+   napi_property_descriptor properties[] = {
+      { "init", NULL, init, NULL, NULL, NULL, napi_default, NULL },
+      { "search", NULL, search, NULL, NULL, NULL, napi_default, NULL },
+      { "cancel", NULL, cancel, NULL, NULL, NULL, napi_default, NULL },
+      { "hint", NULL, hint, NULL, NULL, NULL, napi_default, NULL },
+      { "counters", NULL, counters, NULL, NULL, NULL, napi_default, NULL }
+   };
+
+   NAPI_CALL( env, napi_define_properties( env, exports, sizeof(properties) / sizeof(properties[0]), properties ) );
+   NAPI_CALL( env, napi_create_uint32( env, sizeof(struct hash_counter) / sizeof(uint64_t), &stride ) );
+   NAPI_CALL( env, napi_set_named_property( env, exports, "counterStride", stride ) );
+   return exports;
+}
+
+NAPI_MODULE( koinos_miner, init_module )
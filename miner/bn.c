@@ -60,6 +60,9 @@ void bignum_from_int(struct bn* n, DTYPE_TMP i)
   DTYPE_TMP num_32 = 32;
   DTYPE_TMP tmp = i >> num_32; /* bit-shift with U64 operands to force 64-bit results */
   n->array[1] = tmp;
+ #elif (WORD_SIZE == 8)
+  n->array[0] = (DTYPE)i;
+  n->array[1] = (DTYPE)(i >> 64);
  #endif
 #endif
 }
@@ -80,7 +83,7 @@ int bignum_to_int(struct bn* n)
 #elif (WORD_SIZE == 2)
   ret += n->array[0];
   ret += n->array[1] << 16;
-#elif (WORD_SIZE == 4)
+#elif (WORD_SIZE == 4) || (WORD_SIZE == 8)
   ret += n->array[0];
 #endif
 
@@ -94,7 +97,6 @@ void bignum_from_string(struct bn* n, char* str, int nbytes)
   require(str, "str is null");
   require(nbytes > 0, "nbytes must be positive");
   require((nbytes & 1) == 0, "string format must be in hex -> equal number of bytes");
-  require((nbytes % (sizeof(DTYPE) * 2)) == 0, "string length must be a multiple of (sizeof(DTYPE) * 2) characters");
 
   bignum_init(n);
 
@@ -112,6 +114,22 @@ void bignum_from_string(struct bn* n, char* str, int nbytes)
     i -= (2 * WORD_SIZE); /* step WORD_SIZE hex-byte(s) back in the string. */
     j += 1;               /* step one element forward in the array. */
   }
+
+  /* A string that is not a whole number of elements long leaves a partial "MSB" element */
+  if ((i > -(2 * WORD_SIZE)) && (j < BN_ARRAY_SIZE))
+  {
+    char head[2 * WORD_SIZE + 1];
+    int len = i + (2 * WORD_SIZE);
+    for (i = 0; i < len; ++i)
+    {
+      head[i] = str[i];
+    }
+    head[len] = 0;
+
+    tmp = 0;
+    sscanf(head, SSCANF_FORMAT_STR, &tmp);
+    n->array[j] = tmp;
+  }
 }
 
 
@@ -600,6 +618,15 @@ void bignum_endian_swap(struct bn* n )
                   ((n->array[i] << 8)  & 0x00ff0000 ) | // Move byte 1 to byte 2
                   ((n->array[i] >> 8)  & 0x0000ff00 ) | // Move byte 2 to byte 1
                   ((n->array[i] >> 24) & 0x000000ff );  // Move byte 3 to byte 0
+   #elif (WORD_SIZE == 8)
+    n->array[i] = ((n->array[i] << 56) & 0xff00000000000000 ) | // Move byte 0 to byte 7
+                  ((n->array[i] << 40) & 0x00ff000000000000 ) | // Move byte 1 to byte 6
+                  ((n->array[i] << 24) & 0x0000ff0000000000 ) | // Move byte 2 to byte 5
+                  ((n->array[i] << 8)  & 0x000000ff00000000 ) | // Move byte 3 to byte 4
+                  ((n->array[i] >> 8)  & 0x00000000ff000000 ) | // Move byte 4 to byte 3
+                  ((n->array[i] >> 24) & 0x0000000000ff0000 ) | // Move byte 5 to byte 2
+                  ((n->array[i] >> 40) & 0x000000000000ff00 ) | // Move byte 6 to byte 1
+                  ((n->array[i] >> 56) & 0x00000000000000ff );  // Move byte 7 to byte 0
    #endif
   }
 
@@ -21,12 +21,18 @@ Thanks! :)
 */
 
 #include <stdint.h>
+#include <inttypes.h>
 #include <assert.h>
 
 
 /* This macro defines the word size in bytes of the array that constitues the big-number data structure. */
+/* 64-bit limbs need a 128-bit temporary, so they are the default only where the compiler has one. */
 #ifndef WORD_SIZE
-  #define WORD_SIZE 4
+  #ifdef __SIZEOF_INT128__
+    #define WORD_SIZE 8
+  #else
+    #define WORD_SIZE 4
+  #endif
 #endif
 
 /* Size of big-numbers in bytes */
@@ -34,9 +40,9 @@ Thanks! :)
 
 
 /* Here comes the compile-time specialization for how large the underlying array size should be. */
-/* The choices are 1, 2 and 4 bytes in size with uint32, uint64 for WORD_SIZE==4, as temporary. */
+/* The choices are 1, 2, 4 and 8 bytes in size with uint32, uint64 for WORD_SIZE==4, uint128 for WORD_SIZE==8, as temporary. */
 #ifndef WORD_SIZE
-  #error Must define WORD_SIZE to be 1, 2, 4
+  #error Must define WORD_SIZE to be 1, 2, 4 or 8
 #elif (WORD_SIZE == 1)
   /* Data type of array in structure */
   #define DTYPE                    uint8_t
@@ -63,6 +69,13 @@ Thanks! :)
   #define SPRINTF_FORMAT_STR       "%.08x"
   #define SSCANF_FORMAT_STR        "%8x"
   #define MAX_VAL                  ((DTYPE_TMP)0xFFFFFFFF)
+#elif (WORD_SIZE == 8)
+  #define DTYPE                    uint64_t
+  #define DTYPE_TMP                unsigned __int128
+  #define DTYPE_MSB                ((DTYPE_TMP)(0x8000000000000000))
+  #define SPRINTF_FORMAT_STR       "%.016" PRIx64
+  #define SSCANF_FORMAT_STR        "%16" SCNx64
+  #define MAX_VAL                  ((DTYPE_TMP)0xFFFFFFFFFFFFFFFF)
 #endif
 #ifndef DTYPE
   #error DTYPE must be defined to uint8_t, uint16_t uint32_t or whatever
@@ -119,4 +132,55 @@ void bignum_assign(struct bn* dst, struct bn* src);        /* Copy src into dst
 
 void bignum_endian_swap(struct bn* n);                     /* In place endiam swap on n */
 
+
+/* Inline versions of the operations on the mining hot path. */
+#ifdef __GNUC__
+  #define BN_LIKELY(x)             __builtin_expect(!!(x), 1)
+#else
+  #define BN_LIKELY(x)             (x)
+#endif
+
+static inline void bignum_fast_xor(struct bn* a, struct bn* b, struct bn* c) /* c = a ^ b */
+{
+  int i;
+  for (i = 0; i < BN_ARRAY_SIZE; ++i)
+  {
+    c->array[i] = (a->array[i] ^ b->array[i]);
+  }
+}
+
+/* Compare, deciding on the most significant limb alone unless it is equal, which
+   almost never happens when comparing a hash against a target */
+static inline int bignum_fast_cmp(struct bn* a, struct bn* b)
+{
+  if (BN_LIKELY(a->array[BN_ARRAY_SIZE - 1] != b->array[BN_ARRAY_SIZE - 1]))
+  {
+    return (a->array[BN_ARRAY_SIZE - 1] > b->array[BN_ARRAY_SIZE - 1]) ? LARGER : SMALLER;
+  }
+
+  int i = BN_ARRAY_SIZE - 1;
+  while (i != 0)
+  {
+    i -= 1;
+    if (a->array[i] != b->array[i])
+    {
+      return (a->array[i] > b->array[i]) ? LARGER : SMALLER;
+    }
+  }
+
+  return EQUAL;
+}
+
+static inline void bignum_fast_inc(struct bn* n)
+{
+  int i;
+  for (i = 0; i < BN_ARRAY_SIZE; ++i)
+  {
+    if (BN_LIKELY(++n->array[i] != 0))
+    {
+      break;
+    }
+  }
+}
+
 #endif /* #ifndef __BIGNUM_H__ */
@@ -0,0 +1,239 @@
+#include "buffer_cache.h"
+#include "work.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define CACHE_MAGIC       UINT64_C(0x313042574e494f4b) // "KOINWB01" read as a little endian word
+#define CACHE_HEADER_SIZE 4096                         // Keeps the words page aligned in the file
+#define CACHE_SUFFIX      ".wb"
+
+struct cache_header
+{
+   uint64_t   magic;
+   uint64_t   word_buffer_bytes;
+   struct bn  seed;
+   uint64_t   checksum;
+};
+
+// Multiply-rotate mix of every 64-bit word, far cheaper than regenerating the buffer
+static uint64_t checksum_words( const struct bn* words )
+{
+   const uint64_t* w = (const uint64_t*)words;
+   uint64_t h = UINT64_C(0x9E3779B97F4A7C15);
+
+   for( size_t i = 0; i < WORD_BUFFER_BYTES / sizeof(uint64_t); i++ )
+   {
+      h = (h ^ w[i]) * UINT64_C(0xFF51AFD7ED558CCD);
+      h = (h << 29) | (h >> 35);
+   }
+   return h;
+}
+
+#ifndef _WIN32
+
+static void cache_path( struct buffer_cache* cache, struct bn* seed, char* path, size_t size )
+{
+   char seed_str[78];
+   struct bn s;
+
+   // Named after the block hash as it appears in requests
+   bignum_assign( &s, seed );
+   bignum_endian_swap( &s );
+   bignum_to_string( &s, seed_str, sizeof(seed_str), true );
+   snprintf( path, size, "%s/%s" CACHE_SUFFIX, cache->dir, seed_str );
+}
+
+int buffer_cache_open( struct buffer_cache* cache, const char* dir, unsigned max_entries )
+{
+   if( strlen( dir ) >= sizeof(cache->dir) || max_entries == 0 )
+      return 0;
+
+   mkdir( dir, 0755 );
+
+   struct stat st;
+   if( stat( dir, &st ) || !S_ISDIR( st.st_mode ) )
+      return 0;
+
+   strcpy( cache->dir, dir );
+   cache->max_entries = max_entries;
+   return 1;
+}
+
+int buffer_cache_map( struct buffer_cache* cache, struct bn* seed, struct cache_mapping* mapping )
+{
+   char path[sizeof(cache->dir) + 96];
+   cache_path( cache, seed, path, sizeof(path) );
+
+   int fd = open( path, O_RDONLY );
+   if( fd < 0 )
+      return 0;
+
+   size_t length = CACHE_HEADER_SIZE + WORD_BUFFER_BYTES;
+   struct stat st;
+   void* p = MAP_FAILED;
+   if( fstat( fd, &st ) == 0 && (size_t)st.st_size == length )
+      p = mmap( NULL, length, PROT_READ, MAP_SHARED, fd, 0 );
+   close( fd );
+
+   if( p == MAP_FAILED )
+      return 0;
+
+   const struct cache_header* header = p;
+   struct bn* words = (struct bn*)((char*)p + CACHE_HEADER_SIZE);
+
+   if( header->magic != CACHE_MAGIC || header->word_buffer_bytes != WORD_BUFFER_BYTES
+      || memcmp( &header->seed, seed, sizeof(struct bn) ) || header->checksum != checksum_words( words ) )
+   {
+      fprintf(stderr, "[C] Discarding corrupt cached word buffer %s\n", path);
+      munmap( p, length );
+      unlink( path );
+      return 0;
+   }
+
+   // The modification time orders entries for eviction
+   utimensat( AT_FDCWD, path, NULL, 0 );
+
+   mapping->words = words;
+   mapping->base = p;
+   mapping->length = length;
+   return 1;
+}
+
+void buffer_cache_unmap( struct cache_mapping* mapping )
+{
+   if( mapping->base )
+      munmap( mapping->base, mapping->length );
+
+   mapping->words = NULL;
+   mapping->base = NULL;
+}
+
+struct cache_entry
+{
+   char    name[128];
+   time_t  mtime;
+};
+
+static int compare_entries( const void* a, const void* b )
+{
+   time_t ta = ((const struct cache_entry*)a)->mtime;
+   time_t tb = ((const struct cache_entry*)b)->mtime;
+   return (ta > tb) - (ta < tb);
+}
+
+static void evict( struct buffer_cache* cache )
+{
+   DIR* d = opendir( cache->dir );
+   if( !d )
+      return;
+
+   struct cache_entry* entries = NULL;
+   size_t count = 0, capacity = 0;
+   struct dirent* e;
+   char path[sizeof(cache->dir) + 256];
+
+   while( (e = readdir( d )) )
+   {
+      size_t len = strlen( e->d_name );
+      struct stat st;
+      if( len <= strlen( CACHE_SUFFIX ) || len >= sizeof(entries->name)
+         || strcmp( e->d_name + len - strlen( CACHE_SUFFIX ), CACHE_SUFFIX ) )
+         continue;
+
+      snprintf( path, sizeof(path), "%s/%s", cache->dir, e->d_name );
+      if( stat( path, &st ) )
+         continue;
+
+      if( count == capacity )
+      {
+         capacity = capacity ? 2 * capacity : 32;
+         struct cache_entry* grown = realloc( entries, capacity * sizeof(struct cache_entry) );
+         if( !grown )
+            break;
+         entries = grown;
+      }
+      strcpy( entries[count].name, e->d_name );
+      entries[count].mtime = st.st_mtime;
+      count++;
+   }
+   closedir( d );
+
+   if( count > cache->max_entries )
+   {
+      qsort( entries, count, sizeof(struct cache_entry), compare_entries );
+      for( size_t i = 0; i < count - cache->max_entries; i++ )
+      {
+         snprintf( path, sizeof(path), "%s/%s", cache->dir, entries[i].name );
+         unlink( path );
+      }
+   }
+
+   free( entries );
+}
+
+void buffer_cache_store( struct buffer_cache* cache, struct bn* seed, struct bn* words )
+{
+   char path[sizeof(cache->dir) + 96], tmp[sizeof(path) + 32];
+   cache_path( cache, seed, path, sizeof(path) );
+
+   // Write under a private name and rename, so readers never see a partial file
+   snprintf( tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid() );
+   int fd = open( tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+   if( fd < 0 )
+      return;
+
+   char header_page[CACHE_HEADER_SIZE] = { 0 };
+   struct cache_header header;
+   header.magic = CACHE_MAGIC;
+   header.word_buffer_bytes = WORD_BUFFER_BYTES;
+   bignum_assign( &header.seed, seed );
+   header.checksum = checksum_words( words );
+   memcpy( header_page, &header, sizeof(header) );
+
+   bool ok = write( fd, header_page, sizeof(header_page) ) == (ssize_t)sizeof(header_page)
+      && write( fd, words, WORD_BUFFER_BYTES ) == (ssize_t)WORD_BUFFER_BYTES;
+   ok = close( fd ) == 0 && ok;
+
+   if( !ok || rename( tmp, path ) )
+   {
+      fprintf(stderr, "[C] Could not write cached word buffer %s\n", path);
+      unlink( tmp );
+      return;
+   }
+
+   evict( cache );
+}
+
+#else
+
+int buffer_cache_open( struct buffer_cache* cache, const char* dir, unsigned max_entries )
+{
+   (void)cache; (void)dir; (void)max_entries; (void)checksum_words;
+   return 0;
+}
+
+int buffer_cache_map( struct buffer_cache* cache, struct bn* seed, struct cache_mapping* mapping )
+{
+   return 0;
+}
+
+void buffer_cache_unmap( struct cache_mapping* mapping )
+{
+}
+
+void buffer_cache_store( struct buffer_cache* cache, struct bn* seed, struct bn* words )
+{
+}
+
+#endif
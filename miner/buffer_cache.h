@@ -0,0 +1,41 @@
+#ifndef __BUFFER_CACHE_H__
+#define __BUFFER_CACHE_H__
+
+#include "bn.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Optional on-disk cache of generated word buffers, shared by restarts and by every
+ * miner process pointed at the same directory. Each buffer is a file named after its
+ * seed: a header page with the seed and a checksum of the words, then the words
+ * themselves, which later runs map read-only. The least recently used files are
+ * evicted once the directory holds more than max_entries buffers.
+ *
+ * Not available on Windows, where buffer_cache_open() fails.
+ */
+struct buffer_cache
+{
+   char      dir[1024];
+   unsigned  max_entries;
+};
+
+// A word buffer mapped from the cache
+struct cache_mapping
+{
+   struct bn*  words;
+   void*       base;
+   size_t      length;
+};
+
+int buffer_cache_open( struct buffer_cache* cache, const char* dir, unsigned max_entries );
+
+// Map the buffer for seed if the cache holds a valid one, returns 0 on a miss
+int buffer_cache_map( struct buffer_cache* cache, struct bn* seed, struct cache_mapping* mapping );
+void buffer_cache_unmap( struct cache_mapping* mapping );
+
+// Add a generated buffer, evicting the least recently used beyond max_entries
+void buffer_cache_store( struct buffer_cache* cache, struct bn* seed, struct bn* words );
+
+#endif /* #ifndef __BUFFER_CACHE_H__ */
@@ -0,0 +1,707 @@
+#include "daemon.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#define DAEMON_SLICE_MS        500   // Search time of one job before the next is scheduled
+#define DAEMON_BACKLOG          16
+#define DAEMON_SEND_TIMEOUT_S    5   // A client that stops reading for this long is dropped
+#define DAEMON_POLL_MS          10
+#define DAEMON_RETRY_MS        100
+
+#ifndef _WIN32
+
+/*
+ * Jobs are searched in slices of about DAEMON_SLICE_MS on the whole team, the client
+ * with the fewest hashes per unit of weight going next (stride scheduling), so the hash
+ * rate is split by weight however many clients there are. A slice searches whole ranges
+ * of thread_iterations nonces and the next one of the job resumes right after them,
+ * so slicing neither skips nor repeats nonces.
+ */
+struct client
+{
+   struct channel     channel;
+   int                fd;
+   pthread_t          reader;
+   struct daemon*     daemon;
+
+   uint32_t           weight;
+   double             pass;            // Hashes searched per unit of weight
+   bool               closed;          // The reader is done, free once not searching or reporting
+
+   bool               has_job;
+   struct miner_job   job;
+   uint64_t           serial;          // Tells the engine's current job apart
+   uint64_t           searched;        // Nonces past the job's first one already searched
+   bool               has_best;
+   struct proof       best;            // Lowest result of the job in share mode, over all slices
+   bool               has_next;
+   struct miner_job   next;            // Replaces the job at the next slice
+
+   uint64_t*          thread_hashes;   // Hashes of the job per thread, running slice excluded
+   uint64_t*          last;            // As of the last hash report
+   double*            rates;
+
+   // Taken under the lock and sent without it, a slow reader holds up no one else
+   bool               reporting;
+   uint32_t           report_id;
+   uint64_t           report_hashes;
+   double             report_rate;
+   struct client*     report_link;
+
+   struct client*     link;
+};
+
+struct daemon
+{
+   struct miner_engine*  engine;
+   enum protocol_mode    mode;
+   unsigned              report_interval_ms;
+   const char*           path;
+   int                   listen_fd;
+
+   pthread_mutex_t       lock;
+   pthread_cond_t        changed;
+   struct client*        clients;
+   int                   client_count;
+   struct client*        running;         // Owner of the slice being searched
+   uint64_t              engine_serial;   // Job the engine is set to, 0 for none
+   uint64_t              next_serial;
+   double                pass;            // Pass of the last client scheduled
+   double                rate;            // Hashes per second of the team, 0 until measured
+   bool                  shutdown;
+};
+
+static int signal_pipe[2] = { -1, -1 };
+
+static double monotonic_seconds()
+{
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void sleep_ms( unsigned ms )
+{
+   struct timespec ts;
+   ts.tv_sec = ms / 1000;
+   ts.tv_nsec = (long)(ms % 1000) * 1000000;
+   nanosleep( &ts, NULL );
+}
+
+static void on_signal( int sig )
+{
+   char c = (char)sig;
+   ssize_t written = write( signal_pipe[1], &c, 1 );
+   (void)written;
+}
+
+static void free_client( struct client* c )
+{
+   if( c->channel.in )
+      fclose( c->channel.in );
+   if( c->channel.out )
+      fclose( c->channel.out );
+   close_channel( &c->channel );
+   free( c->thread_hashes );
+   free( c->last );
+   free( c->rates );
+   free( c );
+}
+
+static uint64_t job_hashes( struct client* c, int threads )
+{
+   uint64_t total = 0;
+   for( int t = 0; t < threads; t++ )
+      total += c->thread_hashes[t];
+   return total;
+}
+
+static void* read_client( void* arg )
+{
+   struct client* c = arg;
+   struct daemon* d = c->daemon;
+   struct input_data input;
+   int kind;
+
+   while( (kind = read_data( &c->channel, &input )) != INPUT_CLOSED )
+   {
+      // Hints never preempt a search, they only warm up the next seed
+      if( kind == INPUT_HINT )
+      {
+         struct bn seed;
+         if( seed_from_input( &seed, &input ) )
+            hint_seed( d->engine, &seed );
+         continue;
+      }
+
+      // Never searched, the client's current job carries on
+      if( kind == INPUT_INVALID )
+      {
+         send_finished( &c->channel, input.request_id );
+         continue;
+      }
+
+      pthread_mutex_lock( &d->lock );
+      // A client has a single job, only the client's own weight applies
+      if( kind == INPUT_WEIGHT )
+      {
+         if( !input.request_id )
+            c->weight = input.weight ? input.weight : 1;
+      }
+      else
+      {
+         // A request that never started is answered right away, as on stdin
+         if( c->has_next )
+            send_preempted( &c->channel, c->next.request_id, 0 );
+         job_from_input( &c->next, &c->channel, &input );
+         c->has_next = true;
+         if( d->running == c )
+            cancel_search( d->engine );
+         pthread_cond_broadcast( &d->changed );
+      }
+      pthread_mutex_unlock( &d->lock );
+   }
+
+   pthread_mutex_lock( &d->lock );
+   c->closed = true;
+   if( d->running == c )
+      cancel_search( d->engine );
+   pthread_cond_broadcast( &d->changed );
+   pthread_mutex_unlock( &d->lock );
+
+   return NULL;
+}
+
+static int add_client( struct daemon* d, int fd )
+{
+   int threads = d->engine->threads;
+   struct client* c = calloc( 1, sizeof(struct client) );
+   if( !c )
+      return 0;
+
+   // Reading and writing go through separate streams, each closing its own descriptor
+   int out_fd = dup( fd );
+   FILE* in = fdopen( fd, "rb" );
+   FILE* out = out_fd >= 0 ? fdopen( out_fd, "wb" ) : NULL;
+   open_channel( &c->channel, in, out, d->mode );
+   c->fd = fd;
+   c->daemon = d;
+   c->weight = 1;
+   c->thread_hashes = calloc( threads, sizeof(uint64_t) );
+   c->last = calloc( threads, sizeof(uint64_t) );
+   c->rates = calloc( threads, sizeof(double) );
+
+   if( !in || !out || !c->thread_hashes || !c->last || !c->rates )
+   {
+      if( !in )
+         close( fd );
+      if( !out && out_fd >= 0 )
+         close( out_fd );
+      free_client( c );
+      return 0;
+   }
+
+   // A client that stops reading would otherwise hold up every other one
+   struct timeval timeout = { .tv_sec = DAEMON_SEND_TIMEOUT_S, .tv_usec = 0 };
+   setsockopt( fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout) );
+
+   // The wrapper sizes its per-thread batches from the team size
+   send_thread_count( &c->channel, threads );
+
+   pthread_mutex_lock( &d->lock );
+   c->pass = d->pass;
+   if( pthread_create( &c->reader, NULL, read_client, c ) )
+   {
+      pthread_mutex_unlock( &d->lock );
+      free_client( c );
+      return 0;
+   }
+   c->link = d->clients;
+   d->clients = c;
+   d->client_count++;
+   fprintf(stderr, "[C] Client connected, %d connected\n", d->client_count);
+   fflush(stderr);
+   pthread_mutex_unlock( &d->lock );
+
+   return 1;
+}
+
+static void* accept_clients( void* arg )
+{
+   struct daemon* d = arg;
+
+   for( ;; )
+   {
+      int fd = accept( d->listen_fd, NULL, NULL );
+
+      pthread_mutex_lock( &d->lock );
+      bool done = d->shutdown;
+      pthread_mutex_unlock( &d->lock );
+      if( done )
+      {
+         if( fd >= 0 )
+            close( fd );
+         break;
+      }
+
+      if( fd < 0 )
+      {
+         // Running out of descriptors or memory passes, keep accepting
+         if( errno != EINTR && errno != ECONNABORTED )
+         {
+            fprintf(stderr, "[C] Could not accept a client: %s\n", strerror( errno ));
+            fflush(stderr);
+            sleep_ms( DAEMON_RETRY_MS );
+         }
+         continue;
+      }
+
+      if( !add_client( d, fd ) )
+      {
+         fprintf(stderr, "[C] Could not set up a client\n");
+         fflush(stderr);
+      }
+   }
+
+   return NULL;
+}
+
+// Take c's report for the last elapsed seconds. Called with the lock held
+static void take_report( struct daemon* d, struct client* c, double elapsed )
+{
+   int threads = d->engine->threads;
+   uint64_t total = 0, total_delta = 0;
+
+   for( int t = 0; t < threads; t++ )
+   {
+      uint64_t hashes = c->thread_hashes[t];
+      if( d->running == c )
+         hashes += atomic_load_explicit( &job_counters( &d->engine->reporter, 0 )[t].hashes, memory_order_relaxed );
+      total += hashes;
+      total_delta += hashes - c->last[t];
+      c->rates[t] = (hashes - c->last[t]) / elapsed;
+      c->last[t] = hashes;
+   }
+
+   c->report_id = c->job.request_id;
+   c->report_hashes = total;
+   c->report_rate = total_delta / elapsed;
+   c->reporting = true;
+}
+
+/*
+ * Reports every job on a fixed monotonic clock interval, as the engine's reporter would.
+ * The reports are written without the lock, a client that stops reading blocks only
+ * this thread, until its send times out.
+ */
+static void* report_clients( void* arg )
+{
+   struct daemon* d = arg;
+   int threads = d->engine->threads;
+   double last = monotonic_seconds();
+   double next = last + d->report_interval_ms * 1e-3;
+
+   for( ;; )
+   {
+      struct client* reports = NULL;
+
+      pthread_mutex_lock( &d->lock );
+      bool done = d->shutdown;
+      double now = monotonic_seconds();
+      if( !done && now >= next )
+      {
+         for( struct client* c = d->clients; c; c = c->link )
+         {
+            if( c->has_job && !c->closed )
+            {
+               take_report( d, c, now - last );
+               c->report_link = reports;
+               reports = c;
+            }
+         }
+         last = now;
+         while( next <= now )
+            next += d->report_interval_ms * 1e-3;
+      }
+      pthread_mutex_unlock( &d->lock );
+
+      if( done )
+         break;
+
+      // A reporting client is not freed, and only this thread writes its rates
+      for( struct client* c = reports; c; c = c->report_link )
+         send_hash_report( &c->channel, c->report_id, c->report_hashes, c->report_rate, c->rates, threads );
+
+      if( reports )
+      {
+         pthread_mutex_lock( &d->lock );
+         for( struct client* c = reports; c; c = c->report_link )
+            c->reporting = false;
+         pthread_cond_broadcast( &d->changed );
+         pthread_mutex_unlock( &d->lock );
+      }
+
+      sleep_ms( DAEMON_POLL_MS );
+   }
+
+   return NULL;
+}
+
+// Stop the daemon, the scheduler returns once the running slice ends
+static void* watch_signals( void* arg )
+{
+   struct daemon* d = arg;
+   char c;
+
+   // Also returns when the daemon writes to the pipe itself
+   if( read( signal_pipe[0], &c, 1 ) == 1 && c )
+   {
+      fprintf(stderr, "[C] Signal %d, shutting down\n", c);
+      fflush(stderr);
+   }
+
+   pthread_mutex_lock( &d->lock );
+   d->shutdown = true;
+   if( d->running )
+      cancel_search( d->engine );
+   pthread_cond_broadcast( &d->changed );
+   pthread_mutex_unlock( &d->lock );
+
+   return NULL;
+}
+
+/*
+ * Drop closed clients, replace jobs by newer requests and pick the client to search
+ * next, NULL if no client has a job. Called with the lock held.
+ */
+static struct client* schedule( struct daemon* d )
+{
+   struct client* best = NULL;
+   struct client** p = &d->clients;
+
+   while( *p )
+   {
+      struct client* c = *p;
+
+      // A client that failed a write is waited on to notice its socket closing
+      if( c->channel.failed && !c->closed )
+         shutdown( c->fd, SHUT_RDWR );
+
+      if( c->closed && !c->reporting )
+      {
+         *p = c->link;
+         d->client_count--;
+         pthread_join( c->reader, NULL );
+         free_client( c );
+         fprintf(stderr, "[C] Client disconnected, %d connected\n", d->client_count);
+         fflush(stderr);
+         continue;
+      }
+
+      // Freed once its report is written
+      if( c->closed )
+      {
+         p = &c->link;
+         continue;
+      }
+
+      if( c->has_next )
+      {
+         if( c->has_job )
+         {
+            if( c->has_best )
+               send_best( &c->channel, c->job.request_id, &c->best.nonce, &c->best.result );
+            send_preempted( &c->channel, c->job.request_id, job_hashes( c, d->engine->threads ) );
+         }
+         else if( c->pass < d->pass )
+         {
+            // A client that was idle does not get to catch up on the others
+            c->pass = d->pass;
+         }
+
+         c->job = c->next;
+         c->serial = ++d->next_serial;
+         c->searched = 0;
+         c->has_best = false;
+         c->has_job = true;
+         c->has_next = false;
+         memset( c->thread_hashes, 0, d->engine->threads * sizeof(uint64_t) );
+         memset( c->last, 0, d->engine->threads * sizeof(uint64_t) );
+      }
+
+      if( c->has_job && (!best || c->pass < best->pass) )
+         best = c;
+
+      p = &c->link;
+   }
+
+   if( best )
+      d->pass = best->pass;
+   return best;
+}
+
+// Search one slice of c's job. Called with the lock held, which is released meanwhile
+static void search_slice( struct daemon* d, struct client* c )
+{
+   struct miner_engine* engine = d->engine;
+   char bn_str[78];
+
+   // Whole ranges for about DAEMON_SLICE_MS, at least one for every thread
+   uint64_t iterations = c->job.thread_iterations;
+   uint64_t ranges = (uint64_t)(d->rate * DAEMON_SLICE_MS * 1e-3 / iterations);
+   if( ranges < (uint64_t)engine->threads )
+      ranges = engine->threads;
+   uint64_t limit = (ranges - 1) * iterations;
+   if( limit > c->job.hash_limit - c->searched )
+      limit = c->job.hash_limit - c->searched;
+
+   struct miner_job job = c->job;
+   uint64_t offset = c->searched;
+   bool fresh = c->serial != d->engine_serial;
+   d->engine_serial = c->serial;
+   d->running = c;
+   reset_hash_counters( &engine->reporter, 0 );
+   pthread_mutex_unlock( &d->lock );
+
+   if( fresh )
+      set_job( engine, &job );
+   set_job_range( engine, offset, limit );
+
+   // Setting the range cleared any cancellation that arrived in the meantime
+   pthread_mutex_lock( &d->lock );
+   if( c->has_next || c->closed || d->shutdown )
+      cancel_search( engine );
+   pthread_mutex_unlock( &d->lock );
+
+   struct bn nonce;
+   int slot;
+   double start = monotonic_seconds();
+   enum engine_status status = search_job( engine, &nonce, &slot );
+   double elapsed = monotonic_seconds() - start;
+
+   pthread_mutex_lock( &d->lock );
+   d->running = NULL;
+
+   uint64_t hashes = 0;
+   for( int t = 0; t < engine->threads; t++ )
+   {
+      uint64_t h = atomic_load( &job_counters( &engine->reporter, 0 )[t].hashes );
+      c->thread_hashes[t] += h;
+      hashes += h;
+   }
+   c->pass += (double)hashes / c->weight;
+   if( hashes && elapsed > 0 )
+      d->rate = d->rate ? (d->rate + hashes / elapsed) / 2 : hashes / elapsed;
+
+   // The engine's best starts over whenever another client's job ran in between
+   struct proof best;
+   if( job_best( engine, 0, &best ) && (!c->has_best || bignum_cmp( &best.result, &c->best.result ) < 0) )
+   {
+      c->best = best;
+      c->has_best = true;
+   }
+
+   if( status == ENGINE_FOUND )
+   {
+      if( c->has_best )
+         send_best( &c->channel, job.request_id, &c->best.nonce, &c->best.result );
+      send_nonce( &c->channel, job.request_id, &nonce );
+      c->has_job = false;
+
+      bignum_to_string( &nonce, bn_str, sizeof(bn_str), false );
+      fprintf(stderr, "[C] Nonce: %s\n", bn_str);
+      fflush(stderr);
+   }
+   else if( status == ENGINE_FINISHED )
+   {
+      c->searched += (limit / iterations + 1) * iterations;
+      if( c->searched > job.hash_limit )
+      {
+         if( c->has_best )
+            send_best( &c->channel, job.request_id, &c->best.nonce, &c->best.result );
+         send_finished( &c->channel, job.request_id );
+         c->has_job = false;
+
+         fprintf(stderr, "[C] Finished without nonce\n");
+         fflush(stderr);
+      }
+   }
+}
+
+// A socket at path, replacing one left behind by a daemon that is gone. Returns -1 on error
+static int listen_on( const char* path )
+{
+   struct sockaddr_un addr;
+   memset( &addr, 0, sizeof(addr) );
+   addr.sun_family = AF_UNIX;
+   if( strlen( path ) >= sizeof(addr.sun_path) )
+   {
+      fprintf(stderr, "[C] Socket path is too long: %s\n", path);
+      return -1;
+   }
+   strcpy( addr.sun_path, path );
+
+   int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+   if( fd < 0 )
+   {
+      fprintf(stderr, "[C] Could not create a socket: %s\n", strerror( errno ));
+      return -1;
+   }
+   if( connect( fd, (struct sockaddr*)&addr, sizeof(addr) ) == 0 )
+   {
+      fprintf(stderr, "[C] Another daemon is listening on %s\n", path);
+      close( fd );
+      return -1;
+   }
+   struct stat st;
+   if( errno == ECONNREFUSED && lstat( path, &st ) == 0 && S_ISSOCK( st.st_mode ) )
+      unlink( path );
+   close( fd );
+
+   fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+   if( fd < 0 || bind( fd, (struct sockaddr*)&addr, sizeof(addr) ) || listen( fd, DAEMON_BACKLOG ) )
+   {
+      fprintf(stderr, "[C] Could not listen on %s: %s\n", path, strerror( errno ));
+      if( fd >= 0 )
+         close( fd );
+      return -1;
+   }
+
+   return fd;
+}
+
+// Wake the accept thread, which checks for shutdown after every client
+static void wake_listener( struct daemon* d )
+{
+   struct sockaddr_un addr;
+   memset( &addr, 0, sizeof(addr) );
+   addr.sun_family = AF_UNIX;
+   strcpy( addr.sun_path, d->path );
+
+   int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+   if( fd >= 0 )
+   {
+      connect( fd, (struct sockaddr*)&addr, sizeof(addr) );
+      close( fd );
+   }
+}
+
+int run_daemon( struct miner_engine* engine, const char* path, enum protocol_mode mode, unsigned report_interval_ms )
+{
+   struct daemon d;
+   memset( &d, 0, sizeof(d) );
+   d.engine = engine;
+   d.mode = mode;
+   d.report_interval_ms = report_interval_ms;
+   d.path = path;
+   pthread_mutex_init( &d.lock, NULL );
+   pthread_cond_init( &d.changed, NULL );
+
+   // Writes to a client that went away fail instead of killing the daemon
+   signal( SIGPIPE, SIG_IGN );
+
+   d.listen_fd = listen_on( path );
+   if( d.listen_fd < 0 )
+   {
+      return 0;
+   }
+
+   if( pipe( signal_pipe ) )
+   {
+      fprintf(stderr, "[C] Could not create the signal pipe\n");
+      close( d.listen_fd );
+      unlink( path );
+      return 0;
+   }
+   struct sigaction sa;
+   memset( &sa, 0, sizeof(sa) );
+   sa.sa_handler = on_signal;
+   sigemptyset( &sa.sa_mask );
+   sigaction( SIGINT, &sa, NULL );
+   sigaction( SIGTERM, &sa, NULL );
+
+   pthread_t watcher, listener, reporter;
+   bool watching = pthread_create( &watcher, NULL, watch_signals, &d ) == 0;
+   bool listening = watching && pthread_create( &listener, NULL, accept_clients, &d ) == 0;
+   bool reporting = listening && pthread_create( &reporter, NULL, report_clients, &d ) == 0;
+   if( !reporting )
+   {
+      fprintf(stderr, "[C] Could not start the daemon threads\n");
+   }
+   else
+   {
+      fprintf(stderr, "[C] Listening on %s\n", path);
+      fflush(stderr);
+   }
+
+   pthread_mutex_lock( &d.lock );
+   while( reporting && !d.shutdown )
+   {
+      struct client* c = schedule( &d );
+      if( c )
+         search_slice( &d, c );
+      else
+         pthread_cond_wait( &d.changed, &d.lock );
+   }
+
+   // Closing the sockets ends every reader
+   for( struct client* c = d.clients; c; c = c->link )
+      shutdown( c->fd, SHUT_RDWR );
+   d.shutdown = true;
+   pthread_mutex_unlock( &d.lock );
+
+   if( watching )
+   {
+      on_signal( 0 );
+      pthread_join( watcher, NULL );
+   }
+   if( listening )
+   {
+      wake_listener( &d );
+      pthread_join( listener, NULL );
+   }
+   if( reporting )
+      pthread_join( reporter, NULL );
+
+   while( d.clients )
+   {
+      struct client* c = d.clients;
+      d.clients = c->link;
+      pthread_join( c->reader, NULL );
+      free_client( c );
+   }
+
+   close( d.listen_fd );
+   unlink( path );
+   close( signal_pipe[0] );
+   close( signal_pipe[1] );
+   fprintf(stderr, "[C] Daemon stopped\n");
+   fflush(stderr);
+
+   return reporting;
+}
+
+#else
+
+int run_daemon( struct miner_engine* engine, const char* path, enum protocol_mode mode, unsigned report_interval_ms )
+{
+   fprintf(stderr, "[C] The daemon needs Unix domain sockets, which are not supported on this platform\n");
+   return 0;
+}
+
+#endif
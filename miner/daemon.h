@@ -0,0 +1,20 @@
+#ifndef __DAEMON_H__
+#define __DAEMON_H__
+
+#include "engine.h"
+#include "protocol.h"
+
+/*
+ * Serve any number of wrappers from one engine, so they share its threads and word
+ * buffers instead of each running a miner of its own. Wrappers connect to a Unix domain
+ * socket at path and speak the protocol of mode over it, each with its own request ids
+ * and responses. Every wrapper has at most one job, a newer request preempting it as on
+ * stdin even if it asks to join, and the hash rate is split between the wrappers with a
+ * job by their weights.
+ *
+ * The engine must not run a reporter of its own, the daemon reports every wrapper's job
+ * every report_interval_ms. Runs until SIGINT or SIGTERM, returns 0 on error.
+ */
+int run_daemon( struct miner_engine* engine, const char* path, enum protocol_mode mode, unsigned report_interval_ms );
+
+#endif /* #ifndef __DAEMON_H__ */
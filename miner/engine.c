@@ -0,0 +1,727 @@
+#include "engine.h"
+#include "keccak256.h"
+#include "protocol.h"
+
+#include <inttypes.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PERCENT_100         10000
+
+#define HASH_REPORT_INTERVAL_MS 1000
+
+#define BUFFER_CACHE_SIZE 16 // Buffers kept in the cache directory
+#define WORD_BUFFER_COUNT  4 // Buffers kept in memory
+
+#define NO_PROOF -1
+
+/*
+ * Solidity definition:
+ *
+ * address[] memory recipients,
+ * uint256[] memory split_percents,
+ * uint256 recent_eth_block_number,
+ * uint256 recent_eth_block_hash,
+ * uint256 target,
+ * uint256 pow_height
+ */
+struct secured_struct
+{
+   struct bn miner_address;
+   struct bn oo_address;
+   struct bn miner_percent;
+   struct bn oo_percent;
+   struct bn recent_eth_block_number;
+   struct bn recent_eth_block_hash;
+   struct bn target;
+   struct bn pow_height;
+};
+
+static void hash_secured_struct( struct bn* res, struct secured_struct* ss )
+{
+   /* Solidity ABI encodes as follows:
+    *
+    * Offset pointer to recipient array (256 bits big endian)
+    * Offset pointer to split_perecents array (256 bits big endian)
+    * recent_eth_block_number (256 bit big endian)
+    * recent_eth_block_hash (256 bit big endian)
+    * target (256 bit big endian)
+    * pow_height (256 bit big endian)
+    * size of recipient array (256 bit big endian)
+    * miner_address
+    * oo_address
+    * size of split_percent_array (256 bit big endian)
+    * miner_percent
+    * recipient_offset
+    */
+
+   struct bn recipient_offset, split_percent_offset, array_size;
+   bignum_from_int( &recipient_offset, 6 * 32 );
+   bignum_endian_swap( &recipient_offset );
+   bignum_from_int( &split_percent_offset, 9 * 32 );
+   bignum_endian_swap( &split_percent_offset );
+   bignum_from_int( &array_size, 2 );
+   bignum_endian_swap( &array_size );
+
+   bignum_endian_swap( &ss->target );
+
+   SHA3_CTX c;
+   keccak_init( &c );
+   keccak_update( &c, (unsigned char*)&recipient_offset, sizeof(struct bn) );
+   keccak_update( &c, (unsigned char*)&split_percent_offset, sizeof(struct bn) );
+   keccak_update( &c, (unsigned char*)&ss->recent_eth_block_number, sizeof(struct bn) );
+   keccak_update( &c, (unsigned char*)&ss->recent_eth_block_hash, sizeof(struct bn) );
+   keccak_update( &c, (unsigned char*)&ss->target, sizeof(struct bn) );
+   keccak_update( &c, (unsigned char*)&ss->pow_height, sizeof(struct bn) );
+   keccak_update( &c, (unsigned char*)&array_size, sizeof(struct bn) );
+   keccak_update( &c, (unsigned char*)&ss->miner_address, sizeof(struct bn) );
+   keccak_update( &c, (unsigned char*)&ss->oo_address, sizeof(struct bn) );
+   keccak_update( &c, (unsigned char*)&array_size, sizeof(struct bn) );
+   keccak_update( &c, (unsigned char*)&ss->miner_percent, sizeof(struct bn) );
+   keccak_update( &c, (unsigned char*)&ss->oo_percent, sizeof(struct bn) );
+   keccak_final( &c, (unsigned char*)res );
+
+   bignum_endian_swap( res );
+   bignum_endian_swap( &ss->target );
+}
+
+
+// Hashes of thread t over every job
+static uint64_t thread_hashes( struct hash_reporter* reporter, int t )
+{
+   uint64_t total = 0;
+   for( int j = 0; j < reporter->jobs; j++ )
+      total += atomic_load( &job_counters( reporter, j )[t].hashes );
+   return total;
+}
+
+// Hash rate per domain since start_hashes, and per thread relative to the best domain's
+static void report_domain_scaling( struct topology* topo, struct hash_reporter* reporter, int* thread_domain, uint64_t* start_hashes, double elapsed )
+{
+   double best = 0;
+   double* rate = calloc( topo->domains, sizeof(double) );
+   int* threads = calloc( topo->domains, sizeof(int) );
+
+   for( int t = 0; t < reporter->threads; t++ )
+   {
+      int d = thread_domain[t];
+      if( d < 0 || d >= topo->domains )
+         continue;
+      rate[d] += (thread_hashes( reporter, t ) - start_hashes[t]) / elapsed;
+      threads[d]++;
+   }
+
+   for( int d = 0; d < topo->domains; d++ )
+   {
+      if( threads[d] && rate[d] / threads[d] > best )
+         best = rate[d] / threads[d];
+   }
+
+   for( int d = 0; d < topo->domains; d++ )
+   {
+      if( !threads[d] )
+         continue;
+      fprintf(stderr, "[C] %s %d: %d threads, %.0f H/s, %.0f H/s per thread, %.0f%% scaling efficiency\n",
+         topo->kind, d, threads[d], rate[d], rate[d] / threads[d], best > 0 ? 100 * rate[d] / threads[d] / best : 0);
+   }
+   fflush(stderr);
+
+   free( rate );
+   free( threads );
+}
+
+
+void default_engine_options( struct engine_options* opts )
+{
+   opts->auto_prefetch = true;
+   opts->prefetch_distance = 0;
+   opts->lock_memory = false;
+   opts->report_interval_ms = HASH_REPORT_INTERVAL_MS;
+   opts->cache_dir = NULL;
+   opts->cache_size = BUFFER_CACHE_SIZE;
+   opts->buffer_count = WORD_BUFFER_COUNT;
+   opts->shared_memory = false;
+   opts->topology = TOPOLOGY_AUTO;
+   opts->threads = 0;
+   opts->cpu_list = NULL;
+   opts->smt = SMT_ALL;
+   opts->pin = false;
+}
+
+// Size the OpenMP team and pin it, returns the team size or 0 on error
+static int place_threads( struct miner_engine* engine )
+{
+   struct engine_options* opts = &engine->opts;
+
+   int quota;
+   int cpus = effective_cpus( &quota );
+   if( quota )
+   {
+      fprintf(stderr, "[C] CPU quota: %d cpus\n", quota);
+   }
+
+   // Without an explicit size the team matches the cpus the cgroup lets us keep busy,
+   // as OpenMP would otherwise start a thread for every cpu it sees and get throttled
+   int threads = opts->threads;
+   if( !threads && !getenv( "OMP_NUM_THREADS" ) )
+   {
+      threads = cpus;
+   }
+
+   // Pinning is opt-in, without it the placement is left to OpenMP
+   engine->placement = NULL;
+   if( opts->pin )
+   {
+      threads = plan_placement( &engine->topo, opts->cpu_list, opts->smt, opts->threads, &engine->placement );
+      if( !threads )
+      {
+         return 0;
+      }
+      if( !opts->threads && quota && quota < threads )
+      {
+         threads = quota;
+      }
+      omp_set_num_threads( threads );
+
+      int* placement = engine->placement;
+      #pragma omp parallel
+      pin_thread( placement[omp_get_thread_num()] );
+
+      fprintf(stderr, "[C] Thread placement:");
+      for( int t = 0; t < threads; t++ )
+      {
+         fprintf(stderr, " %d:cpu%d", t, placement[t]);
+      }
+      fprintf(stderr, "\n");
+   }
+   else if( threads )
+   {
+      omp_set_num_threads( threads );
+   }
+   fprintf(stderr, "[C] Search threads: %d\n", omp_get_max_threads());
+   fflush(stderr);
+
+   return omp_get_max_threads();
+}
+
+int init_engine( struct miner_engine* engine, const struct engine_options* opts )
+{
+   engine->opts = *opts;
+   opts = &engine->opts;
+   atomic_init( &engine->stop, false );
+   pthread_mutex_init( &engine->pause_lock, NULL );
+   pthread_cond_init( &engine->resumed, NULL );
+
+   bool use_cache = false;
+   if( opts->cache_dir )
+   {
+      use_cache = buffer_cache_open( &engine->cache, opts->cache_dir, opts->cache_size );
+      if( use_cache )
+         fprintf(stderr, "[C] Word buffer cache: %s (%u buffers)\n", opts->cache_dir, opts->cache_size);
+      else
+         fprintf(stderr, "[C] Word buffer cache %s is not usable, continuing without it\n", opts->cache_dir);
+   }
+
+   if( !init_word_buffers( &engine->buffers, opts->buffer_count, opts->lock_memory, opts->shared_memory, use_cache ? &engine->cache : NULL ) )
+   {
+      fprintf(stderr, "[C] Could not allocate the word buffers\n");
+      return 0;
+   }
+   fprintf(stderr, "[C] Word buffers: %u, %s%s\n", engine->buffers.count, word_buffer_mode_name( engine->buffers.entries[0].alloc.mode ),
+      engine->buffers.entries[0].alloc.locked ? ", locked" : "");
+
+   init_work_constants();
+   if( !verify_fast_reductions() )
+   {
+      fprintf(stderr, "[C] Fast modular reductions disagree with division, aborting\n");
+      return 0;
+   }
+
+   keccak_select_kernel();
+   fprintf(stderr, "[C] Keccak kernel: %s (%u lanes)\n", keccak_kernel_name(), keccak_kernel_lanes());
+   select_search_kernel();
+   fprintf(stderr, "[C] Search kernel: %s (%u nonces)\n", search_kernel_name(), search_kernel_lanes());
+   if( !opts->auto_prefetch )
+   {
+      set_prefetch_distance( opts->prefetch_distance );
+      fprintf(stderr, "[C] Prefetch distance: %u nonces\n", get_prefetch_distance());
+   }
+   fflush(stderr);
+
+   // Private replicas of a shared buffer would bring back a copy per process in every cache
+   enum topology_policy policy = opts->shared_memory ? TOPOLOGY_OFF : opts->topology;
+   if( !detect_topology( &engine->topo, policy, opts->lock_memory ) )
+   {
+      fprintf(stderr, "[C] Could not allocate the word buffer replicas\n");
+      return 0;
+   }
+   if( engine->topo.replicas )
+      fprintf(stderr, "[C] Word buffer replicas: %d (per %s)\n", engine->topo.domains, engine->topo.kind);
+   else if( opts->shared_memory && opts->topology != TOPOLOGY_OFF )
+      fprintf(stderr, "[C] Word buffer replicas: 1 (not replicated, the buffer is in shared memory)\n");
+   else
+      fprintf(stderr, "[C] Word buffer replicas: 1 (not replicated)\n");
+
+   engine->threads = place_threads( engine );
+   if( !engine->threads )
+   {
+      return 0;
+   }
+
+   engine->thread_domain = malloc( engine->threads * sizeof(int) );
+   engine->start_hashes = malloc( engine->threads * sizeof(uint64_t) );
+   if( !engine->thread_domain || !engine->start_hashes || !init_hash_reporter( &engine->reporter, engine->threads, ENGINE_MAX_JOBS, opts->report_interval_ms ) )
+   {
+      fprintf(stderr, "[C] Could not allocate the hash counters\n");
+      return 0;
+   }
+
+   for( int i = 0; i < ENGINE_MAX_JOBS; i++ )
+   {
+      struct job_slot* s = &engine->slots[i];
+      s->proofs = malloc( engine->threads * sizeof(struct proof) );
+      s->shares = malloc( engine->threads * sizeof(struct share_sink) );
+      if( !s->proofs || !s->shares )
+      {
+         fprintf(stderr, "[C] Could not allocate the proofs\n");
+         return 0;
+      }
+      atomic_init( &s->state, JOB_IDLE );
+      atomic_init( &s->winner, NO_PROOF );
+      atomic_init( &s->weight, 0 );
+      atomic_init( &s->next_offset, 0 );
+      atomic_init( &s->busy, 0 );
+      atomic_init( &s->exhausted, false );
+   }
+   atomic_init( &engine->ticket, 0 );
+
+   engine->word_buffer = NULL;
+   return 1;
+}
+
+void hint_seed( struct miner_engine* engine, struct bn* seed )
+{
+   struct bn swapped;
+   bignum_assign( &swapped, seed );
+   bignum_endian_swap( &swapped );
+   hint_word_buffer( &engine->buffers, &swapped );
+}
+
+// Shares are sent by the thread that found them, while the search goes on
+static void send_job_share( void* context, struct bn* nonce, struct bn* result )
+{
+   struct job_slot* s = context;
+   if( s->job.channel )
+      send_share( s->job.channel, s->job.request_id, nonce, result );
+}
+
+// Ready job in slot, whose word buffer is the current one
+static void init_slot( struct miner_engine* engine, int slot, const struct miner_job* new_job, unsigned weight )
+{
+   char bn_str[78];
+   struct secured_struct ss;
+   struct job_slot* s = &engine->slots[slot];
+
+   s->job = *new_job;
+   struct miner_job* job = &s->job;
+
+   bignum_assign( &ss.miner_address, &job->miner_address );
+   bignum_assign( &ss.oo_address, &job->tip_address );
+
+   bignum_to_string( &ss.miner_address, bn_str, sizeof(bn_str), false );
+   fprintf(stderr, "[C] Miner Address: %s\n", bn_str);
+
+   bignum_to_string( &ss.oo_address, bn_str, sizeof(bn_str), false );
+   fprintf(stderr, "[C] OpenOrchard Address: %s\n", bn_str);
+   fflush(stderr);
+
+   bignum_endian_swap( &ss.miner_address );
+   bignum_endian_swap( &ss.oo_address );
+
+   uint64_t miner_pay = PERCENT_100 - job->tip;
+   uint64_t oo_pay    = job->tip;
+
+   fprintf(stderr, "[C] Miner pay: %" PRIu64 "\n", miner_pay);
+   fprintf(stderr, "[C] OpenOrchard tip: %" PRIu64 "\n", oo_pay);
+
+   bignum_from_int( &ss.miner_percent, PERCENT_100 - job->tip );
+   bignum_endian_swap( &ss.miner_percent );
+   bignum_from_int( &ss.oo_percent, job->tip );
+   bignum_endian_swap( &ss.oo_percent );
+   bignum_from_int( &ss.recent_eth_block_number, job->block_num );
+   bignum_endian_swap( &ss.recent_eth_block_number );
+
+   bignum_assign( &ss.recent_eth_block_hash, &job->block_hash );
+   bignum_endian_swap( &ss.recent_eth_block_hash );
+
+   bignum_assign( &ss.target, &job->target );
+
+   bignum_from_int( &ss.pow_height, job->pow_height );
+   bignum_endian_swap( &ss.pow_height );
+
+   bignum_to_string( &ss.target, bn_str, sizeof(bn_str), true );
+   fprintf(stderr, "[C] Difficulty Target: %s\n", bn_str);
+   fflush(stderr);
+
+   hash_secured_struct( &s->secured_struct_hash, &ss );
+
+   bignum_to_string( &s->secured_struct_hash, bn_str, sizeof(bn_str), true);
+   fprintf(stderr, "[C] Secured Struct Hash: %s\n", bn_str );
+
+   bignum_add( &job->block_hash, &job->nonce_offset, &s->nonce );
+
+   bignum_to_string( &s->nonce, bn_str, sizeof(bn_str), true );
+   fprintf(stderr, "[C] Starting Nonce: %s\n", bn_str );
+
+   init_work_data( &s->wdata, &s->secured_struct_hash );
+
+   if( !bignum_is_zero( &job->share_target ) )
+   {
+      bignum_to_string( &job->share_target, bn_str, sizeof(bn_str), true );
+      fprintf(stderr, "[C] Share Target: %s\n", bn_str );
+      for( int t = 0; t < engine->threads; t++ )
+         init_share_sink( s->shares + t, &job->share_target, send_job_share, s );
+   }
+
+   atomic_store( &s->winner, NO_PROOF );
+   atomic_store( &s->weight, weight );
+   atomic_store( &s->next_offset, 0 );
+   atomic_store( &s->busy, 0 );
+   atomic_store( &s->exhausted, false );
+   reset_hash_counters( &engine->reporter, slot );
+   report_job( &engine->reporter, slot, job->channel, job->request_id );
+   atomic_store( &s->state, JOB_ACTIVE );
+}
+
+void set_job( struct miner_engine* engine, const struct miner_job* new_job )
+{
+   char bn_str[78];
+
+   // The team size is a setting of the calling thread, and jobs may come from any thread
+   omp_set_num_threads( engine->threads );
+   atomic_store( &engine->stop, false );
+
+   for( int i = 0; i < ENGINE_MAX_JOBS; i++ )
+   {
+      atomic_store( &engine->slots[i].state, JOB_IDLE );
+      report_job( &engine->reporter, i, NULL, 0 );
+   }
+
+   struct bn seed;
+   engine->block_hash = new_job->block_hash;
+   bignum_assign( &seed, &engine->block_hash );
+   bignum_endian_swap( &seed );
+   engine->word_buffer = use_word_buffer( &engine->buffers, &seed );
+   replicate_word_buffer( &engine->topo, engine->word_buffer, &seed );
+
+   bignum_to_string( &seed, bn_str, sizeof(bn_str), true );
+   fprintf(stderr, "[C] Seed: %s\n", bn_str);
+
+   init_slot( engine, 0, new_job, 1 );
+
+   // The best distance depends on the memory system, tune it once on a real buffer
+   if( engine->opts.auto_prefetch )
+   {
+      struct job_slot* s = &engine->slots[0];
+      fprintf(stderr, "[C] Prefetch distance: %u nonces (auto)\n", tune_prefetch_distance( &s->wdata, &s->secured_struct_hash, engine->word_buffer ));
+      fflush(stderr);
+      engine->opts.auto_prefetch = false;
+   }
+}
+
+int add_job( struct miner_engine* engine, const struct miner_job* job, unsigned weight )
+{
+   struct bn block_hash = job->block_hash;
+   if( !engine->word_buffer || bignum_cmp( &block_hash, &engine->block_hash ) != 0 )
+   {
+      return -1;
+   }
+
+   for( int i = 0; i < ENGINE_MAX_JOBS; i++ )
+   {
+      if( atomic_load( &engine->slots[i].state ) == JOB_IDLE )
+      {
+         fprintf(stderr, "[C] Job %d, weight %u\n", i, weight);
+         init_slot( engine, i, job, weight );
+         atomic_store( &engine->stop, false );
+         return i;
+      }
+   }
+
+   return -1;
+}
+
+// Wake the threads waiting on paused jobs, after a weight or the stop flag was stored
+static void wake_paused( struct miner_engine* engine )
+{
+   pthread_mutex_lock( &engine->pause_lock );
+   pthread_cond_broadcast( &engine->resumed );
+   pthread_mutex_unlock( &engine->pause_lock );
+}
+
+void set_job_weight( struct miner_engine* engine, int slot, unsigned weight )
+{
+   atomic_store( &engine->slots[slot].weight, weight );
+   wake_paused( engine );
+}
+
+void set_job_range( struct miner_engine* engine, uint64_t offset, uint64_t hash_limit )
+{
+   struct job_slot* s = &engine->slots[0];
+   struct bn first, t_offset;
+
+   atomic_store( &engine->stop, false );
+
+   bignum_add( &s->job.block_hash, &s->job.nonce_offset, &first );
+   bignum_from_int( &t_offset, offset );
+   bignum_add( &first, &t_offset, &s->nonce );
+   s->job.hash_limit = hash_limit;
+
+   atomic_store( &s->winner, NO_PROOF );
+   atomic_store( &s->next_offset, 0 );
+   atomic_store( &s->busy, 0 );
+   atomic_store( &s->exhausted, false );
+   report_job( &engine->reporter, 0, s->job.channel, s->job.request_id );
+   atomic_store( &s->state, JOB_ACTIVE );
+}
+
+/*
+ * A job with unclaimed ranges, picked by weight, or NULL if there is none. Sets *paused
+ * if jobs are only waiting for a weight.
+ */
+static struct job_slot* claim_job( struct miner_engine* engine, bool* paused )
+{
+   unsigned total = 0;
+
+   *paused = false;
+   for( int i = 0; i < ENGINE_MAX_JOBS; i++ )
+   {
+      struct job_slot* s = &engine->slots[i];
+      if( atomic_load_explicit( &s->state, memory_order_relaxed ) != JOB_ACTIVE || atomic_load_explicit( &s->exhausted, memory_order_relaxed ) )
+         continue;
+      unsigned weight = atomic_load_explicit( &s->weight, memory_order_relaxed );
+      if( !weight )
+         *paused = true;
+      total += weight;
+   }
+   if( !total )
+      return NULL;
+
+   unsigned pick = atomic_fetch_add_explicit( &engine->ticket, 1, memory_order_relaxed ) % total;
+   for( int i = 0; i < ENGINE_MAX_JOBS; i++ )
+   {
+      struct job_slot* s = &engine->slots[i];
+      if( atomic_load_explicit( &s->state, memory_order_relaxed ) != JOB_ACTIVE || atomic_load_explicit( &s->exhausted, memory_order_relaxed ) )
+         continue;
+      unsigned weight = atomic_load_explicit( &s->weight, memory_order_relaxed );
+      if( pick < weight )
+         return s;
+      pick -= weight;
+   }
+
+   // The weights changed in between, try again
+   *paused = true;
+   return NULL;
+}
+
+// Block while jobs wait for a weight and nothing stopped the search
+static void wait_paused( struct miner_engine* engine )
+{
+   bool paused;
+
+   pthread_mutex_lock( &engine->pause_lock );
+   while( !atomic_load( &engine->stop ) )
+   {
+      // A weight stored after this check broadcasts only once the wait has begun
+      if( claim_job( engine, &paused ) || !paused )
+         break;
+      pthread_cond_wait( &engine->resumed, &engine->pause_lock );
+   }
+   pthread_mutex_unlock( &engine->pause_lock );
+}
+
+// A range of s ended. The last one of an exhausted job finishes it, which ends the search
+static void end_range( struct miner_engine* engine, struct job_slot* s, bool complete )
+{
+   if( atomic_fetch_sub( &s->busy, 1 ) == 1 && complete && atomic_load( &s->exhausted ) )
+   {
+      int active = JOB_ACTIVE;
+      if( atomic_compare_exchange_strong( &s->state, &active, JOB_FINISHED ) )
+         atomic_store( &engine->stop, true );
+   }
+}
+
+// Return a job that found a proof or ran out of nonces, freeing its slot
+static bool take_done_job( struct miner_engine* engine, struct bn* nonce, int* slot, enum engine_status* status )
+{
+   for( int i = 0; i < ENGINE_MAX_JOBS; i++ )
+   {
+      struct job_slot* s = &engine->slots[i];
+      int state = atomic_load( &s->state );
+      if( state != JOB_FOUND && state != JOB_FINISHED )
+         continue;
+
+      if( state == JOB_FOUND )
+         bignum_assign( nonce, &s->proofs[atomic_load( &s->winner )].nonce );
+      *status = state == JOB_FOUND ? ENGINE_FOUND : ENGINE_FINISHED;
+      *slot = i;
+
+      // The stop this job raised is spent, the others carry on with the next search
+      atomic_store( &s->state, JOB_IDLE );
+      report_job( &engine->reporter, i, NULL, 0 );
+      atomic_store( &engine->stop, false );
+      return true;
+   }
+
+   return false;
+}
+
+enum engine_status search_job( struct miner_engine* engine, struct bn* nonce, int* slot )
+{
+   struct topology* topo = &engine->topo;
+   int* thread_domain = engine->thread_domain;
+   int* placement = engine->placement;
+   struct bn* word_buffer = engine->word_buffer;
+   atomic_bool* stop = &engine->stop;
+   enum engine_status status;
+
+   // Jobs done alongside the one returned last time, and jobs whose last ranges a
+   // cancelled search cut short, are returned without searching
+   for( int i = 0; i < ENGINE_MAX_JOBS; i++ )
+   {
+      struct job_slot* s = &engine->slots[i];
+      int active = JOB_ACTIVE;
+      if( atomic_load( &s->exhausted ) )
+         atomic_compare_exchange_strong( &s->state, &active, JOB_FINISHED );
+   }
+   if( take_done_job( engine, nonce, slot, &status ) )
+   {
+      return status;
+   }
+
+   omp_set_num_threads( engine->threads );
+
+   start_hash_reporter( &engine->reporter );
+   for( int t = 0; t < engine->threads; t++ )
+      engine->start_hashes[t] = thread_hashes( &engine->reporter, t );
+   double search_start = omp_get_wtime();
+
+   #pragma omp parallel
+   {
+      int tid = omp_get_thread_num();
+      thread_domain[tid] = -1;
+
+      // OpenMP keeps its threads between regions, this only matters if it replaced one
+      if( placement )
+      {
+         pin_thread( placement[tid] );
+      }
+
+      while( !atomic_load_explicit( stop, memory_order_relaxed ) )
+      {
+         bool paused;
+         struct job_slot* s = claim_job( engine, &paused );
+         if( !s )
+         {
+            if( !paused )
+               break;
+            wait_paused( engine );
+            continue;
+         }
+
+         // Claim the next range of nonces, as an offset from the job's starting nonce
+         atomic_fetch_add( &s->busy, 1 );
+         uint64_t offset = atomic_fetch_add_explicit( &s->next_offset, s->job.thread_iterations, memory_order_relaxed );
+         if( offset > s->job.hash_limit )
+         {
+            atomic_store( &s->exhausted, true );
+            end_range( engine, s, true );
+            continue;
+         }
+
+         struct proof* t_proof = s->proofs + tid;
+         struct bn t_offset;
+         bignum_from_int( &t_offset, offset );
+         bignum_add( &s->nonce, &t_offset, &t_proof->nonce );
+
+         // Threads are free to migrate, look the local replica up for every range
+         thread_domain[tid] = current_domain( topo );
+         struct bn* local_words = local_word_buffer( topo, word_buffer, thread_domain[tid] );
+         struct hash_counter* counter = job_counters( &engine->reporter, (int)(s - engine->slots) ) + tid;
+
+         struct share_sink* shares = bignum_is_zero( &s->job.share_target ) ? NULL : s->shares + tid;
+
+         if( search_range( &t_proof->nonce, s->job.thread_iterations, &s->wdata, &s->secured_struct_hash, &s->job.target, shares, local_words, stop, &counter->hashes, &t_proof->result ) )
+         {
+            // Two threads could find a valid proof at the same time (unlikely, but possible).
+            // We want to return the more difficult proof. A published proof is never
+            // written again, as its thread stops searching
+            int current = atomic_load( &s->winner );
+            while( current == NO_PROOF || bignum_cmp( &t_proof->result, &s->proofs[current].result ) < 0 )
+            {
+               if( atomic_compare_exchange_weak( &s->winner, &current, tid ) )
+                  break;
+            }
+            int active = JOB_ACTIVE;
+            atomic_compare_exchange_strong( &s->state, &active, JOB_FOUND );
+            atomic_store( stop, true );
+            end_range( engine, s, false );
+         }
+         else
+         {
+            end_range( engine, s, !atomic_load_explicit( stop, memory_order_relaxed ) );
+         }
+      }
+   }
+
+   stop_hash_reporter( &engine->reporter );
+
+   if( topo->domains > 1 )
+   {
+      report_domain_scaling( topo, &engine->reporter, thread_domain, engine->start_hashes, omp_get_wtime() - search_start );
+   }
+
+   if( take_done_job( engine, nonce, slot, &status ) )
+   {
+      return status;
+   }
+   *slot = -1;
+   return ENGINE_CANCELLED;
+}
+
+void cancel_search( struct miner_engine* engine )
+{
+   atomic_store( &engine->stop, true );
+   wake_paused( engine );
+}
+
+uint64_t engine_hashes( struct miner_engine* engine, int slot )
+{
+   return total_hashes( &engine->reporter, slot );
+}
+
+int job_best( struct miner_engine* engine, int slot, struct proof* best )
+{
+   struct job_slot* s = &engine->slots[slot];
+   if( bignum_is_zero( &s->job.share_target ) || !engine_hashes( engine, slot ) )
+      return 0;
+
+   struct share_sink* t_best = s->shares;
+   for( int t = 1; t < engine->threads; t++ )
+   {
+      if( bignum_cmp( &s->shares[t].best, &t_best->best ) < 0 )
+         t_best = s->shares + t;
+   }
+
+   bignum_assign( &best->nonce, &t_best->best_nonce );
+   bignum_assign( &best->result, &t_best->best );
+   return 1;
+}
+
+void release_engine( struct miner_engine* engine )
+{
+   close_hash_reporter( &engine->reporter );
+   release_shared_buffers( &engine->buffers );
+}
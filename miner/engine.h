@@ -0,0 +1,177 @@
+#ifndef __ENGINE_H__
+#define __ENGINE_H__
+
+#include "bn.h"
+#include "buffer_cache.h"
+#include "hash_report.h"
+#include "topology.h"
+#include "word_buffer.h"
+#include "work.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+struct channel;
+
+/*
+ * The search engine behind the miner executable and the Node.js addon: word buffers,
+ * thread placement, hash counters and the parallel nonce search, driven through
+ * jobs. One engine is meant to exist per process, as it pins the OpenMP threads. Jobs
+ * may be set and searched from any thread, one at a time.
+ */
+#define ENGINE_MAX_JOBS 8
+struct engine_options
+{
+   bool                  auto_prefetch;
+   unsigned              prefetch_distance;
+   bool                  lock_memory;
+   unsigned              report_interval_ms;   // 0 to only count hashes, without a reporter thread
+   const char*           cache_dir;
+   unsigned              cache_size;
+   unsigned              buffer_count;
+   bool                  shared_memory;
+   enum topology_policy  topology;             // Word buffer replicas, none with shared_memory
+   int                   threads;              // 0 for the effective cpu count
+   const char*           cpu_list;
+   enum smt_policy       smt;
+   bool                  pin;
+};
+
+void default_engine_options( struct engine_options* opts );
+
+/*
+ * The secured struct fields of a proof and the nonces to search for it: hash_limit
+ * nonces from block_hash + nonce_offset, claimed thread_iterations at a time.
+ */
+struct miner_job
+{
+   struct channel*  channel;            // Receives the hash reports
+   uint32_t         request_id;         // Carried by hash reports
+   struct bn        miner_address;
+   struct bn        tip_address;
+   struct bn        block_hash;
+   struct bn        target;
+   struct bn        nonce_offset;
+   uint64_t         block_num;
+   uint64_t         tip;                // Hundredths of a percent
+   uint64_t         pow_height;
+   uint64_t         thread_iterations;
+   uint64_t         hash_limit;
+   struct bn        share_target;       // Results at or under it are sent as shares, 0 for none
+};
+
+// A proof found by one thread, published by compare-and-swap on the winning thread id
+struct proof
+{
+   struct bn nonce;
+   struct bn result;
+};
+
+enum job_state
+{
+   JOB_IDLE,          // Free for a new job
+   JOB_ACTIVE,
+   JOB_FOUND,         // Done, until search_job() returns it
+   JOB_FINISHED
+};
+
+/*
+ * One job of the set searched together. Threads claim the ranges of every active job
+ * in proportion to the weights, which take effect at the next claim.
+ */
+struct job_slot
+{
+   struct miner_job      job;
+   struct bn             secured_struct_hash;
+   struct bn             nonce;            // First nonce of the job
+   struct work_data      wdata;
+   struct proof*         proofs;           // One per thread
+   struct share_sink*    shares;           // One per thread, used if the job has a share target
+   atomic_int            winner;
+   atomic_int            state;
+   atomic_uint           weight;           // 0 pauses the job
+   atomic_uint_fast64_t  next_offset;      // Next range to claim, kept between searches
+   atomic_int            busy;             // Ranges being searched
+   atomic_bool           exhausted;        // Every range has been claimed
+};
+
+struct miner_engine
+{
+   struct engine_options  opts;
+   struct buffer_cache    cache;
+   struct word_buffers    buffers;
+   struct topology        topo;
+   int*                   placement;      // Cpu of every thread when pinned, otherwise NULL
+   int                    threads;
+   int*                   thread_domain;
+   uint64_t*              start_hashes;   // Per thread, when the search started
+   struct hash_reporter   reporter;       // A row of counters per job slot
+
+   // The current job set, all on the seed of the first job
+   struct job_slot        slots[ENGINE_MAX_JOBS];
+   struct bn              block_hash;
+   struct bn*             word_buffer;
+   atomic_uint            ticket;         // Counts claims, spread over the jobs by weight
+
+   atomic_bool            stop;
+
+   // Threads wait here while every job is paused, until a weight changes or a cancel
+   pthread_mutex_t        pause_lock;
+   pthread_cond_t         resumed;
+};
+
+enum engine_status
+{
+   ENGINE_FINISHED,    // Every nonce of a job was searched
+   ENGINE_FOUND,
+   ENGINE_CANCELLED
+};
+
+int init_engine( struct miner_engine* engine, const struct engine_options* opts );
+
+// Start building the word buffer of a seed that an upcoming job will use. Safe to call
+// from any thread, also during a search
+void hint_seed( struct miner_engine* engine, struct bn* seed );
+
+// Make job the only one in slot 0, readying its word buffer, and clear any cancellation.
+// Not to be called during a search
+void set_job( struct miner_engine* engine, const struct miner_job* job );
+
+/*
+ * Search job alongside the current ones, with a share of the ranges set by weight.
+ * Returns its slot, or -1 if the set is full or job has a different seed. Not to be
+ * called during a search.
+ */
+int add_job( struct miner_engine* engine, const struct miner_job* job, unsigned weight );
+
+// Change the share of the job in slot. Safe to call from any thread, also during a search
+void set_job_weight( struct miner_engine* engine, int slot, unsigned weight );
+
+// Narrow the job in slot 0 to hash_limit nonces from offset nonces past its first one,
+// clearing any cancellation. Cheaper than set_job() when resuming a job in parts
+void set_job_range( struct miner_engine* engine, uint64_t offset, uint64_t hash_limit );
+
+/*
+ * Search the current jobs with the whole team until one of them finds a proof or runs
+ * out of nonces, or cancel_search() is called. The job is stored in *slot, and the
+ * proof's nonce in *nonce. Its slot is then free, the other jobs carry on with the next
+ * search, less the ranges the stop cut short. Not to be called without an active job.
+ */
+enum engine_status search_job( struct miner_engine* engine, struct bn* nonce, int* slot );
+
+// Stop the running search within one kernel batch, or the next one if it has not
+// started since set_job(), add_job() or a search returned a job. Safe to call from any thread
+void cancel_search( struct miner_engine* engine );
+
+// Hashes of the job in slot, since it was set or added
+uint64_t engine_hashes( struct miner_engine* engine, int slot );
+
+// The lowest result of the job in slot since it was set or added, and its nonce. Returns 0
+// if the job has no share target or has not searched a nonce yet
+int job_best( struct miner_engine* engine, int slot, struct proof* best );
+
+void release_engine( struct miner_engine* engine );
+
+#endif /* #ifndef __ENGINE_H__ */
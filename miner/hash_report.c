@@ -0,0 +1,205 @@
+#include "hash_report.h"
+#include "protocol.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// The reporter sleeps in slices this long so a new search never waits a whole interval
+#define REPORTER_POLL_MS 10
+
+static double monotonic_seconds()
+{
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void sleep_ms( unsigned ms )
+{
+   struct timespec ts;
+   ts.tv_sec = ms / 1000;
+   ts.tv_nsec = (long)(ms % 1000) * 1000000;
+   nanosleep( &ts, NULL );
+}
+
+static void report( struct hash_reporter* reporter, double elapsed )
+{
+   for( int j = 0; j < reporter->jobs; j++ )
+   {
+      if( !reporter->channels[j] )
+         continue;
+
+      struct hash_counter* counters = job_counters( reporter, j );
+      uint64_t* last = reporter->last + j * reporter->threads;
+      uint64_t total = 0, total_delta = 0;
+
+      for( int t = 0; t < reporter->threads; t++ )
+      {
+         uint64_t hashes = atomic_load_explicit( &counters[t].hashes, memory_order_relaxed );
+         total += hashes;
+         total_delta += hashes - last[t];
+         reporter->rates[t] = (hashes - last[t]) / elapsed;
+         last[t] = hashes;
+      }
+
+      send_hash_report( reporter->channels[j], reporter->request_ids[j], total, total_delta / elapsed, reporter->rates, reporter->threads );
+   }
+}
+
+static void* reporter_main( void* arg )
+{
+   struct hash_reporter* reporter = arg;
+   double last = 0, next = 0;
+
+   pthread_mutex_lock( &reporter->lock );
+   while( !reporter->done )
+   {
+      if( !reporter->active )
+      {
+         pthread_cond_wait( &reporter->changed, &reporter->lock );
+         continue;
+      }
+
+      double now = monotonic_seconds();
+      if( reporter->restarted )
+      {
+         reporter->restarted = false;
+         last = now;
+         next = now + reporter->interval_ms * 1e-3;
+      }
+
+      if( now >= next )
+      {
+         report( reporter, now - last );
+         last = now;
+         // Keep to the fixed schedule, skipping intervals that were missed entirely
+         while( next <= now )
+            next += reporter->interval_ms * 1e-3;
+         continue;
+      }
+
+      unsigned wait = (unsigned)((next - now) * 1e3) + 1;
+      pthread_mutex_unlock( &reporter->lock );
+      sleep_ms( wait < REPORTER_POLL_MS ? wait : REPORTER_POLL_MS );
+      pthread_mutex_lock( &reporter->lock );
+   }
+   pthread_mutex_unlock( &reporter->lock );
+
+   return NULL;
+}
+
+int init_hash_reporter( struct hash_reporter* reporter, int threads, int jobs, unsigned interval_ms )
+{
+   size_t size = (size_t)jobs * threads * sizeof(struct hash_counter);
+
+#ifdef _WIN32
+   reporter->counters = _aligned_malloc( size, CACHE_LINE_BYTES );
+#else
+   void* p = NULL;
+   reporter->counters = posix_memalign( &p, CACHE_LINE_BYTES, size ) ? NULL : p;
+#endif
+   reporter->channels = calloc( jobs, sizeof(struct channel*) );
+   reporter->request_ids = calloc( jobs, sizeof(uint32_t) );
+   reporter->last = calloc( (size_t)jobs * threads, sizeof(uint64_t) );
+   reporter->rates = malloc( threads * sizeof(double) );
+   reporter->threads = threads;
+   reporter->jobs = jobs;
+   reporter->interval_ms = interval_ms;
+   reporter->active = false;
+   reporter->restarted = false;
+   reporter->done = false;
+   reporter->running = false;
+   pthread_mutex_init( &reporter->lock, NULL );
+   pthread_cond_init( &reporter->changed, NULL );
+
+   if( !reporter->counters || !reporter->channels || !reporter->request_ids || !reporter->last || !reporter->rates )
+      return 0;
+
+   for( int j = 0; j < jobs; j++ )
+      reset_hash_counters( reporter, j );
+
+   if( interval_ms )
+   {
+      reporter->running = pthread_create( &reporter->thread, NULL, reporter_main, reporter ) == 0;
+      if( !reporter->running )
+      {
+         fprintf(stderr, "[C] Could not start the hash reporter\n");
+         return 0;
+      }
+   }
+   return 1;
+}
+
+void close_hash_reporter( struct hash_reporter* reporter )
+{
+   pthread_mutex_lock( &reporter->lock );
+   reporter->done = true;
+   pthread_cond_signal( &reporter->changed );
+   pthread_mutex_unlock( &reporter->lock );
+
+   if( reporter->running )
+   {
+      pthread_join( reporter->thread, NULL );
+      reporter->running = false;
+   }
+}
+
+void reset_hash_counters( struct hash_reporter* reporter, int job )
+{
+   struct hash_counter* counters = job_counters( reporter, job );
+   uint64_t* last = reporter->last + job * reporter->threads;
+
+   pthread_mutex_lock( &reporter->lock );
+   for( int t = 0; t < reporter->threads; t++ )
+   {
+      atomic_store( &counters[t].hashes, 0 );
+      last[t] = 0;
+   }
+   pthread_mutex_unlock( &reporter->lock );
+}
+
+void report_job( struct hash_reporter* reporter, int job, struct channel* channel, uint32_t request_id )
+{
+   pthread_mutex_lock( &reporter->lock );
+   reporter->channels[job] = channel;
+   reporter->request_ids[job] = request_id;
+   pthread_mutex_unlock( &reporter->lock );
+}
+
+void start_hash_reporter( struct hash_reporter* reporter )
+{
+   pthread_mutex_lock( &reporter->lock );
+   for( int i = 0; i < reporter->jobs * reporter->threads; i++ )
+   {
+      reporter->last[i] = atomic_load_explicit( &reporter->counters[i].hashes, memory_order_relaxed );
+   }
+   reporter->active = true;
+   reporter->restarted = true;
+   pthread_cond_signal( &reporter->changed );
+   pthread_mutex_unlock( &reporter->lock );
+}
+
+void stop_hash_reporter( struct hash_reporter* reporter )
+{
+   // A report in progress holds the lock, none is sent once this returns
+   pthread_mutex_lock( &reporter->lock );
+   reporter->active = false;
+   pthread_mutex_unlock( &reporter->lock );
+}
+
+uint64_t total_hashes( struct hash_reporter* reporter, int job )
+{
+   struct hash_counter* counters = job_counters( reporter, job );
+   uint64_t total = 0;
+   for( int t = 0; t < reporter->threads; t++ )
+   {
+      total += atomic_load_explicit( &counters[t].hashes, memory_order_relaxed );
+   }
+   return total;
+}
@@ -0,0 +1,67 @@
+#ifndef __HASH_REPORT_H__
+#define __HASH_REPORT_H__
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CACHE_LINE_BYTES 64
+
+struct channel;
+
+// Hashes completed by one worker, alone on its cache line so workers never share one
+struct hash_counter
+{
+   _Alignas(CACHE_LINE_BYTES) atomic_uint_fast64_t hashes;
+};
+
+/*
+ * Samples the worker counters on a fixed monotonic clock interval and sends a hash
+ * report for every job being searched with its total and per-thread rates, so workers
+ * never format or flush anything themselves. Every job has a row of counters, one
+ * per thread. One thread serves every search, it waits while none is running.
+ */
+struct hash_reporter
+{
+   struct hash_counter*  counters;
+   int                   threads;
+   int                   jobs;
+   unsigned              interval_ms;
+
+   struct channel**      channels;      // Per job, NULL while the job is not reported
+   uint32_t*             request_ids;
+   uint64_t*             last;
+   double*               rates;
+
+   pthread_mutex_t       lock;          // Guards the fields below, and the above against report()
+   pthread_cond_t        changed;
+   bool                  active;        // A search is running
+   bool                  restarted;     // Rates count from the last start_hash_reporter()
+   bool                  done;
+   bool                  running;       // The thread was started, and is to be joined
+   pthread_t             thread;
+};
+
+// Starts the reporter thread unless interval_ms is 0, returns 0 on error
+int init_hash_reporter( struct hash_reporter* reporter, int threads, int jobs, unsigned interval_ms );
+void close_hash_reporter( struct hash_reporter* reporter );
+
+static inline struct hash_counter* job_counters( struct hash_reporter* reporter, int job )
+{
+   return reporter->counters + job * reporter->threads;
+}
+
+void reset_hash_counters( struct hash_reporter* reporter, int job );
+
+// Report job's counters to channel for request_id, or no longer with a NULL channel
+void report_job( struct hash_reporter* reporter, int job, struct channel* channel, uint32_t request_id );
+
+// Report on the counters until stop_hash_reporter(), rates counting from now. No
+// report is sent after stop_hash_reporter() returns
+void start_hash_reporter( struct hash_reporter* reporter );
+void stop_hash_reporter( struct hash_reporter* reporter );
+
+uint64_t total_hashes( struct hash_reporter* reporter, int job );
+
+#endif /* #ifndef __HASH_REPORT_H__ */
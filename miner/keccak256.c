@@ -32,48 +32,26 @@
 #define IS_ALIGNED_64(p) (0 == (7 & ((const char*)(p) - (const char*)0)))
 #define me64_to_le_str(to, from, length) memcpy((to), (from), (length))
 
-/* constants */
-
-//const uint8_t round_constant_info[] PROGMEM = {
-//const uint8_t constants[] PROGMEM = {
-const uint8_t constants[]  = {
-
-    1, 26, 94, 112, 31, 33, 121, 85, 14, 12, 53, 38, 63, 79, 93, 83, 82, 72, 22, 102, 121, 88, 33, 116,
-//};
-
-//const uint8_t pi_transform[] PROGMEM = {
-    1, 6, 9, 22, 14, 20, 2, 12, 13, 19, 23, 15, 4, 24, 21, 8, 16, 5, 3, 18, 17, 11, 7, 10,
-//};
-
-//const uint8_t rhoTransforms[] PROGMEM = {
-    1, 62, 28, 27, 36, 44, 6, 55, 20, 3, 10, 43, 25, 39, 41, 45, 15, 21, 8, 18, 2, 61, 56, 14,
+#if defined(__GNUC__)
+#define bswap_64(x) __builtin_bswap64(x)
+#else
+#define bswap_64(x) \
+    ((((x) & I64(0x00000000000000FF)) << 56) | (((x) & I64(0x000000000000FF00)) << 40) | \
+     (((x) & I64(0x0000000000FF0000)) << 24) | (((x) & I64(0x00000000FF000000)) <<  8) | \
+     (((x) & I64(0x000000FF00000000)) >>  8) | (((x) & I64(0x0000FF0000000000)) >> 24) | \
+     (((x) & I64(0x00FF000000000000)) >> 40) | (((x) & I64(0xFF00000000000000)) >> 56))
+#endif
+
+/* Keccak-f[1600] round constants for the iota() step */
+static const uint64_t keccak_round_constants[24] = {
+    I64(0x0000000000000001), I64(0x0000000000008082), I64(0x800000000000808A), I64(0x8000000080008000),
+    I64(0x000000000000808B), I64(0x0000000080000001), I64(0x8000000080008081), I64(0x8000000000008009),
+    I64(0x000000000000008A), I64(0x0000000000000088), I64(0x0000000080008009), I64(0x000000008000000A),
+    I64(0x000000008000808B), I64(0x800000000000008B), I64(0x8000000000008089), I64(0x8000000000008003),
+    I64(0x8000000000008002), I64(0x8000000000000080), I64(0x000000000000800A), I64(0x800000008000000A),
+    I64(0x8000000080008081), I64(0x8000000000008080), I64(0x0000000080000001), I64(0x8000000080008008)
 };
 
-#define TYPE_ROUND_INFO      0
-#define TYPE_PI_TRANSFORM   24
-#define TYPE_RHO_TRANSFORM  48
-
-uint8_t getConstant(uint8_t type, uint8_t index) {
-    return constants[type + index];
-    //return pgm_read_byte(&constants[type + index]);
-}
-
-static uint64_t get_round_constant(uint8_t round) {
-    uint64_t result = 0;
-
-    //uint8_t roundInfo = pgm_read_byte(&round_constant_info[round]);
-    uint8_t roundInfo = getConstant(TYPE_ROUND_INFO, round);
-    if (roundInfo & (1 << 6)) { result |= ((uint64_t)1 << 63); }
-    if (roundInfo & (1 << 5)) { result |= ((uint64_t)1 << 31); }
-    if (roundInfo & (1 << 4)) { result |= ((uint64_t)1 << 15); }
-    if (roundInfo & (1 << 3)) { result |= ((uint64_t)1 << 7); }
-    if (roundInfo & (1 << 2)) { result |= ((uint64_t)1 << 3); }
-    if (roundInfo & (1 << 1)) { result |= ((uint64_t)1 << 1); }
-    if (roundInfo & (1 << 0)) { result |= ((uint64_t)1 << 0); }
-
-    return result;
-}
-
 
 /* Initializing a sha3 context for given number of output bits */
 void keccak_init(SHA3_CTX *ctx) {
@@ -82,72 +60,171 @@ void keccak_init(SHA3_CTX *ctx) {
     memset(ctx, 0, sizeof(SHA3_CTX));
 }
 
-/* Keccak theta() transformation */
-static void keccak_theta(uint64_t *A) {
-    uint64_t C[5], D[5];
-
-    for (uint8_t i = 0; i < 5; i++) {
-        C[i] = A[i];
-        for (uint8_t j = 5; j < 25; j += 5) { C[i] ^= A[i + j]; }
-    }
-
-    for (uint8_t i = 0; i < 5; i++) {
-        D[i] = ROTL64(C[(i + 1) % 5], 1) ^ C[(i + 4) % 5];
-    }
-
-    for (uint8_t i = 0; i < 5; i++) {
-        //for (uint8_t j = 0; j < 25; j += 5) {
-        for (uint8_t j = 0; j < 25; j += 5) { A[i + j] ^= D[i]; }
-    }
-}
-
-
-/* Keccak pi() transformation */
-static void keccak_pi(uint64_t *A) {
-    uint64_t A1 = A[1];
-    //for (uint8_t i = 1; i < sizeof(pi_transform); i++) {
-    for (uint8_t i = 1; i < 24; i++) {
-        //A[pgm_read_byte(&pi_transform[i - 1])] = A[pgm_read_byte(&pi_transform[i])];
-        A[getConstant(TYPE_PI_TRANSFORM, i - 1)] = A[getConstant(TYPE_PI_TRANSFORM, i)];
-    }
-    A[10] = A1;
-    /* note: A[ 0] is left as is */
-}
+/*
+ * The permutation is fully unrolled with the 25 lanes held in local
+ * variables. Lanes are named A<plane><sheet> after the Keccak team's
+ * reference code: planes b, g, k, m, s are y = 0..4 and sheets
+ * a, e, i, o, u are x = 0..4, so Aba is state[0] and Asu is state[24].
+ *
+ * The lane type is a parameter so the same round serves the multi-buffer
+ * kernels below, where each lane is a vector holding one lane per message.
+ */
+#define KECCAK_DECLARE_LANES(T) \
+    T Aba, Abe, Abi, Abo, Abu, Aga, Age, Agi, Ago, Agu, \
+      Aka, Ake, Aki, Ako, Aku, Ama, Ame, Ami, Amo, Amu, \
+      Asa, Ase, Asi, Aso, Asu; \
+    T Bba, Bbe, Bbi, Bbo, Bbu, Bga, Bge, Bgi, Bgo, Bgu, \
+      Bka, Bke, Bki, Bko, Bku, Bma, Bme, Bmi, Bmo, Bmu, \
+      Bsa, Bse, Bsi, Bso, Bsu; \
+    T Ca, Ce, Ci, Co, Cu, Da, De, Di, Do, Du
+
+#define KECCAK_LOAD_LANES(s) \
+    Aba = (s)[ 0]; Abe = (s)[ 1]; Abi = (s)[ 2]; Abo = (s)[ 3]; Abu = (s)[ 4]; \
+    Aga = (s)[ 5]; Age = (s)[ 6]; Agi = (s)[ 7]; Ago = (s)[ 8]; Agu = (s)[ 9]; \
+    Aka = (s)[10]; Ake = (s)[11]; Aki = (s)[12]; Ako = (s)[13]; Aku = (s)[14]; \
+    Ama = (s)[15]; Ame = (s)[16]; Ami = (s)[17]; Amo = (s)[18]; Amu = (s)[19]; \
+    Asa = (s)[20]; Ase = (s)[21]; Asi = (s)[22]; Aso = (s)[23]; Asu = (s)[24]
+
+#define KECCAK_STORE_LANES(s) \
+    (s)[ 0] = Aba; (s)[ 1] = Abe; (s)[ 2] = Abi; (s)[ 3] = Abo; (s)[ 4] = Abu; \
+    (s)[ 5] = Aga; (s)[ 6] = Age; (s)[ 7] = Agi; (s)[ 8] = Ago; (s)[ 9] = Agu; \
+    (s)[10] = Aka; (s)[11] = Ake; (s)[12] = Aki; (s)[13] = Ako; (s)[14] = Aku; \
+    (s)[15] = Ama; (s)[16] = Ame; (s)[17] = Ami; (s)[18] = Amo; (s)[19] = Amu; \
+    (s)[20] = Asa; (s)[21] = Ase; (s)[22] = Asi; (s)[23] = Aso; (s)[24] = Asu
+
+/* Keccak theta() transformation followed by rho() and pi() into the B lanes */
+#define KECCAK_THETA_RHO_PI \
+    Ca = Aba ^ Aga ^ Aka ^ Ama ^ Asa; \
+    Ce = Abe ^ Age ^ Ake ^ Ame ^ Ase; \
+    Ci = Abi ^ Agi ^ Aki ^ Ami ^ Asi; \
+    Co = Abo ^ Ago ^ Ako ^ Amo ^ Aso; \
+    Cu = Abu ^ Agu ^ Aku ^ Amu ^ Asu; \
+    Da = Cu ^ ROTL64(Ce, 1); \
+    De = Ca ^ ROTL64(Ci, 1); \
+    Di = Ce ^ ROTL64(Co, 1); \
+    Do = Ci ^ ROTL64(Cu, 1); \
+    Du = Co ^ ROTL64(Ca, 1); \
+    Bba =        Aba ^ Da;       \
+    Bbe = ROTL64(Age ^ De, 44); \
+    Bbi = ROTL64(Aki ^ Di, 43); \
+    Bbo = ROTL64(Amo ^ Do, 21); \
+    Bbu = ROTL64(Asu ^ Du, 14); \
+    Bga = ROTL64(Abo ^ Do, 28); \
+    Bge = ROTL64(Agu ^ Du, 20); \
+    Bgi = ROTL64(Aka ^ Da,  3); \
+    Bgo = ROTL64(Ame ^ De, 45); \
+    Bgu = ROTL64(Asi ^ Di, 61); \
+    Bka = ROTL64(Abe ^ De,  1); \
+    Bke = ROTL64(Agi ^ Di,  6); \
+    Bki = ROTL64(Ako ^ Do, 25); \
+    Bko = ROTL64(Amu ^ Du,  8); \
+    Bku = ROTL64(Asa ^ Da, 18); \
+    Bma = ROTL64(Abu ^ Du, 27); \
+    Bme = ROTL64(Aga ^ Da, 36); \
+    Bmi = ROTL64(Ake ^ De, 10); \
+    Bmo = ROTL64(Ami ^ Di, 15); \
+    Bmu = ROTL64(Aso ^ Do, 56); \
+    Bsa = ROTL64(Abi ^ Di, 62); \
+    Bse = ROTL64(Ago ^ Do, 55); \
+    Bsi = ROTL64(Aku ^ Du, 39); \
+    Bso = ROTL64(Ama ^ Da, 41); \
+    Bsu = ROTL64(Ase ^ De,  2)
+
+#ifdef KECCAK_LANE_COMPLEMENTING
+/*
+ * Lanes Abe, Abi, Ago, Aki, Ami and Asa are kept complemented between
+ * rounds, which removes all but one NOT per plane from chi().
+ */
+#define KECCAK_CHI \
+    Aba =  Bba ^ ( Bbe |  Bbi); \
+    Abe =  Bbe ^ (~Bbi |  Bbo); \
+    Abi =  Bbi ^ ( Bbo &  Bbu); \
+    Abo =  Bbo ^ ( Bbu |  Bba); \
+    Abu =  Bbu ^ ( Bba &  Bbe); \
+    Aga =  Bga ^ ( Bge |  Bgi); \
+    Age =  Bge ^ ( Bgi &  Bgo); \
+    Agi =  Bgi ^ ( Bgo | ~Bgu); \
+    Ago =  Bgo ^ ( Bgu |  Bga); \
+    Agu =  Bgu ^ ( Bga &  Bge); \
+    Aka =  Bka ^ ( Bke |  Bki); \
+    Ake =  Bke ^ ( Bki &  Bko); \
+    Aki =  Bki ^ (~Bko &  Bku); \
+    Ako = ~Bko ^ ( Bku |  Bka); \
+    Aku =  Bku ^ ( Bka &  Bke); \
+    Ama =  Bma ^ ( Bme &  Bmi); \
+    Ame =  Bme ^ ( Bmi |  Bmo); \
+    Ami =  Bmi ^ (~Bmo |  Bmu); \
+    Amo = ~Bmo ^ ( Bmu &  Bma); \
+    Amu =  Bmu ^ ( Bma |  Bme); \
+    Asa =  Bsa ^ (~Bse &  Bsi); \
+    Ase = ~Bse ^ ( Bsi |  Bso); \
+    Asi =  Bsi ^ ( Bso &  Bsu); \
+    Aso =  Bso ^ ( Bsu |  Bsa); \
+    Asu =  Bsu ^ ( Bsa &  Bse)
+
+#define KECCAK_COMPLEMENT_LANES \
+    Abe = ~Abe; Abi = ~Abi; Ago = ~Ago; Aki = ~Aki; Ami = ~Ami; Asa = ~Asa
+#else
+#define KECCAK_CHI \
+    Aba = Bba ^ (~Bbe & Bbi); \
+    Abe = Bbe ^ (~Bbi & Bbo); \
+    Abi = Bbi ^ (~Bbo & Bbu); \
+    Abo = Bbo ^ (~Bbu & Bba); \
+    Abu = Bbu ^ (~Bba & Bbe); \
+    Aga = Bga ^ (~Bge & Bgi); \
+    Age = Bge ^ (~Bgi & Bgo); \
+    Agi = Bgi ^ (~Bgo & Bgu); \
+    Ago = Bgo ^ (~Bgu & Bga); \
+    Agu = Bgu ^ (~Bga & Bge); \
+    Aka = Bka ^ (~Bke & Bki); \
+    Ake = Bke ^ (~Bki & Bko); \
+    Aki = Bki ^ (~Bko & Bku); \
+    Ako = Bko ^ (~Bku & Bka); \
+    Aku = Bku ^ (~Bka & Bke); \
+    Ama = Bma ^ (~Bme & Bmi); \
+    Ame = Bme ^ (~Bmi & Bmo); \
+    Ami = Bmi ^ (~Bmo & Bmu); \
+    Amo = Bmo ^ (~Bmu & Bma); \
+    Amu = Bmu ^ (~Bma & Bme); \
+    Asa = Bsa ^ (~Bse & Bsi); \
+    Ase = Bse ^ (~Bsi & Bso); \
+    Asi = Bsi ^ (~Bso & Bsu); \
+    Aso = Bso ^ (~Bsu & Bsa); \
+    Asu = Bsu ^ (~Bsa & Bse)
+
+#define KECCAK_COMPLEMENT_LANES
+#endif
+
+#define KECCAK_ROUND(rc) \
+    KECCAK_THETA_RHO_PI; \
+    KECCAK_CHI; \
+    Aba ^= (rc)
 
 /*
-ketch uses 30084 bytes (93%) of program storage space. Maximum is 32256 bytes.
-Global variables use 743 bytes (36%) of dynamic memory, leaving 1305 bytes for local variables. Maximum is 2048 bytes.
-*/
-/* Keccak chi() transformation */
-static void keccak_chi(uint64_t *A) {
-    for (uint8_t i = 0; i < 25; i += 5) {
-        uint64_t A0 = A[0 + i], A1 = A[1 + i];
-        A[0 + i] ^= ~A1 & A[2 + i];
-        A[1 + i] ^= ~A[2 + i] & A[3 + i];
-        A[2 + i] ^= ~A[3 + i] & A[4 + i];
-        A[3 + i] ^= ~A[4 + i] & A0;
-        A[4 + i] ^= ~A0 & A1;
+ * All 24 rounds on lanes that are already loaded and complemented. Unrolled by four
+ * rounds, not 24: the fully unrolled permutation is four times the code, which costs
+ * the scalar path more in instruction fetch than the loop branch does
+ */
+#define KECCAK_ROUNDS \
+    for (uint8_t round = 0; round < 24; round += 4) { \
+        KECCAK_ROUND(keccak_round_constants[round]); \
+        KECCAK_ROUND(keccak_round_constants[round + 1]); \
+        KECCAK_ROUND(keccak_round_constants[round + 2]); \
+        KECCAK_ROUND(keccak_round_constants[round + 3]); \
     }
-}
 
+#define KECCAK_PERMUTE(T, state) \
+    do { \
+        KECCAK_DECLARE_LANES(T); \
+        KECCAK_LOAD_LANES(state); \
+        KECCAK_COMPLEMENT_LANES; \
+        KECCAK_ROUNDS; \
+        KECCAK_COMPLEMENT_LANES; \
+        KECCAK_STORE_LANES(state); \
+    } while (0)
 
 static void sha3_permutation(uint64_t *state) {
-    //for (uint8_t round = 0; round < sizeof(round_constant_info); round++) {
-    for (uint8_t round = 0; round < 24; round++) {
-        keccak_theta(state);
-
-        /* apply Keccak rho() transformation */
-        for (uint8_t i = 1; i < 25; i++) {
-            //state[i] = ROTL64(state[i], pgm_read_byte(&rhoTransforms[i - 1]));
-            state[i] = ROTL64(state[i], getConstant(TYPE_RHO_TRANSFORM, i - 1));
-        }
-
-        keccak_pi(state);
-        keccak_chi(state);
-
-        /* apply iota(state, round) */
-        *state ^= get_round_constant(round);
-    }
+    KECCAK_PERMUTE(uint64_t, state);
 }
 
 /**
@@ -241,3 +318,272 @@ void keccak_final(SHA3_CTX *ctx, unsigned char* result)
          me64_to_le_str(result, ctx->hash, digest_length);
     }
 }
+
+/*
+ * Multi-buffer hashing.
+ *
+ * keccak256_xN() hashes several independent messages of the same size at
+ * once. The SIMD kernels keep message k of a batch in element k of every
+ * lane vector, so one pass of the unrolled round permutes 4 (AVX2) or 8
+ * (AVX-512) states. The kernel is chosen by keccak_select_kernel().
+ */
+
+typedef void (*keccak256_kernel_t)(unsigned char* const* results, const unsigned char* const* msgs, uint16_t size);
+
+static void keccak256_x1(unsigned char* const* results, const unsigned char* const* msgs, uint16_t size)
+{
+    SHA3_CTX ctx;
+    keccak_init(&ctx);
+    keccak_update(&ctx, msgs[0], size);
+    keccak_final(&ctx, results[0]);
+}
+
+/*
+ * Fixed length path for the word derivation H(seed || be256(index)).
+ *
+ * The 64 byte message and its padding fit in a single block, so instead of
+ * going through a context the lanes are loaded directly: the seed into
+ * Aba..Abo, the big endian index into Abu..Agi (only Agi is non-zero for a
+ * 64-bit index), the 0x01 pad byte into Ago and the final 0x80 into Ame.
+ * SPLAT turns a 64-bit value into the lane type.
+ */
+#define KECCAK_64B_LOAD_LANES(SPLAT, seed, index_lane) \
+    Aba = SPLAT(seed[0]); Abe = SPLAT(seed[1]); Abi = SPLAT(seed[2]); Abo = SPLAT(seed[3]); Abu = SPLAT(0); \
+    Aga = SPLAT(0); Age = SPLAT(0); Agi = (index_lane); Ago = SPLAT(0x01); Agu = SPLAT(0); \
+    Aka = SPLAT(0); Ake = SPLAT(0); Aki = SPLAT(0); Ako = SPLAT(0); Aku = SPLAT(0); \
+    Ama = SPLAT(0); Ame = SPLAT(I64(0x8000000000000000)); Ami = SPLAT(0); Amo = SPLAT(0); Amu = SPLAT(0); \
+    Asa = SPLAT(0); Ase = SPLAT(0); Asi = SPLAT(0); Aso = SPLAT(0); Asu = SPLAT(0)
+
+#define KECCAK_SPLAT_SCALAR(x) ((uint64_t)(x))
+
+typedef void (*keccak256_64B_kernel_t)(unsigned char* results, const uint64_t* seed, uint64_t index);
+
+static void keccak256_64B_x1(unsigned char* results, const uint64_t* seed, uint64_t index)
+{
+    KECCAK_DECLARE_LANES(uint64_t);
+    KECCAK_64B_LOAD_LANES(KECCAK_SPLAT_SCALAR, seed, bswap_64(index));
+    KECCAK_COMPLEMENT_LANES;
+    KECCAK_ROUNDS;
+    KECCAK_COMPLEMENT_LANES;
+    me64_to_le_str(results,      &Aba, sizeof(Aba));
+    me64_to_le_str(results +  8, &Abe, sizeof(Abe));
+    me64_to_le_str(results + 16, &Abi, sizeof(Abi));
+    me64_to_le_str(results + 24, &Abo, sizeof(Abo));
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KECCAK_HAVE_SIMD_KERNELS
+
+typedef uint64_t keccak_v4 __attribute__((vector_size(32)));
+typedef uint64_t keccak_v8 __attribute__((vector_size(64)));
+
+/*
+ * Defines keccak256_x<lanes>(), absorbing whole blocks straight from the
+ * messages and padding the last partial block of each message on the stack.
+ */
+#define KECCAK256_MULTI_BUFFER_KERNEL(lanes, V, isa) \
+__attribute__((target(isa))) \
+static void keccak256_x##lanes(unsigned char* const* results, const unsigned char* const* msgs, uint16_t size) \
+{ \
+    V state[25]; \
+    V block[17]; \
+    unsigned char pad[BLOCK_SIZE]; \
+    uint16_t offset = 0; \
+    memset(state, 0, sizeof(state)); \
+    for (;;) { \
+        uint16_t rest = size - offset; \
+        for (uint8_t k = 0; k < lanes; k++) { \
+            const unsigned char* p = msgs[k] + offset; \
+            if (rest < BLOCK_SIZE) { \
+                memset(pad, 0, BLOCK_SIZE); \
+                memcpy(pad, p, rest); \
+                pad[rest] |= 0x01; \
+                pad[BLOCK_SIZE - 1] |= 0x80; \
+                p = pad; \
+            } \
+            for (uint8_t i = 0; i < 17; i++) { \
+                uint64_t w; \
+                memcpy(&w, p + 8 * i, sizeof(w)); \
+                block[i][k] = le2me_64(w); \
+            } \
+        } \
+        for (uint8_t i = 0; i < 17; i++) { \
+            state[i] ^= block[i]; \
+        } \
+        KECCAK_PERMUTE(V, state); \
+        if (rest < BLOCK_SIZE) break; \
+        offset += BLOCK_SIZE; \
+    } \
+    for (uint8_t k = 0; k < lanes; k++) { \
+        for (uint8_t i = 0; i < 4; i++) { \
+            uint64_t w = state[i][k]; \
+            me64_to_le_str(results[k] + 8 * i, &w, sizeof(w)); \
+        } \
+    } \
+}
+
+/* Broadcasts a 64-bit value to every element, zero is declared by the kernel */
+#define KECCAK_SPLAT_VECTOR(x) (zero + (x))
+
+/* Defines keccak256_64B_x<lanes>(), hashing indices index..index+lanes-1 */
+#define KECCAK256_64B_KERNEL(lanes, V, isa) \
+__attribute__((target(isa))) \
+static void keccak256_64B_x##lanes(unsigned char* results, const uint64_t* seed, uint64_t index) \
+{ \
+    const V zero = { 0 }; \
+    V index_lane; \
+    KECCAK_DECLARE_LANES(V); \
+    for (uint8_t k = 0; k < lanes; k++) { \
+        index_lane[k] = bswap_64(index + k); \
+    } \
+    KECCAK_64B_LOAD_LANES(KECCAK_SPLAT_VECTOR, seed, index_lane); \
+    KECCAK_COMPLEMENT_LANES; \
+    KECCAK_ROUNDS; \
+    KECCAK_COMPLEMENT_LANES; \
+    for (uint8_t k = 0; k < lanes; k++) { \
+        uint64_t digest[4] = { Aba[k], Abe[k], Abi[k], Abo[k] }; \
+        me64_to_le_str(results + 32 * k, digest, sizeof(digest)); \
+    } \
+}
+
+KECCAK256_MULTI_BUFFER_KERNEL(4, keccak_v4, "avx2")
+KECCAK256_MULTI_BUFFER_KERNEL(8, keccak_v8, "avx512f")
+KECCAK256_64B_KERNEL(4, keccak_v4, "avx2")
+KECCAK256_64B_KERNEL(8, keccak_v8, "avx512f")
+#endif
+
+/*
+ * The kernels from the most to the least preferred, each one used only where the
+ * cpu supports it.
+ */
+struct keccak_kernel {
+    const char* name;
+    unsigned lanes;
+    int (*supported)(void);
+    keccak256_kernel_t hash;
+    keccak256_64B_kernel_t hash_64B;
+};
+
+#ifdef KECCAK_HAVE_SIMD_KERNELS
+static int keccak_cpu_has_avx512(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f");
+}
+
+static int keccak_cpu_has_avx2(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+
+static const struct keccak_kernel keccak_kernels[] = {
+#ifdef KECCAK_HAVE_SIMD_KERNELS
+    { "avx512", 8, keccak_cpu_has_avx512, keccak256_x8, keccak256_64B_x8 },
+    { "avx2", 4, keccak_cpu_has_avx2, keccak256_x4, keccak256_64B_x4 },
+#endif
+    { "scalar", 1, NULL, keccak256_x1, keccak256_64B_x1 }
+};
+
+#define KECCAK_KERNEL_COUNT (sizeof(keccak_kernels) / sizeof(keccak_kernels[0]))
+
+static keccak256_kernel_t keccak256_kernel = keccak256_x1;
+static keccak256_64B_kernel_t keccak256_64B_kernel = keccak256_64B_x1;
+static unsigned keccak256_kernel_lanes = 1;
+static const char* keccak256_kernel_id = "scalar";
+
+static void keccak_use_kernel(const struct keccak_kernel* k)
+{
+    keccak256_kernel = k->hash;
+    keccak256_64B_kernel = k->hash_64B;
+    keccak256_kernel_lanes = k->lanes;
+    keccak256_kernel_id = k->name;
+}
+
+void keccak_select_kernel(void)
+{
+    for (size_t i = 0; i < KECCAK_KERNEL_COUNT; i++) {
+        if (!keccak_kernels[i].supported || keccak_kernels[i].supported()) {
+            keccak_use_kernel(&keccak_kernels[i]);
+            return;
+        }
+    }
+}
+
+int keccak_select_kernel_named(const char* name)
+{
+    for (size_t i = 0; i < KECCAK_KERNEL_COUNT; i++) {
+        if (strcmp(keccak_kernels[i].name, name) == 0) {
+            if (keccak_kernels[i].supported && !keccak_kernels[i].supported())
+                return 0;
+            keccak_use_kernel(&keccak_kernels[i]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+const char* keccak_kernel_name_at(unsigned i)
+{
+    return i < KECCAK_KERNEL_COUNT ? keccak_kernels[i].name : NULL;
+}
+
+const char* keccak_kernel_name(void)
+{
+    return keccak256_kernel_id;
+}
+
+unsigned keccak_kernel_lanes(void)
+{
+    return keccak256_kernel_lanes;
+}
+
+/**
+ * Hash n messages of size bytes each into n 32 byte digests.
+ *
+ * @param results n output buffers of 32 bytes each
+ * @param msgs n input messages
+ * @param size length of every message
+ * @param n number of messages, any remainder below the kernel width is hashed one at a time
+ */
+void keccak256_xN(unsigned char* const* results, const unsigned char* const* msgs, uint16_t size, unsigned n)
+{
+    unsigned i = 0;
+
+    for (; i + keccak256_kernel_lanes <= n; i += keccak256_kernel_lanes) {
+        keccak256_kernel(results + i, msgs + i, size);
+    }
+
+    for (; i < n; i++) {
+        keccak256_x1(results + i, msgs + i, size);
+    }
+}
+
+/**
+ * Hash the n 64 byte messages seed || be256(first_index + k), k < n.
+ *
+ * @param results 32 * n bytes receiving the digests back to back
+ * @param seed the 32 byte message prefix
+ * @param first_index index of the first message
+ * @param n number of messages
+ */
+void keccak256_64B(unsigned char* results, const unsigned char* seed, uint64_t first_index, unsigned n)
+{
+    uint64_t seed_lanes[4];
+    unsigned i = 0;
+
+    for (uint8_t j = 0; j < 4; j++) {
+        uint64_t w;
+        memcpy(&w, seed + 8 * j, sizeof(w));
+        seed_lanes[j] = le2me_64(w);
+    }
+
+    for (; i + keccak256_kernel_lanes <= n; i += keccak256_kernel_lanes) {
+        keccak256_64B_kernel(results + 32 * i, seed_lanes, first_index + i);
+    }
+
+    for (; i < n; i++) {
+        keccak256_64B_x1(results + 32 * i, seed_lanes, first_index + i);
+    }
+}
@@ -47,6 +47,17 @@ void keccak_init(SHA3_CTX *ctx);
 void keccak_update(SHA3_CTX *ctx, const unsigned char *msg, uint16_t size);
 void keccak_final(SHA3_CTX *ctx, unsigned char* result);
 
+/* Multi-buffer hashing of equally sized messages, see keccak256.c */
+void keccak_select_kernel(void);
+/* Use the kernel of that name, returns 0 if there is none or the cpu lacks it */
+int keccak_select_kernel_named(const char* name);
+/* The name of kernel i, most preferred first, NULL past the last one */
+const char* keccak_kernel_name_at(unsigned i);
+const char* keccak_kernel_name(void);
+unsigned keccak_kernel_lanes(void);
+void keccak256_xN(unsigned char* const* results, const unsigned char* const* msgs, uint16_t size, unsigned n);
+void keccak256_64B(unsigned char* results, const unsigned char* seed, uint64_t first_index, unsigned n);
+
 
 #ifdef __cplusplus
 }
@@ -1,14 +1,16 @@
 
 #include "bn.h"
-#include "keccak256.h"
+#include "daemon.h"
+#include "engine.h"
+#include "protocol.h"
 
 #include <inttypes.h>
-#include <omp.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 
 #ifdef _WIN32
 #include <io.h>
@@ -17,18 +19,9 @@
 #include <unistd.h>
 #endif
 
-#define WORD_BUFFER_BYTES  (2 << 20) // 2 MB
-#define WORD_BUFFER_LENGTH (WORD_BUFFER_BYTES / sizeof(struct bn))
-
-#define SAMPLE_INDICES         10
-#define READ_BUFSIZE         1024
-#define ETH_HASH_SIZE          66
-#define ETH_ADDRESS_SIZE       42
-#define PERCENT_100         10000
-
 #define THREAD_ITERATIONS 600000
 
-#define HASH_REPORT_THRESHOLD 1
+#define REQUEST_QUEUE_LENGTH 16
 
 int to_hex_string( unsigned char* n, unsigned char* dest, int len )
 {
@@ -43,524 +36,454 @@ int to_hex_string( unsigned char* n, unsigned char* dest, int len )
    return len * 2;
 }
 
-bool is_hex_prefixed( char* str )
+/*
+ * Requests are read on their own thread so a new one can preempt the search in
+ * progress: the search stops within one kernel batch whenever a newer request is
+ * waiting, and its hashes are reported with P: instead of F:. A request that joins
+ * the running jobs also stops the search, which resumes with the job added.
+ */
+struct request_queue
 {
-   return str[0] == '0' && str[1] == 'x';
-}
-
-uint32_t coprimes[10];
+   pthread_mutex_t    lock;
+   pthread_cond_t     changed;
+   struct input_data  requests[REQUEST_QUEUE_LENGTH];
+   int                head;
+   int                count;
+   bool               eof;
+
+   bool               searching;    // Newer requests cancel the running search
+
+   struct channel*      channel;
+   struct miner_engine* engine;     // Receives seed hints, job weights and cancellations
+   uint32_t             slot_ids[ENGINE_MAX_JOBS];  // Request of the job in every slot, 0 if free
+};
 
-uint32_t bignum_mod_small( struct bn* b, uint32_t m )
+void* read_requests( void* arg )
 {
-   // Compute b % m
-   uint64_t tmp = 0;
-   size_t i;
-   for( int i=BN_ARRAY_SIZE-1; i>=0; i-- )
+   struct request_queue* queue = arg;
+   struct input_data input;
+   int more;
+
+   do
    {
-      tmp = (tmp << 32) | b->array[i];
-      tmp %= m;
-   }
-   return (uint32_t) tmp;
-}
+      int kind = read_data( queue->channel, &input );
+      more = kind != INPUT_CLOSED;
 
-void bignum_add_small( struct bn* b, uint32_t n )
-{
+      if( kind == INPUT_HINT )
+      {
+         // Hints never preempt the search, they only warm up the next seed
+         struct bn seed;
+         if( seed_from_input( &seed, &input ) )
+            hint_seed( queue->engine, &seed );
+         continue;
+      }
 
-   uint32_t tmp = b->array[0];
-   b->array[0] += n;
-   int i = 0;
-   while( i < BN_ARRAY_SIZE - 1 && tmp > b->array[i] )
-   {
-      tmp = b->array[i+1];
-      b->array[i+1]++;
-      i++;
-   }
-}
+      // Never searched, the running jobs carry on
+      if( kind == INPUT_INVALID )
+      {
+         send_finished( queue->channel, input.request_id );
+         continue;
+      }
 
-void init_work_constants()
-{
-   size_t i;
-
-   coprimes[0] = 0x0000fffd;
-   coprimes[1] = 0x0000fffb;
-   coprimes[2] = 0x0000fff7;
-   coprimes[3] = 0x0000fff1;
-   coprimes[4] = 0x0000ffef;
-   coprimes[5] = 0x0000ffe5;
-   coprimes[6] = 0x0000ffdf;
-   coprimes[7] = 0x0000ffd9;
-   coprimes[8] = 0x0000ffd3;
-   coprimes[9] = 0x0000ffd1;
-}
+      // Weights apply to the jobs of the set at once, without stopping the search. With
+      // a single wrapper there is nothing to share the whole hash rate with
+      if( kind == INPUT_WEIGHT )
+      {
+         pthread_mutex_lock( &queue->lock );
+         for( int s = 0; s < ENGINE_MAX_JOBS; s++ )
+         {
+            if( input.request_id && queue->slot_ids[s] == input.request_id )
+               set_job_weight( queue->engine, s, input.weight );
+         }
+         pthread_mutex_unlock( &queue->lock );
+         continue;
+      }
 
-struct work_data
-{
-   uint32_t x[10];
-};
+      pthread_mutex_lock( &queue->lock );
+      while( more && queue->count == REQUEST_QUEUE_LENGTH )
+         pthread_cond_wait( &queue->changed, &queue->lock );
 
-void init_work_data( struct work_data* wdata, struct bn* secured_struct_hash )
-{
-   size_t i;
-   struct bn x;
-   for( i=0; i<10; i++ )
-   {
-      wdata->x[i] = bignum_mod_small( secured_struct_hash, coprimes[i] );
-   }
+      if( more )
+         queue->requests[(queue->head + queue->count++) % REQUEST_QUEUE_LENGTH] = input;
+      else
+         queue->eof = true;
+
+      // Either way the running search is now stale
+      if( queue->searching )
+         cancel_search( queue->engine );
+
+      pthread_cond_broadcast( &queue->changed );
+      pthread_mutex_unlock( &queue->lock );
+   } while( more );
+
+   return NULL;
 }
 
 /*
- * Solidity definition:
- *
- * address[] memory recipients,
- * uint256[] memory split_percents,
- * uint256 recent_eth_block_number,
- * uint256 recent_eth_block_hash,
- * uint256 target,
- * uint256 pow_height
+ * Take the next request, waiting for one if wait is set. Returns 1 for a request, 0 if
+ * none is waiting and -1 once stdin is closed and no request is left.
  */
-struct secured_struct
-{
-   struct bn miner_address;
-   struct bn oo_address;
-   struct bn miner_percent;
-   struct bn oo_percent;
-   struct bn recent_eth_block_number;
-   struct bn recent_eth_block_hash;
-   struct bn target;
-   struct bn pow_height;
-};
-
-struct input_data
-{
-   char     miner_address[ETH_ADDRESS_SIZE + 1];
-   char     tip_address[ETH_ADDRESS_SIZE + 1];
-   char     block_hash[ETH_HASH_SIZE + 1];
-   uint64_t block_num;
-   char     difficulty_str[ETH_HASH_SIZE + 1];
-   uint64_t tip;
-   uint64_t pow_height;
-   uint64_t thread_iterations;
-   uint64_t hash_limit;
-   char     nonce_offset[ETH_HASH_SIZE + 1];
-};
-
-void read_data( struct input_data* d )
+int next_request( struct request_queue* queue, struct input_data* input, bool wait )
 {
-   char buf[READ_BUFSIZE] = { '\0' };
+   pthread_mutex_lock( &queue->lock );
+   while( wait && !queue->count && !queue->eof )
+      pthread_cond_wait( &queue->changed, &queue->lock );
 
-   int i = 0;
-   do
+   int got = queue->count > 0 ? 1 : queue->eof ? -1 : 0;
+   if( got > 0 )
    {
-      int c;
-      while ((c = getchar()) != '\n' && c != EOF)
-      {
-         if ( i < READ_BUFSIZE )
-         {
-            buf[i++] = c;
-         }
-         else
-         {
-            fprintf(stderr, "[C] Buffer was about to overflow!");
-         }
-      }
-   } while ( strlen(buf) == 0 || buf[strlen(buf)-1] != ';' );
-
-   fprintf(stderr, "[C] Buffer: %s\n", buf);
-   sscanf(buf, "%42s %42s %66s %" SCNu64 " %66s %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %66s",
-      d->miner_address,
-      d->tip_address,
-      d->block_hash,
-      &d->block_num,
-      d->difficulty_str,
-      &d->tip,
-      &d->pow_height,
-      &d->thread_iterations,
-      &d->hash_limit,
-      d->nonce_offset);
-
-   fprintf(stderr, "[C] Miner address: %s\n", d->miner_address);
-   fprintf(stderr, "[C] Tip address:   %s\n", d->tip_address);
-   fprintf(stderr, "[C] Ethereum Block Hash: %s\n", d->block_hash );
-   fprintf(stderr, "[C] Ethereum Block Number: %" PRIu64 "\n", d->block_num );
-   fprintf(stderr, "[C] Difficulty Target: %s\n", d->difficulty_str );
-   fprintf(stderr, "[C] OpenOrchard Tip: %" PRIu64 "\n", d->tip );
-   fprintf(stderr, "[C] PoW Height: %" PRIu64 "\n", d->pow_height );
-   fprintf(stderr, "[C] Thread Iterations: %" PRIu64 "\n", d->thread_iterations );
-   fprintf(stderr, "[C] Hash Limit: %" PRIu64 "\n", d->hash_limit );
-   fprintf(stderr, "[C] Nonce Offset: %s\n", d->nonce_offset );
-   fflush(stderr);
-}
+      *input = queue->requests[queue->head];
+      queue->head = (queue->head + 1) % REQUEST_QUEUE_LENGTH;
+      queue->count--;
+      pthread_cond_broadcast( &queue->changed );
+   }
+   pthread_mutex_unlock( &queue->lock );
 
+   return got;
+}
 
-void hash_secured_struct( struct bn* res, struct secured_struct* ss )
+// Let newer requests cancel the next search. A search that is already stale stops at once
+void begin_search( struct request_queue* queue )
 {
-   /* Solidity ABI encodes as follows:
-    *
-    * Offset pointer to recipient array (256 bits big endian)
-    * Offset pointer to split_perecents array (256 bits big endian)
-    * recent_eth_block_number (256 bit big endian)
-    * recent_eth_block_hash (256 bit big endian)
-    * target (256 bit big endian)
-    * pow_height (256 bit big endian)
-    * size of recipient array (256 bit big endian)
-    * miner_address
-    * oo_address
-    * size of split_percent_array (256 bit big endian)
-    * miner_percent
-    * recipient_offset
-    */
-
-   struct bn recipient_offset, split_percent_offset, array_size;
-   bignum_from_int( &recipient_offset, 6 * 32 );
-   bignum_endian_swap( &recipient_offset );
-   bignum_from_int( &split_percent_offset, 9 * 32 );
-   bignum_endian_swap( &split_percent_offset );
-   bignum_from_int( &array_size, 2 );
-   bignum_endian_swap( &array_size );
-
-   bignum_endian_swap( &ss->target );
-
-   SHA3_CTX c;
-   keccak_init( &c );
-   keccak_update( &c, (unsigned char*)&recipient_offset, sizeof(struct bn) );
-   keccak_update( &c, (unsigned char*)&split_percent_offset, sizeof(struct bn) );
-   keccak_update( &c, (unsigned char*)&ss->recent_eth_block_number, sizeof(struct bn) );
-   keccak_update( &c, (unsigned char*)&ss->recent_eth_block_hash, sizeof(struct bn) );
-   keccak_update( &c, (unsigned char*)&ss->target, sizeof(struct bn) );
-   keccak_update( &c, (unsigned char*)&ss->pow_height, sizeof(struct bn) );
-   keccak_update( &c, (unsigned char*)&array_size, sizeof(struct bn) );
-   keccak_update( &c, (unsigned char*)&ss->miner_address, sizeof(struct bn) );
-   keccak_update( &c, (unsigned char*)&ss->oo_address, sizeof(struct bn) );
-   keccak_update( &c, (unsigned char*)&array_size, sizeof(struct bn) );
-   keccak_update( &c, (unsigned char*)&ss->miner_percent, sizeof(struct bn) );
-   keccak_update( &c, (unsigned char*)&ss->oo_percent, sizeof(struct bn) );
-   keccak_final( &c, (unsigned char*)res );
-
-   bignum_endian_swap( res );
-   bignum_endian_swap( &ss->target );
+   pthread_mutex_lock( &queue->lock );
+   queue->searching = true;
+   if( queue->count > 0 || queue->eof )
+      cancel_search( queue->engine );
+   pthread_mutex_unlock( &queue->lock );
 }
 
-
-void find_word( struct bn* result, uint32_t x, uint32_t* coefficients, struct bn* word_buffer )
+void end_search( struct request_queue* queue )
 {
-   uint64_t y = coefficients[4];
-   y *= x;
-   y += coefficients[3];
-   y %= WORD_BUFFER_LENGTH - 1;
-   y *= x;
-   y += coefficients[2];
-   y %= WORD_BUFFER_LENGTH - 1;
-   y *= x;
-   y += coefficients[1];
-   y %= WORD_BUFFER_LENGTH - 1;
-   y *= x;
-   y += coefficients[0];
-   y %= WORD_BUFFER_LENGTH - 1;
-   bignum_assign( result, word_buffer + y );
+   pthread_mutex_lock( &queue->lock );
+   queue->searching = false;
+   pthread_mutex_unlock( &queue->lock );
 }
 
-
-void find_and_xor_word( struct bn* result, uint32_t x, uint32_t* coefficients, struct bn* word_buffer )
+void set_slot_id( struct request_queue* queue, int slot, uint32_t request_id )
 {
-   uint64_t y = coefficients[4];
-   y *= x;
-   y += coefficients[3];
-   y %= WORD_BUFFER_LENGTH - 1;
-   y *= x;
-   y += coefficients[2];
-   y %= WORD_BUFFER_LENGTH - 1;
-   y *= x;
-   y += coefficients[1];
-   y %= WORD_BUFFER_LENGTH - 1;
-   y *= x;
-   y += coefficients[0];
-   y %= WORD_BUFFER_LENGTH - 1;
-   bignum_xor( result, word_buffer + y, result );
+   pthread_mutex_lock( &queue->lock );
+   queue->slot_ids[slot] = request_id;
+   pthread_mutex_unlock( &queue->lock );
 }
 
-
-void work( struct bn* result, struct bn* secured_struct_hash, struct bn* nonce, struct bn* word_buffer )
+// In share mode, the lowest result of the job in slot comes before its final response
+void send_job_best( struct channel* ch, struct miner_engine* engine, int slot, uint32_t request_id )
 {
-   struct work_data wdata;
-   init_work_data( &wdata, secured_struct_hash );
-
-   bignum_assign( result, secured_struct_hash ); // result = secured_struct_hash;
-
-   uint32_t coefficients[5];
+   struct proof best;
+   if( job_best( engine, slot, &best ) )
+      send_best( ch, request_id, &best.nonce, &best.result );
+}
 
-   int i;
-   for( i = 0; i < sizeof(coefficients) / sizeof(uint32_t); ++i )
+// Abandon every job of the set
+void preempt_jobs( struct request_queue* queue, struct miner_engine* engine )
+{
+   for( int s = 0; s < ENGINE_MAX_JOBS; s++ )
    {
-      coefficients[i] = 1 + bignum_mod_small( nonce, coprimes[i] );
-   }
+      if( !queue->slot_ids[s] )
+         continue;
 
-   for( i = 0; i < sizeof(coprimes) / sizeof(uint32_t); ++i )
-   {
-      find_and_xor_word( result, wdata.x[i], coefficients, word_buffer );
+      send_job_best( queue->channel, engine, s, queue->slot_ids[s] );
+      send_preempted( queue->channel, queue->slot_ids[s], engine_hashes( engine, s ) );
+
+      fprintf(stderr, "[C] Abandoned for a newer request after %" PRIu64 " hashes\n", engine_hashes( engine, s ));
+      fflush(stderr);
+      set_slot_id( queue, s, 0 );
    }
 }
 
 
-int words_are_unique( struct bn* secured_struct_hash, struct bn* nonce, struct bn* word_buffer )
+struct miner_options
 {
-   struct work_data wdata;
-   struct bn w[sizeof(coprimes) / sizeof(uint32_t)];
-   init_work_data( &wdata, secured_struct_hash );
+   struct engine_options engine;
+   enum protocol_mode protocol;
+   const char* listen;            // Socket path of the daemon, NULL to serve stdin
+};
 
-   uint32_t coefficients[5];
 
-   int i, j;
-   for( i = 0; i < sizeof(coefficients) / sizeof(uint32_t); ++i )
-   {
-      coefficients[i] = 1 + bignum_mod_small( nonce, coprimes[i] );
-   }
+// Parse the "--option value" arguments. Positional arguments are the addresses the
+// JS wrapper passes along, which arrive again with every request, so they are ignored
+int parse_options( struct miner_options* opts, int argc, char** argv )
+{
+   default_engine_options( &opts->engine );
+   opts->protocol = PROTOCOL_TEXT;
+   opts->listen = NULL;
 
-   for( i = 0; i < sizeof(coprimes) / sizeof(uint32_t); ++i )
+   for( int i = 1; i < argc; i++ )
    {
-      find_word( w+i, wdata.x[i], coefficients, word_buffer );
-      for( j = 0; j < i; j++ )
+      if( strcmp( argv[i], "--prefetch-distance" ) == 0 && i + 1 < argc )
       {
-         if( bignum_cmp( w+i, w+j ) == 0 )
+         i++;
+         if( strcmp( argv[i], "auto" ) == 0 )
+         {
+            opts->engine.auto_prefetch = true;
+         }
+         else
+         {
+            char* end;
+            unsigned long distance = strtoul( argv[i], &end, 10 );
+            if( *argv[i] == '\0' || *end != '\0' )
+            {
+               fprintf(stderr, "[C] Invalid prefetch distance: %s\n", argv[i]);
+               return 0;
+            }
+            opts->engine.auto_prefetch = false;
+            opts->engine.prefetch_distance = (unsigned)distance;
+         }
+      }
+      else if( strcmp( argv[i], "--report-interval" ) == 0 && i + 1 < argc )
+      {
+         i++;
+         char* end;
+         unsigned long interval = strtoul( argv[i], &end, 10 );
+         if( *argv[i] == '\0' || *end != '\0' || interval == 0 )
+         {
+            fprintf(stderr, "[C] Invalid report interval: %s\n", argv[i]);
             return 0;
+         }
+         opts->engine.report_interval_ms = (unsigned)interval;
       }
-   }
-   return 1;
-}
-
-
-int main( int argc, char** argv )
-{
-   #ifdef _WIN32
-      _setmode( _fileno( stdin ), _O_BINARY );
-   #endif
-
-   struct bn* word_buffer = malloc( WORD_BUFFER_BYTES );
-   struct bn seed, bn_i;
-
-   char bn_str[78];
-
-   SHA3_CTX c;
-
-   struct secured_struct ss;
-
-   init_work_constants();
-
-   bignum_init( &seed );
-
-   while ( true )
-   {
-      struct input_data input;
-
-      read_data( &input );
-
-      if( is_hex_prefixed( input.miner_address ) )
+      else if( strcmp( argv[i], "--cache-dir" ) == 0 && i + 1 < argc )
       {
-         bignum_from_string( &ss.miner_address, input.miner_address + 2, strlen(input.miner_address) - 2 );
+         opts->engine.cache_dir = argv[++i];
       }
-      else
+      else if( strcmp( argv[i], "--cache-size" ) == 0 && i + 1 < argc )
       {
-         bignum_from_string( &ss.miner_address, input.miner_address , strlen(input.miner_address) );
+         i++;
+         char* end;
+         unsigned long size = strtoul( argv[i], &end, 10 );
+         if( *argv[i] == '\0' || *end != '\0' || size == 0 )
+         {
+            fprintf(stderr, "[C] Invalid cache size: %s\n", argv[i]);
+            return 0;
+         }
+         opts->engine.cache_size = (unsigned)size;
       }
-
-      if( is_hex_prefixed( input.tip_address ) )
+      else if( strcmp( argv[i], "--buffers" ) == 0 && i + 1 < argc )
       {
-         bignum_from_string( &ss.oo_address, input.tip_address + 2, strlen(input.tip_address) - 2 );
+         i++;
+         char* end;
+         unsigned long count = strtoul( argv[i], &end, 10 );
+         if( *argv[i] == '\0' || *end != '\0' || count == 0 )
+         {
+            fprintf(stderr, "[C] Invalid word buffer count: %s\n", argv[i]);
+            return 0;
+         }
+         opts->engine.buffer_count = (unsigned)count;
       }
-      else
+      else if( strcmp( argv[i], "--replicate" ) == 0 && i + 1 < argc )
       {
-         bignum_from_string( &ss.oo_address, input.tip_address, strlen(input.tip_address) );
+         i++;
+         if( strcmp( argv[i], "auto" ) == 0 )
+            opts->engine.topology = TOPOLOGY_AUTO;
+         else if( strcmp( argv[i], "numa" ) == 0 )
+            opts->engine.topology = TOPOLOGY_NUMA;
+         else if( strcmp( argv[i], "l3" ) == 0 )
+            opts->engine.topology = TOPOLOGY_L3;
+         else if( strcmp( argv[i], "off" ) == 0 )
+            opts->engine.topology = TOPOLOGY_OFF;
+         else
+         {
+            fprintf(stderr, "[C] Invalid replication policy: %s\n", argv[i]);
+            return 0;
+         }
       }
-
-      bignum_to_string( &ss.miner_address, bn_str, sizeof(bn_str), false );
-      fprintf(stderr, "[C] Miner Address: %s\n", bn_str);
-
-      bignum_to_string( &ss.oo_address, bn_str, sizeof(bn_str), false );
-      fprintf(stderr, "[C] OpenOrchard Address: %s\n", bn_str);
-      fflush(stderr);
-
-      bignum_endian_swap( &ss.miner_address );
-      bignum_endian_swap( &ss.oo_address );
-
-      uint64_t miner_pay = PERCENT_100 - input.tip;
-      uint64_t oo_pay    = input.tip;
-
-      fprintf(stderr, "[C] Miner pay: %" PRIu64 "\n", miner_pay);
-      fprintf(stderr, "[C] OpenOrchard tip: %" PRIu64 "\n", oo_pay);
-
-      bignum_from_int( &ss.miner_percent, PERCENT_100 - input.tip );
-      bignum_endian_swap( &ss.miner_percent );
-      bignum_from_int( &ss.oo_percent, input.tip );
-      bignum_endian_swap( &ss.oo_percent );
-      bignum_from_int( &ss.recent_eth_block_number, input.block_num );
-      bignum_endian_swap( &ss.recent_eth_block_number );
-
-      if( is_hex_prefixed( input.block_hash ) )
+      else if( strcmp( argv[i], "--threads" ) == 0 && i + 1 < argc )
       {
-         bignum_from_string( &ss.recent_eth_block_hash, input.block_hash + 2, ETH_HASH_SIZE - 2 );
+         i++;
+         char* end;
+         long threads = strtol( argv[i], &end, 10 );
+         if( *argv[i] == '\0' || *end != '\0' || threads <= 0 )
+         {
+            fprintf(stderr, "[C] Invalid thread count: %s\n", argv[i]);
+            return 0;
+         }
+         opts->engine.threads = (int)threads;
       }
-      else
+      else if( strcmp( argv[i], "--cpus" ) == 0 && i + 1 < argc )
       {
-         bignum_from_string( &ss.recent_eth_block_hash, input.block_hash, ETH_HASH_SIZE - 2 );
+         opts->engine.cpu_list = argv[++i];
+         opts->engine.pin = true;
       }
-
-      bignum_endian_swap( &ss.recent_eth_block_hash );
-
-      if( is_hex_prefixed( input.difficulty_str ) )
+      else if( strcmp( argv[i], "--smt" ) == 0 && i + 1 < argc )
       {
-         bignum_from_string( &ss.target, input.difficulty_str + 2, ETH_HASH_SIZE - 2 );
+         i++;
+         if( strcmp( argv[i], "all" ) == 0 )
+            opts->engine.smt = SMT_ALL;
+         else if( strcmp( argv[i], "core" ) == 0 )
+            opts->engine.smt = SMT_CORE;
+         else
+         {
+            fprintf(stderr, "[C] Invalid SMT policy: %s\n", argv[i]);
+            return 0;
+         }
+         opts->engine.pin = true;
       }
-      else
+      else if( strcmp( argv[i], "--pin" ) == 0 )
       {
-         bignum_from_string( &ss.target, input.difficulty_str, ETH_HASH_SIZE - 2 );
+         opts->engine.pin = true;
       }
-
-      bignum_from_int( &ss.pow_height, input.pow_height );
-      bignum_endian_swap( &ss.pow_height );
-
-      if( bignum_cmp( &seed, &ss.recent_eth_block_hash ) )
+      else if( strcmp( argv[i], "--protocol" ) == 0 && i + 1 < argc )
       {
-         bignum_assign( &seed, &ss.recent_eth_block_hash );
-         // Procedurally generate word buffer w[i] from a seed
-         // Each word buffer element is computed by w[i] = H(seed, i)
-         for( unsigned long i = 0; i < WORD_BUFFER_LENGTH; i++ )
+         i++;
+         if( strcmp( argv[i], "text" ) == 0 )
+            opts->protocol = PROTOCOL_TEXT;
+         else if( strcmp( argv[i], "binary" ) == 0 )
+            opts->protocol = PROTOCOL_BINARY;
+         else
          {
-            keccak_init( &c );
-            keccak_update( &c, (unsigned char*)&seed, sizeof(seed) );
-            bignum_from_int( &bn_i, i );
-            bignum_endian_swap( &bn_i );
-            keccak_update( &c, (unsigned char*)&bn_i, sizeof(struct bn) );
-            keccak_final( &c, (unsigned char*)(word_buffer + i) );
-            bignum_endian_swap( word_buffer + i );
+            fprintf(stderr, "[C] Invalid protocol: %s\n", argv[i]);
+            return 0;
          }
       }
+      else if( strcmp( argv[i], "--listen" ) == 0 && i + 1 < argc )
+      {
+         opts->listen = argv[++i];
+      }
+      else if( strcmp( argv[i], "--shared-memory" ) == 0 )
+      {
+         opts->engine.shared_memory = true;
+      }
+      else if( strcmp( argv[i], "--lock-memory" ) == 0 )
+      {
+         opts->engine.lock_memory = true;
+      }
+      else if( strncmp( argv[i], "--", 2 ) == 0 )
+      {
+         fprintf(stderr, "[C] Unknown option: %s\n", argv[i]);
+         return 0;
+      }
+   }
 
-      bignum_to_string( &seed, bn_str, sizeof(bn_str), true );
-      fprintf(stderr, "[C] Seed: %s\n", bn_str);
-
-      bignum_to_string( &ss.target, bn_str, sizeof(bn_str), true );
-      fprintf(stderr, "[C] Difficulty Target: %s\n", bn_str);
-      fflush(stderr);
+   return 1;
+}
 
-      struct bn secured_struct_hash;
-      hash_secured_struct( &secured_struct_hash, &ss );
 
-      bignum_to_string( &secured_struct_hash, bn_str, sizeof(bn_str), true);
-      fprintf(stderr, "[C] Secured Struct Hash: %s\n", bn_str );
+int main( int argc, char** argv )
+{
+   #ifdef _WIN32
+      _setmode( _fileno( stdin ), _O_BINARY );
+   #endif
 
-      struct bn nonce;
-      bignum_assign( &nonce, &ss.recent_eth_block_hash );
-      bignum_endian_swap( &nonce );
+   struct miner_options opts;
+   if( !parse_options( &opts, argc, argv ) )
+   {
+      return 1;
+   }
 
-      struct bn nonce_offset;
-      if( is_hex_prefixed( input.nonce_offset ) )
-      {
-         bignum_from_string( &nonce_offset, input.nonce_offset + 2, ETH_HASH_SIZE - 2 );
-      }
-      else
+   struct miner_engine engine;
+   if( opts.listen )
+   {
+      // The daemon sends its own reports, for whichever client's job is being searched
+      unsigned report_interval_ms = opts.engine.report_interval_ms;
+      opts.engine.report_interval_ms = 0;
+      if( !init_engine( &engine, &opts.engine ) )
       {
-         bignum_from_string( &nonce_offset, input.nonce_offset, ETH_HASH_SIZE - 2 );
+         return 1;
       }
-      bignum_add( &nonce, &nonce_offset, &nonce );
 
-      bignum_to_string( &nonce, bn_str, sizeof(bn_str), true );
-      fprintf(stderr, "[C] Starting Nonce: %s\n", bn_str );
+      int ok = run_daemon( &engine, opts.listen, opts.protocol, report_interval_ms );
+      release_engine( &engine );
+      return ok ? 0 : 1;
+   }
 
-      struct bn result, t_nonce, t_result, s_nonce;
-      bool stop = false;
+   struct channel channel;
+   open_stdio_channel( &channel, opts.protocol );
 
-      bignum_assign( &s_nonce, &nonce );
-      uint32_t hash_report_counter = 0;
-      time_t timer;
-      struct tm* timeinfo;
-      char time_str[20];
+   if( !init_engine( &engine, &opts.engine ) )
+   {
+      return 1;
+   }
 
-      uint64_t hashes = 0;
+   // The wrapper sizes its per-thread batches from the team size
+   send_thread_count( &channel, engine.threads );
 
-      bignum_init( &result );
+   struct request_queue queue = { .head = 0, .count = 0, .eof = false, .searching = false, .channel = &channel, .engine = &engine };
+   pthread_t reader;
+   pthread_mutex_init( &queue.lock, NULL );
+   pthread_cond_init( &queue.changed, NULL );
+   if( pthread_create( &reader, NULL, read_requests, &queue ) )
+   {
+      fprintf(stderr, "[C] Could not start the request reader\n");
+      return 1;
+   }
 
-      #pragma omp parallel private(t_nonce, t_result)
+   char bn_str[78];
+   int active = 0;
+
+   while ( true )
+   {
+      struct input_data input;
+      int got;
+
+      // Take every waiting request, only waiting for one when there is nothing to search
+      while( (got = next_request( &queue, &input, active == 0 )) > 0 )
       {
-         while( !stop && hashes <= input.hash_limit )
-         {
-            #pragma omp critical
-            {
-               if( omp_get_thread_num() == 0 )
-               {
-                  if( hash_report_counter >= HASH_REPORT_THRESHOLD )
-                  {
-                     time( &timer );
-                     timeinfo = localtime( &timer );
-                     strftime( time_str, sizeof(time_str), "%FT%T", timeinfo );
-                     fprintf( stdout, "H:%s %" PRId64 ";\n", time_str, hashes );
-                     fflush( stdout );
-                     hash_report_counter = 0;
-                  }
-                  else
-                  {
-                     hash_report_counter++;
-                  }
-
-               }
-               bignum_assign( &t_nonce, &s_nonce );
-               bignum_add_small( &s_nonce, input.thread_iterations );
-               hashes += input.thread_iterations;
-            }
+         struct miner_job job;
+         job_from_input( &job, &channel, &input );
 
-            for( uint64_t i = 0; i < input.thread_iterations && !stop; i++ )
+         int slot = -1;
+         if( active && (input.flags & REQUEST_JOIN) )
+         {
+            slot = add_job( &engine, &job, input.weight );
+            if( slot < 0 )
             {
-               work( &t_result, &secured_struct_hash, &t_nonce, word_buffer );
-
-               if( bignum_cmp( &t_result, &ss.target ) <= 0)
-               {
-                  if( !words_are_unique( &secured_struct_hash, &t_nonce, word_buffer ) )
-                  {
-                     // Non-unique, do nothing
-                     // This is normal
-                     fprintf( stderr, "[C] Possible proof failed uniqueness check\n");
-                     bignum_inc( &t_nonce );
-                  }
-                  else
-                  {
-                     #pragma omp critical
-                     {
-                        // Two threads could find a valid proof at the same time (unlikely, but possible).
-                        // We want to return the more difficult proof
-                        if( !stop )
-                        {
-                           stop = true;
-                           bignum_assign( &result, &t_result );
-                           bignum_assign( &nonce, &t_nonce );
-                        }
-                        else if( bignum_cmp( &t_result, &result ) < 0 )
-                        {
-                           bignum_assign( &result, &t_result );
-                           bignum_assign( &nonce, &t_nonce );
-                        }
-                     }
-                  }
-               }
-               else
-                  bignum_inc( &t_nonce );
+               fprintf(stderr, "[C] Request %" PRIu32 " cannot join the running jobs, replacing them\n", input.request_id);
+               fflush(stderr);
             }
          }
+         if( slot < 0 )
+         {
+            preempt_jobs( &queue, &engine );
+            active = 0;
+            set_job( &engine, &job );
+            set_job_weight( &engine, 0, input.weight );
+            slot = 0;
+         }
+         set_slot_id( &queue, slot, input.request_id );
+         active++;
       }
 
-      if( bignum_is_zero( &result ) )
+      if( got < 0 )
       {
-         fprintf( stdout, "F:1;\n" );
+         preempt_jobs( &queue, &engine );
+         break;
+      }
+
+      struct bn nonce;
+      int slot;
+      begin_search( &queue );
+      enum engine_status status = search_job( &engine, &nonce, &slot );
+      end_search( &queue );
+
+      // A cancelled search was preempted, the newer requests are taken first
+      if( status == ENGINE_CANCELLED )
+         continue;
+
+      uint32_t request_id = queue.slot_ids[slot];
+      set_slot_id( &queue, slot, 0 );
+      active--;
+      send_job_best( &channel, &engine, slot, request_id );
+
+      if( status == ENGINE_FINISHED )
+      {
+         send_finished( &channel, request_id );
 
          fprintf(stderr, "[C] Finished without nonce\n");
          fflush(stderr);
       }
       else
       {
-         bignum_to_string( &nonce, bn_str, sizeof(bn_str), false );
-         fprintf( stdout, "N:%s;\n", bn_str );
+         send_nonce( &channel, request_id, &nonce );
 
+         bignum_to_string( &nonce, bn_str, sizeof(bn_str), false );
          fprintf(stderr, "[C] Nonce: %s\n", bn_str);
          fflush(stderr);
       }
-
-      fflush( stdout );
    }
+
+   fprintf(stderr, "[C] Input closed, exiting\n");
+   pthread_join( reader, NULL );
+   release_engine( &engine );
+
+   return 0;
 }
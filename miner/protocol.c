@@ -0,0 +1,490 @@
+#include "protocol.h"
+#include "engine.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#define READ_BUFSIZE         1024
+
+// Five fields and five u64s, then the optional weight and flags, and share target
+#define REQUEST_PAYLOAD_BYTES (5 * FRAME_FIELD_BYTES + 5 * 8)
+#define REQUEST_WEIGHT_BYTES  (REQUEST_PAYLOAD_BYTES + 2 * 4)
+#define REQUEST_SHARE_BYTES   (REQUEST_WEIGHT_BYTES + FRAME_FIELD_BYTES)
+
+#define ADDRESS_BYTES          20
+
+static bool is_hex_prefixed( char* str )
+{
+   return str[0] == '0' && str[1] == 'x';
+}
+
+static void parse_hash( struct bn* hash, char* str )
+{
+   if( is_hex_prefixed( str ) )
+   {
+      bignum_from_string( hash, str + 2, ETH_HASH_SIZE - 2 );
+   }
+   else
+   {
+      bignum_from_string( hash, str, ETH_HASH_SIZE - 2 );
+   }
+}
+
+static void parse_address( struct bn* address, char* str )
+{
+   if( is_hex_prefixed( str ) )
+   {
+      bignum_from_string( address, str + 2, strlen(str) - 2 );
+   }
+   else
+   {
+      bignum_from_string( address, str, strlen(str) );
+   }
+}
+
+void job_from_input( struct miner_job* job, struct channel* ch, struct input_data* input )
+{
+   job->channel = ch;
+   job->request_id = input->request_id;
+   parse_address( &job->miner_address, input->miner_address );
+   parse_address( &job->tip_address, input->tip_address );
+   parse_hash( &job->block_hash, input->block_hash );
+   parse_hash( &job->target, input->difficulty_str );
+   parse_hash( &job->nonce_offset, input->nonce_offset );
+   job->block_num = input->block_num;
+   job->tip = input->tip;
+   job->pow_height = input->pow_height;
+   job->thread_iterations = input->thread_iterations;
+   job->hash_limit = input->hash_limit;
+   if( input->share_target_str[0] )
+      parse_hash( &job->share_target, input->share_target_str );
+   else
+      bignum_init( &job->share_target );
+}
+
+int seed_from_input( struct bn* seed, struct input_data* input )
+{
+   size_t length = strlen( input->block_hash );
+   if( length != ETH_HASH_SIZE && length != ETH_HASH_SIZE - 2 )
+      return 0;
+
+   parse_hash( seed, input->block_hash );
+   return 1;
+}
+
+void open_channel( struct channel* ch, FILE* in, FILE* out, enum protocol_mode mode )
+{
+   ch->in = in;
+   ch->out = out;
+   ch->mode = mode;
+   ch->next_text_request = 1;
+   ch->failed = false;
+   pthread_mutex_init( &ch->lock, NULL );
+}
+
+void open_stdio_channel( struct channel* ch, enum protocol_mode mode )
+{
+   #ifdef _WIN32
+   if( mode == PROTOCOL_BINARY )
+      _setmode( _fileno( stdout ), _O_BINARY );
+   #endif
+
+   open_channel( ch, stdin, stdout, mode );
+}
+
+void close_channel( struct channel* ch )
+{
+   pthread_mutex_destroy( &ch->lock );
+}
+
+static void log_request( struct input_data* d )
+{
+   fprintf(stderr, "[C] Request: %" PRIu32 "\n", d->request_id );
+   fprintf(stderr, "[C] Miner address: %s\n", d->miner_address);
+   fprintf(stderr, "[C] Tip address:   %s\n", d->tip_address);
+   fprintf(stderr, "[C] Ethereum Block Hash: %s\n", d->block_hash );
+   fprintf(stderr, "[C] Ethereum Block Number: %" PRIu64 "\n", d->block_num );
+   fprintf(stderr, "[C] Difficulty Target: %s\n", d->difficulty_str );
+   fprintf(stderr, "[C] OpenOrchard Tip: %" PRIu64 "\n", d->tip );
+   fprintf(stderr, "[C] PoW Height: %" PRIu64 "\n", d->pow_height );
+   fprintf(stderr, "[C] Thread Iterations: %" PRIu64 "\n", d->thread_iterations );
+   fprintf(stderr, "[C] Hash Limit: %" PRIu64 "\n", d->hash_limit );
+   fprintf(stderr, "[C] Nonce Offset: %s\n", d->nonce_offset );
+   fprintf(stderr, "[C] Weight: %" PRIu32 "%s\n", d->weight, d->flags & REQUEST_JOIN ? ", joining" : "" );
+   if( d->share_target_str[0] )
+      fprintf(stderr, "[C] Share Target: %s\n", d->share_target_str );
+   fflush(stderr);
+}
+
+// Ranges of no nonces would never get the search past its hash limit
+static int checked_request( struct input_data* d )
+{
+   if( d->thread_iterations == 0 )
+   {
+      fprintf(stderr, "[C] Request %" PRIu32 " has no thread iterations, rejecting it\n", d->request_id);
+      fflush(stderr);
+      return INPUT_INVALID;
+   }
+   return INPUT_REQUEST;
+}
+
+static int read_text( struct channel* ch, struct input_data* d )
+{
+   char buf[READ_BUFSIZE] = { '\0' };
+
+   int i = 0;
+   int c;
+   do
+   {
+      while ((c = getc(ch->in)) != '\n' && c != EOF)
+      {
+         if ( i < READ_BUFSIZE - 1 )
+         {
+            buf[i++] = c;
+         }
+         else
+         {
+            fprintf(stderr, "[C] Buffer was about to overflow!");
+         }
+      }
+      if ( c == EOF && ( strlen(buf) == 0 || buf[strlen(buf)-1] != ';' ) )
+      {
+         return INPUT_CLOSED;
+      }
+   } while ( strlen(buf) == 0 || buf[strlen(buf)-1] != ';' );
+
+   if ( strncmp(buf, "hint ", 5) == 0 )
+   {
+      d->block_hash[0] = '\0';
+      sscanf(buf, "hint %66[0-9a-fA-Fx]", d->block_hash);
+      fprintf(stderr, "[C] Seed hint: %s\n", d->block_hash);
+      fflush(stderr);
+      return INPUT_HINT;
+   }
+
+   if ( strncmp(buf, "weight ", 7) == 0 )
+   {
+      d->weight = 0;
+      d->request_id = 0;
+      sscanf(buf, "weight %" SCNu32 " %" SCNu32, &d->weight, &d->request_id);
+      fprintf(stderr, "[C] Weight: %" PRIu32 " for %" PRIu32 "\n", d->weight, d->request_id);
+      fflush(stderr);
+      return INPUT_WEIGHT;
+   }
+
+   fprintf(stderr, "[C] Buffer: %s\n", buf);
+   d->weight = 1;
+   d->flags = 0;
+   d->share_target_str[0] = '\0';
+   sscanf(buf, "%42s %42s %66s %" SCNu64 " %66s %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %66s %" SCNu32 " %" SCNu32 " %66[0-9a-fA-Fx]",
+      d->miner_address,
+      d->tip_address,
+      d->block_hash,
+      &d->block_num,
+      d->difficulty_str,
+      &d->tip,
+      &d->pow_height,
+      &d->thread_iterations,
+      &d->hash_limit,
+      d->nonce_offset,
+      &d->weight,
+      &d->flags,
+      d->share_target_str);
+
+   d->request_id = ch->next_text_request++;
+   log_request( d );
+
+   return checked_request( d );
+}
+
+static uint32_t get_u32( const unsigned char* p )
+{
+   return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t get_u64( const unsigned char* p )
+{
+   return ((uint64_t)get_u32( p ) << 32) | get_u32( p + 4 );
+}
+
+// "0x" followed by the bytes of a big endian field in hex
+static void field_to_hex( char* dest, const unsigned char* field, int bytes )
+{
+   static const char hex[16] = {'0','1','2','3','4','5','6','7','8','9','a','b','c','d','e','f'};
+
+   *dest++ = '0';
+   *dest++ = 'x';
+   for( int i = 0; i < bytes; i++ )
+   {
+      *dest++ = hex[field[i] >> 4];
+      *dest++ = hex[field[i] & 0x0F];
+   }
+   *dest = '\0';
+}
+
+static bool read_exact( FILE* in, unsigned char* buf, size_t bytes )
+{
+   return fread( buf, 1, bytes, in ) == bytes;
+}
+
+static int read_binary( struct channel* ch, struct input_data* d )
+{
+   unsigned char frame[FRAME_MAX_BYTES];
+
+   for( ;; )
+   {
+      if( !read_exact( ch->in, frame, 4 ) )
+         return INPUT_CLOSED;
+
+      // A length outside the limits means the stream is out of step, there is no recovering
+      uint32_t length = get_u32( frame );
+      if( length < FRAME_HEADER_BYTES - 4 || length > FRAME_MAX_BYTES - 4 )
+      {
+         fprintf(stderr, "[C] Invalid frame length %" PRIu32 ", closing the input\n", length);
+         return INPUT_CLOSED;
+      }
+      if( !read_exact( ch->in, frame + 4, length ) )
+         return INPUT_CLOSED;
+
+      unsigned version = frame[4], type = frame[5];
+      uint32_t id = get_u32( frame + 8 );
+      const unsigned char* payload = frame + FRAME_HEADER_BYTES;
+      size_t payload_bytes = length + 4 - FRAME_HEADER_BYTES;
+
+      // Frames may grow new fields at the end, only a short payload is an error
+      if( version != PROTOCOL_VERSION )
+      {
+         fprintf(stderr, "[C] Ignoring frame of protocol version %u\n", version);
+      }
+      else if( type == FRAME_HINT && payload_bytes >= FRAME_FIELD_BYTES )
+      {
+         field_to_hex( d->block_hash, payload, FRAME_FIELD_BYTES );
+         fprintf(stderr, "[C] Seed hint: %s\n", d->block_hash);
+         fflush(stderr);
+         return INPUT_HINT;
+      }
+      else if( type == FRAME_WEIGHT && payload_bytes >= 4 )
+      {
+         d->weight = get_u32( payload );
+         d->request_id = id;
+         fprintf(stderr, "[C] Weight: %" PRIu32 " for %" PRIu32 "\n", d->weight, d->request_id);
+         fflush(stderr);
+         return INPUT_WEIGHT;
+      }
+      else if( type == FRAME_REQUEST && payload_bytes >= REQUEST_PAYLOAD_BYTES )
+      {
+         d->request_id = id;
+         field_to_hex( d->miner_address, payload + FRAME_FIELD_BYTES - ADDRESS_BYTES, ADDRESS_BYTES );
+         payload += FRAME_FIELD_BYTES;
+         field_to_hex( d->tip_address, payload + FRAME_FIELD_BYTES - ADDRESS_BYTES, ADDRESS_BYTES );
+         payload += FRAME_FIELD_BYTES;
+         field_to_hex( d->block_hash, payload, FRAME_FIELD_BYTES );
+         payload += FRAME_FIELD_BYTES;
+         field_to_hex( d->difficulty_str, payload, FRAME_FIELD_BYTES );
+         payload += FRAME_FIELD_BYTES;
+         field_to_hex( d->nonce_offset, payload, FRAME_FIELD_BYTES );
+         payload += FRAME_FIELD_BYTES;
+         d->block_num = get_u64( payload );
+         d->tip = get_u64( payload + 8 );
+         d->pow_height = get_u64( payload + 16 );
+         d->thread_iterations = get_u64( payload + 24 );
+         d->hash_limit = get_u64( payload + 32 );
+         d->weight = payload_bytes >= REQUEST_WEIGHT_BYTES ? get_u32( payload + 40 ) : 1;
+         d->flags = payload_bytes >= REQUEST_WEIGHT_BYTES ? get_u32( payload + 44 ) : 0;
+
+         // A zero share target is the same as none
+         d->share_target_str[0] = '\0';
+         if( payload_bytes >= REQUEST_SHARE_BYTES )
+         {
+            const unsigned char* share_target = payload + 48;
+            for( int i = 0; i < FRAME_FIELD_BYTES; i++ )
+            {
+               if( share_target[i] )
+               {
+                  field_to_hex( d->share_target_str, share_target, FRAME_FIELD_BYTES );
+                  break;
+               }
+            }
+         }
+
+         log_request( d );
+         return checked_request( d );
+      }
+      else
+      {
+         fprintf(stderr, "[C] Ignoring frame of type 0x%02x (%zu bytes)\n", type, payload_bytes);
+      }
+      fflush(stderr);
+   }
+}
+
+int read_data( struct channel* ch, struct input_data* d )
+{
+   return ch->mode == PROTOCOL_BINARY ? read_binary( ch, d ) : read_text( ch, d );
+}
+
+static void put_u32( FILE* out, uint32_t v )
+{
+   unsigned char b[4] = { v >> 24, v >> 16, v >> 8, v };
+   fwrite( b, 1, sizeof(b), out );
+}
+
+static void put_u64( FILE* out, uint64_t v )
+{
+   put_u32( out, (uint32_t)(v >> 32) );
+   put_u32( out, (uint32_t)v );
+}
+
+static void put_header( FILE* out, enum frame_type type, uint32_t request_id, size_t payload_bytes )
+{
+   unsigned char b[4] = { PROTOCOL_VERSION, type, 0, 0 };
+   put_u32( out, (uint32_t)(FRAME_HEADER_BYTES - 4 + payload_bytes) );
+   fwrite( b, 1, sizeof(b), out );
+   put_u32( out, request_id );
+}
+
+static void send_end( struct channel* ch )
+{
+   if( fflush( ch->out ) || ferror( ch->out ) )
+      ch->failed = true;
+   pthread_mutex_unlock( &ch->lock );
+}
+
+void send_thread_count( struct channel* ch, int threads )
+{
+   pthread_mutex_lock( &ch->lock );
+   if( ch->mode == PROTOCOL_BINARY )
+   {
+      put_header( ch->out, FRAME_THREADS, 0, 4 );
+      put_u32( ch->out, threads );
+   }
+   else
+   {
+      fprintf( ch->out, "T:%d;\n", threads );
+   }
+   send_end( ch );
+}
+
+void send_hash_report( struct channel* ch, uint32_t request_id, uint64_t hashes, double rate, const double* thread_rates, int threads )
+{
+   pthread_mutex_lock( &ch->lock );
+   if( ch->mode == PROTOCOL_BINARY )
+   {
+      struct timespec ts;
+      clock_gettime( CLOCK_REALTIME, &ts );
+
+      put_header( ch->out, FRAME_HASH_REPORT, request_id, 3 * 8 + 4 + threads * 8 );
+      put_u64( ch->out, (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 );
+      put_u64( ch->out, hashes );
+      put_u64( ch->out, (uint64_t)(rate + 0.5) );
+      put_u32( ch->out, threads );
+      for( int t = 0; t < threads; t++ )
+         put_u64( ch->out, (uint64_t)(thread_rates[t] + 0.5) );
+   }
+   else
+   {
+      time_t timer;
+      char time_str[20];
+      time( &timer );
+      strftime( time_str, sizeof(time_str), "%FT%T", localtime( &timer ) );
+
+      fprintf( ch->out, "H:%s %" PRIu64 " %.0f ", time_str, hashes, rate );
+      for( int t = 0; t < threads; t++ )
+         fprintf( ch->out, "%s%.0f", t ? "," : "", thread_rates[t] );
+      fprintf( ch->out, ";\n" );
+   }
+   send_end( ch );
+}
+
+static void put_field( FILE* out, struct bn* n )
+{
+   // Most significant byte first, whatever the limb size
+   unsigned char field[FRAME_FIELD_BYTES];
+   for( int i = 0; i < FRAME_FIELD_BYTES; i++ )
+   {
+      int byte = FRAME_FIELD_BYTES - 1 - i;
+      field[i] = (unsigned char)(n->array[byte / WORD_SIZE] >> (8 * (byte % WORD_SIZE)));
+   }
+   fwrite( field, 1, sizeof(field), out );
+}
+
+// A share or the best result, "<prefix><nonce> <result>;" in text
+static void send_result( struct channel* ch, enum frame_type type, const char* prefix, uint32_t request_id, struct bn* nonce, struct bn* result )
+{
+   pthread_mutex_lock( &ch->lock );
+   if( ch->mode == PROTOCOL_BINARY )
+   {
+      put_header( ch->out, type, request_id, 2 * FRAME_FIELD_BYTES );
+      put_field( ch->out, nonce );
+      put_field( ch->out, result );
+   }
+   else
+   {
+      char nonce_str[78], result_str[78];
+      bignum_to_string( nonce, nonce_str, sizeof(nonce_str), false );
+      bignum_to_string( result, result_str, sizeof(result_str), true );
+      fprintf( ch->out, "%s%s %s;\n", prefix, nonce_str, result_str );
+   }
+   send_end( ch );
+}
+
+void send_share( struct channel* ch, uint32_t request_id, struct bn* nonce, struct bn* result )
+{
+   send_result( ch, FRAME_SHARE, "S:", request_id, nonce, result );
+}
+
+void send_best( struct channel* ch, uint32_t request_id, struct bn* nonce, struct bn* result )
+{
+   send_result( ch, FRAME_BEST, "B:", request_id, nonce, result );
+}
+
+void send_nonce( struct channel* ch, uint32_t request_id, struct bn* nonce )
+{
+   pthread_mutex_lock( &ch->lock );
+   if( ch->mode == PROTOCOL_BINARY )
+   {
+      put_header( ch->out, FRAME_NONCE, request_id, FRAME_FIELD_BYTES );
+      put_field( ch->out, nonce );
+   }
+   else
+   {
+      char bn_str[78];
+      bignum_to_string( nonce, bn_str, sizeof(bn_str), false );
+      fprintf( ch->out, "N:%s;\n", bn_str );
+   }
+   send_end( ch );
+}
+
+void send_finished( struct channel* ch, uint32_t request_id )
+{
+   pthread_mutex_lock( &ch->lock );
+   if( ch->mode == PROTOCOL_BINARY )
+      put_header( ch->out, FRAME_FINISHED, request_id, 0 );
+   else
+      fprintf( ch->out, "F:1;\n" );
+   send_end( ch );
+}
+
+void send_preempted( struct channel* ch, uint32_t request_id, uint64_t hashes )
+{
+   pthread_mutex_lock( &ch->lock );
+   if( ch->mode == PROTOCOL_BINARY )
+   {
+      put_header( ch->out, FRAME_PREEMPTED, request_id, 8 );
+      put_u64( ch->out, hashes );
+   }
+   else
+   {
+      fprintf( ch->out, "P:%" PRIu64 ";\n", hashes );
+   }
+   send_end( ch );
+}
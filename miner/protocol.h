@@ -0,0 +1,139 @@
+#ifndef __PROTOCOL_H__
+#define __PROTOCOL_H__
+
+#include "bn.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct miner_job;
+
+#define ETH_HASH_SIZE          66
+#define ETH_ADDRESS_SIZE       42
+
+/*
+ * Messages between the JS wrapper and the miner come in two encodings.
+ *
+ * The text protocol is one message per line: requests are ten whitespace separated
+ * fields ending in ';', optionally followed by a weight, flags and a share target,
+ * "hint <block hash>;" announces an upcoming seed, "weight <n> [<request id>];" sets
+ * the share of a job, or without an id the wrapper's share of a daemon's hash rate, and
+ * the miner answers with "T:", "H:", "S:", "B:", "N:", "F:" and "P:" lines.
+ *
+ * A request without thread iterations is never searched, only answered as finished.
+ *
+ * A request with a share target is searched in share mode: every result at or under
+ * it is sent as a share while the search goes on, and the lowest result is sent before
+ * the request's final response.
+ *
+ * The binary protocol frames every message with a fixed header, all integers big
+ * endian:
+ *
+ *    u32 length       bytes that follow this field, header included
+ *    u8  version      PROTOCOL_VERSION
+ *    u8  type         enum frame_type
+ *    u16 reserved     0
+ *    u32 request id   chosen by the wrapper, echoed on every response to the request
+ *
+ * Hashes, targets, nonces and addresses are 32 byte big endian fields, addresses
+ * right aligned as in the ABI encoding.
+ */
+#define PROTOCOL_VERSION        1
+#define FRAME_HEADER_BYTES     12
+#define FRAME_FIELD_BYTES      32
+#define FRAME_MAX_BYTES      4096
+
+enum frame_type
+{
+   // Wrapper to miner
+   FRAME_REQUEST      = 0x01,   // miner address, tip address, block hash, target, nonce offset,
+                                // u64 block number, tip, pow height, thread iterations, hash limit,
+                                // optionally u32 weight, flags, then share target
+   FRAME_HINT         = 0x02,   // block hash
+   FRAME_WEIGHT       = 0x03,   // u32 weight, for the job of the request id or the wrapper if 0
+
+   // Miner to wrapper
+   FRAME_THREADS      = 0x81,   // u32 search threads, sent once at startup
+   FRAME_HASH_REPORT  = 0x82,   // u64 unix time ms, hashes, hashes/s, u32 threads, u64 hashes/s per thread
+   FRAME_NONCE        = 0x83,   // nonce
+   FRAME_FINISHED     = 0x84,   // no payload
+   FRAME_PREEMPTED    = 0x85,   // u64 hashes
+   FRAME_SHARE        = 0x86,   // nonce, result
+   FRAME_BEST         = 0x87    // nonce, result
+};
+
+// Request flags
+#define REQUEST_JOIN 0x1   // Search alongside the jobs on the same seed instead of preempting them
+
+enum protocol_mode
+{
+   PROTOCOL_TEXT,
+   PROTOCOL_BINARY
+};
+
+struct input_data
+{
+   uint32_t request_id;   // Numbered by the miner in text mode
+   char     miner_address[ETH_ADDRESS_SIZE + 1];
+   char     tip_address[ETH_ADDRESS_SIZE + 1];
+   char     block_hash[ETH_HASH_SIZE + 1];
+   uint64_t block_num;
+   char     difficulty_str[ETH_HASH_SIZE + 1];
+   uint64_t tip;
+   uint64_t pow_height;
+   uint64_t thread_iterations;
+   uint64_t hash_limit;
+   char     nonce_offset[ETH_HASH_SIZE + 1];
+   uint32_t weight;       // Share of the hash rate, among the jobs of a set
+   uint32_t flags;
+   char     share_target_str[ETH_HASH_SIZE + 1];   // Empty without share mode
+};
+
+enum
+{
+   INPUT_CLOSED,
+   INPUT_REQUEST,
+   INPUT_HINT,     // A seed that upcoming requests will use
+   INPUT_WEIGHT,   // The wrapper's share of the hash rate, daemon only
+   INPUT_INVALID   // A request that cannot be searched, only request_id is set, to answer as finished
+};
+
+// One wrapper's connection: the miner's stdin and stdout, or a client of the daemon
+struct channel
+{
+   FILE*               in;
+   FILE*               out;
+   enum protocol_mode  mode;
+   uint32_t            next_text_request;
+   bool                failed;    // A response could not be written
+   pthread_mutex_t     lock;      // Held while a response is written
+};
+
+void open_channel( struct channel* ch, FILE* in, FILE* out, enum protocol_mode mode );
+void open_stdio_channel( struct channel* ch, enum protocol_mode mode );
+void close_channel( struct channel* ch );
+
+// Read one message into d, hints only fill in block_hash and weights only weight
+int read_data( struct channel* ch, struct input_data* d );
+
+// The job of a request, reporting to ch
+void job_from_input( struct miner_job* job, struct channel* ch, struct input_data* input );
+
+// The seed of a hint, returns 0 if the hint holds no block hash
+int seed_from_input( struct bn* seed, struct input_data* input );
+
+/*
+ * Responses. They may be sent from any thread, each one is written and flushed
+ * as a whole.
+ */
+void send_thread_count( struct channel* ch, int threads );
+void send_hash_report( struct channel* ch, uint32_t request_id, uint64_t hashes, double rate, const double* thread_rates, int threads );
+void send_share( struct channel* ch, uint32_t request_id, struct bn* nonce, struct bn* result );
+void send_best( struct channel* ch, uint32_t request_id, struct bn* nonce, struct bn* result );
+void send_nonce( struct channel* ch, uint32_t request_id, struct bn* nonce );
+void send_finished( struct channel* ch, uint32_t request_id );
+void send_preempted( struct channel* ch, uint32_t request_id, uint64_t hashes );
+
+#endif /* #ifndef __PROTOCOL_H__ */
@@ -0,0 +1,179 @@
+#include "shared_buffer.h"
+#include "work.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#define SHARED_HEADER_SIZE 4096 // Keeps the words page aligned in the segment
+#define SHARED_PREFIX      "/koinos-miner-"
+#define SHARED_RETRY_MS       1
+#define SHARED_STALE_TRIES  100 // Unpublished without a creator's lock this often, the creator died
+#define SHARED_MAX_TRIES   1000 // Then give up and use a private buffer
+
+struct shared_header
+{
+   atomic_uint  ready;
+   int32_t      creator;   // For diagnostics only, pids do not cross pid namespaces
+   struct bn    seed;
+};
+
+#ifndef _WIN32
+
+static void segment_name( char* name, size_t size, struct bn* seed )
+{
+   char seed_str[78];
+   struct bn s;
+   bignum_assign( &s, seed );
+   bignum_endian_swap( &s );
+   bignum_to_string( &s, seed_str, sizeof(seed_str), true );
+   snprintf( name, size, SHARED_PREFIX "%s", seed_str );
+}
+
+static int map_segment( struct shared_buffer* sb, int prot )
+{
+   sb->length = SHARED_HEADER_SIZE + WORD_BUFFER_BYTES;
+   sb->base = mmap( NULL, sb->length, prot, MAP_SHARED, sb->fd, 0 );
+   if( sb->base == MAP_FAILED )
+   {
+      sb->base = NULL;
+      return 0;
+   }
+   sb->words = (struct bn*)((char*)sb->base + SHARED_HEADER_SIZE);
+   return 1;
+}
+
+static int create_segment( struct shared_buffer* sb, struct bn* seed )
+{
+   sb->fd = shm_open( sb->name, O_RDWR | O_CREAT | O_EXCL, 0644 );
+   if( sb->fd < 0 )
+      return errno == EEXIST ? SHARED_MAPPED : SHARED_FAILED;
+
+   // Readers block on their shared lock until the words are published
+   flock( sb->fd, LOCK_EX );
+   if( ftruncate( sb->fd, SHARED_HEADER_SIZE + WORD_BUFFER_BYTES ) || !map_segment( sb, PROT_READ | PROT_WRITE ) )
+   {
+      shm_unlink( sb->name );
+      close( sb->fd );
+      return SHARED_FAILED;
+   }
+
+   struct shared_header* header = sb->base;
+   header->creator = getpid();
+   bignum_assign( &header->seed, seed );
+   sb->created = true;
+   return SHARED_CREATED;
+}
+
+int shared_buffer_acquire( struct shared_buffer* sb, struct bn* seed )
+{
+   sb->base = NULL;
+   sb->created = false;
+   segment_name( sb->name, sizeof(sb->name), seed );
+
+   int stale = 0;
+   for( int tries = 0; tries < SHARED_MAX_TRIES; tries++ )
+   {
+      int created = create_segment( sb, seed );
+      if( created != SHARED_MAPPED )
+         return created;
+
+      // Someone else created it, wait for the words under a shared lock
+      sb->fd = shm_open( sb->name, O_RDONLY, 0 );
+      if( sb->fd >= 0 )
+      {
+         // The creator holds its exclusive lock until it publishes, and the kernel drops
+         // the lock if it dies, so this only returns once the words are ready or never
+         // will be, unless the creator has yet to take the lock
+         flock( sb->fd, LOCK_SH );
+         struct stat st;
+         bool sized = fstat( sb->fd, &st ) == 0 && (size_t)st.st_size == SHARED_HEADER_SIZE + WORD_BUFFER_BYTES;
+         if( sized && map_segment( sb, PROT_READ ) )
+         {
+            struct shared_header* header = sb->base;
+            if( atomic_load( &header->ready ) && memcmp( &header->seed, seed, sizeof(struct bn) ) == 0 )
+            {
+               flock( sb->fd, LOCK_UN );
+               close( sb->fd );
+               return SHARED_MAPPED;
+            }
+            munmap( sb->base, sb->length );
+            sb->base = NULL;
+         }
+
+         // A creator takes its lock right after creating the segment, one that leaves it
+         // unlocked and unpublished for this long is gone
+         if( ++stale >= SHARED_STALE_TRIES )
+         {
+            fprintf(stderr, "[C] Removing shared word buffer %s left behind by a failed miner\n", sb->name);
+            shm_unlink( sb->name );
+            stale = 0;
+         }
+         flock( sb->fd, LOCK_UN );
+         close( sb->fd );
+      }
+
+      struct timespec ts = { 0, SHARED_RETRY_MS * 1000000 };
+      nanosleep( &ts, NULL );
+   }
+
+   fprintf(stderr, "[C] Gave up waiting for shared word buffer %s\n", sb->name);
+   return SHARED_FAILED;
+}
+
+void shared_buffer_publish( struct shared_buffer* sb )
+{
+   struct shared_header* header = sb->base;
+   atomic_store( &header->ready, 1 );
+
+   // Keep only a read-only view, like every other process
+   munmap( sb->base, sb->length );
+   if( !map_segment( sb, PROT_READ ) )
+      fprintf(stderr, "[C] Could not remap shared word buffer %s\n", sb->name);
+   flock( sb->fd, LOCK_UN );
+   close( sb->fd );
+}
+
+void shared_buffer_release( struct shared_buffer* sb )
+{
+   if( sb->base )
+      munmap( sb->base, sb->length );
+
+   // Processes that still map the segment keep it until they unmap it
+   if( sb->created )
+      shm_unlink( sb->name );
+
+   sb->base = NULL;
+   sb->words = NULL;
+   sb->created = false;
+}
+
+#else
+
+int shared_buffer_acquire( struct shared_buffer* sb, struct bn* seed )
+{
+   sb->base = NULL;
+   sb->created = false;
+   return SHARED_FAILED;
+}
+
+void shared_buffer_publish( struct shared_buffer* sb )
+{
+}
+
+void shared_buffer_release( struct shared_buffer* sb )
+{
+}
+
+#endif
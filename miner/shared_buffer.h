@@ -0,0 +1,41 @@
+#ifndef __SHARED_BUFFER_H__
+#define __SHARED_BUFFER_H__
+
+#include "bn.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Word buffers in named POSIX shared memory, one segment per seed, so every miner
+ * process on a host maps the same physical copy. The first process to ask for a
+ * seed creates the segment and generates the words while holding an exclusive
+ * lock on it; the others block on a shared lock until the words are published and
+ * then map them read-only.
+ *
+ * Not available on Windows, where shared_buffer_acquire() always fails.
+ */
+struct shared_buffer
+{
+   struct bn*  words;
+   void*       base;
+   size_t      length;
+   int         fd;
+   bool        created;   // This process created the segment
+   char        name[80];
+};
+
+enum
+{
+   SHARED_FAILED,
+   SHARED_MAPPED,   // words are mapped read-only and ready
+   SHARED_CREATED   // words are writable, fill them and call shared_buffer_publish()
+};
+
+int shared_buffer_acquire( struct shared_buffer* sb, struct bn* seed );
+void shared_buffer_publish( struct shared_buffer* sb );
+
+// Unmap the buffer, removing the segment if this process created it
+void shared_buffer_release( struct shared_buffer* sb );
+
+#endif /* #ifndef __SHARED_BUFFER_H__ */
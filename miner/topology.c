@@ -0,0 +1,528 @@
+// CPU sets, sched_getcpu() and pthread_attr_setaffinity_np() are GNU extensions
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "topology.h"
+#include "work.h"
+
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+
+// Parse a cpu list such as "0-3,8-11", setting flags[cpu] for every cpu < cpus in it.
+// Returns the number of cpus set, or -1 on a syntax error
+static int parse_cpulist( const char* list, bool* flags, int cpus )
+{
+   int count = 0;
+   const char* p = list;
+
+   while( *p && *p != '\n' )
+   {
+      char* end;
+      long first = strtol( p, &end, 10 ), last = first;
+      if( end == p || first < 0 )
+         return -1;
+      p = end;
+      if( *p == '-' )
+      {
+         last = strtol( p + 1, &end, 10 );
+         if( end == p + 1 || last < first )
+            return -1;
+         p = end;
+      }
+      for( long cpu = first; cpu <= last && cpu < cpus; cpu++ )
+      {
+         count += !flags[cpu];
+         flags[cpu] = true;
+      }
+      if( *p == ',' )
+         p++;
+      else if( *p && *p != '\n' )
+         return -1;
+   }
+   return count;
+}
+
+static bool read_line( const char* path, char* buf, size_t size )
+{
+   FILE* f = fopen( path, "r" );
+   if( !f )
+      return false;
+   bool ok = fgets( buf, size, f ) != NULL;
+   fclose( f );
+   return ok;
+}
+
+// Assign the cpus of the sysfs cpu list at path to domain
+static int assign_cpulist( const char* path, struct topology* topo, int domain )
+{
+   char buf[4096];
+   if( !read_line( path, buf, sizeof(buf) ) )
+      return 0;
+
+   bool* flags = calloc( topo->cpus, sizeof(bool) );
+   int assigned = 0;
+   if( flags && parse_cpulist( buf, flags, topo->cpus ) > 0 )
+   {
+      for( int cpu = 0; cpu < topo->cpus; cpu++ )
+      {
+         if( flags[cpu] )
+         {
+            topo->cpu_domain[cpu] = domain;
+            assigned++;
+         }
+      }
+   }
+   free( flags );
+   return assigned;
+}
+
+static int detect_numa( struct topology* topo )
+{
+   char path[128];
+   int domains = 0;
+
+   for( int node = 0; node < topo->cpus; node++ )
+   {
+      snprintf( path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node );
+      if( assign_cpulist( path, topo, domains ) )
+         domains++;
+   }
+   return domains;
+}
+
+static int detect_l3( struct topology* topo )
+{
+   char path[128];
+   int domains = 0;
+
+   for( int cpu = 0; cpu < topo->cpus; cpu++ )
+      topo->cpu_domain[cpu] = -1;
+
+   // Every cpu not yet assigned starts a new domain made of the cpus sharing its L3
+   for( int cpu = 0; cpu < topo->cpus; cpu++ )
+   {
+      if( topo->cpu_domain[cpu] >= 0 )
+         continue;
+      snprintf( path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index3/shared_cpu_list", cpu );
+      if( assign_cpulist( path, topo, domains ) )
+         domains++;
+   }
+
+   for( int cpu = 0; cpu < topo->cpus; cpu++ )
+   {
+      if( topo->cpu_domain[cpu] < 0 )
+         topo->cpu_domain[cpu] = 0;
+   }
+   return domains;
+}
+
+struct first_touch
+{
+   struct topology*  topo;
+   int               domain;
+   struct bn*        words;   // To copy into the replica
+   bool              lock;    // To allocate the replica with
+   bool              ok;
+};
+
+// Allocating in the domain matters when the pages are faulted in right away, as mlock() does
+static void* alloc_replica( void* arg )
+{
+   struct first_touch* touch = arg;
+   touch->ok = alloc_word_buffer( touch->topo->replicas + touch->domain, touch->lock );
+   return NULL;
+}
+
+static void* copy_replica( void* arg )
+{
+   struct first_touch* touch = arg;
+   memcpy( touch->topo->replicas[touch->domain].words, touch->words, WORD_BUFFER_BYTES );
+   return NULL;
+}
+
+// Run task for every domain, each on a thread bound to that domain's cpus
+static void run_in_domains( struct topology* topo, void* (*task)( void* ), struct first_touch* touches )
+{
+   pthread_t* threads = malloc( topo->domains * sizeof(pthread_t) );
+   bool* started = calloc( topo->domains, sizeof(bool) );
+
+   for( int d = 0; d < topo->domains; d++ )
+   {
+      pthread_attr_t attr;
+      cpu_set_t set;
+      CPU_ZERO( &set );
+      for( int cpu = 0; cpu < topo->cpus; cpu++ )
+      {
+         if( topo->cpu_domain[cpu] == d )
+            CPU_SET( cpu, &set );
+      }
+
+      // Without a thread of its own the domain is served from here, wherever that is
+      pthread_attr_init( &attr );
+      pthread_attr_setaffinity_np( &attr, sizeof(set), &set );
+      if( !threads || !started || pthread_create( threads + d, &attr, task, touches + d ) )
+         task( touches + d );
+      else
+         started[d] = true;
+      pthread_attr_destroy( &attr );
+   }
+
+   for( int d = 0; d < topo->domains; d++ )
+   {
+      if( started && started[d] )
+         pthread_join( threads[d], NULL );
+   }
+
+   free( threads );
+   free( started );
+}
+
+void replicate_word_buffer( struct topology* topo, struct bn* words, struct bn* seed )
+{
+   if( !topo->replicas || (topo->replicated && bignum_cmp( &topo->seed, seed ) == 0) )
+      return;
+
+   struct first_touch* touches = calloc( topo->domains, sizeof(struct first_touch) );
+   if( !touches )
+      return;
+   for( int d = 0; d < topo->domains; d++ )
+   {
+      touches[d].topo = topo;
+      touches[d].domain = d;
+      touches[d].words = words;
+   }
+   run_in_domains( topo, copy_replica, touches );
+
+   free( touches );
+   bignum_assign( &topo->seed, seed );
+   topo->replicated = true;
+}
+
+// Position of cpu among its SMT siblings, 0 for the first hardware thread of a core
+static int sibling_rank( struct topology* topo, int cpu )
+{
+   char path[128], buf[4096];
+   snprintf( path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu );
+   if( !read_line( path, buf, sizeof(buf) ) )
+      return 0;
+
+   bool* flags = calloc( topo->cpus, sizeof(bool) );
+   int rank = 0;
+   if( flags && parse_cpulist( buf, flags, topo->cpus ) > 0 )
+   {
+      for( int c = 0; c < cpu; c++ )
+         rank += flags[c];
+   }
+   free( flags );
+   return rank;
+}
+
+int plan_placement( struct topology* topo, const char* cpu_list, enum smt_policy smt, int threads, int** placement )
+{
+   bool* usable = calloc( topo->cpus, sizeof(bool) );
+   int* rank = calloc( topo->cpus, sizeof(int) );
+   int* cpus = malloc( topo->cpus * sizeof(int) );
+   int count = 0, max_rank = 0;
+
+   if( !usable || !rank || !cpus )
+      goto fail;
+
+   // Start from the cpus the process may run on, which honours taskset and cpusets
+   cpu_set_t allowed;
+   if( sched_getaffinity( 0, sizeof(allowed), &allowed ) )
+      CPU_ZERO( &allowed );
+   for( int cpu = 0; cpu < topo->cpus && cpu < CPU_SETSIZE; cpu++ )
+      usable[cpu] = CPU_ISSET( cpu, &allowed );
+
+   if( cpu_list )
+   {
+      bool* listed = calloc( topo->cpus, sizeof(bool) );
+      if( !listed || parse_cpulist( cpu_list, listed, topo->cpus ) < 0 )
+      {
+         free( listed );
+         fprintf(stderr, "[C] Invalid cpu list: %s\n", cpu_list);
+         goto fail;
+      }
+      for( int cpu = 0; cpu < topo->cpus; cpu++ )
+         usable[cpu] = usable[cpu] && listed[cpu];
+      free( listed );
+   }
+
+   for( int cpu = 0; cpu < topo->cpus; cpu++ )
+   {
+      rank[cpu] = sibling_rank( topo, cpu );
+      if( rank[cpu] > max_rank )
+         max_rank = rank[cpu];
+   }
+
+   // First hardware threads of every core, then second ones, and so on, so a smaller
+   // team spreads over cores before it doubles up on them
+   for( int r = 0; r <= (smt == SMT_CORE ? 0 : max_rank); r++ )
+   {
+      for( int cpu = 0; cpu < topo->cpus; cpu++ )
+      {
+         if( usable[cpu] && rank[cpu] == r )
+            cpus[count++] = cpu;
+      }
+   }
+
+   if( count == 0 )
+   {
+      fprintf(stderr, "[C] No usable cpus\n");
+      goto fail;
+   }
+
+   if( threads <= 0 )
+      threads = count;
+
+   *placement = malloc( threads * sizeof(int) );
+   if( !*placement )
+      goto fail;
+   for( int t = 0; t < threads; t++ )
+      (*placement)[t] = cpus[t % count];
+
+   free( usable );
+   free( rank );
+   free( cpus );
+   return threads;
+
+fail:
+   free( usable );
+   free( rank );
+   free( cpus );
+   return 0;
+}
+
+// cpus granted by the CFS quota in dir, rounded up, or 0 when it is unlimited
+static int cgroup_quota_at( const char* dir, bool v2 )
+{
+   char path[4096], buf[128];
+   long long quota, period;
+
+   if( v2 )
+   {
+      snprintf( path, sizeof(path), "%s/cpu.max", dir );
+      if( !read_line( path, buf, sizeof(buf) ) || sscanf( buf, "%lld %lld", &quota, &period ) != 2 )
+         return 0;
+   }
+   else
+   {
+      snprintf( path, sizeof(path), "%s/cpu.cfs_quota_us", dir );
+      if( !read_line( path, buf, sizeof(buf) ) || sscanf( buf, "%lld", &quota ) != 1 )
+         return 0;
+      snprintf( path, sizeof(path), "%s/cpu.cfs_period_us", dir );
+      if( !read_line( path, buf, sizeof(buf) ) || sscanf( buf, "%lld", &period ) != 1 )
+         return 0;
+   }
+
+   // "max" in cpu.max fails to scan, -1 is v1's unlimited
+   if( quota <= 0 || period <= 0 )
+      return 0;
+   return (int)((quota + period - 1) / period);
+}
+
+// The tightest quota from the cgroup at mount/path up to the root of the hierarchy.
+// Inside a cgroup namespace the path is often not visible under the mount, in which
+// case the mount itself is the container's cgroup
+static int cgroup_quota( const char* mount, const char* path, bool v2 )
+{
+   char dir[4096];
+   snprintf( dir, sizeof(dir), "%s%s", mount, strcmp( path, "/" ) ? path : "" );
+   if( access( dir, F_OK ) )
+      snprintf( dir, sizeof(dir), "%s", mount );
+
+   size_t root = strlen( mount );
+   int cpus = 0;
+   for( ;; )
+   {
+      int quota = cgroup_quota_at( dir, v2 );
+      if( quota && (!cpus || quota < cpus) )
+         cpus = quota;
+
+      char* slash = strrchr( dir, '/' );
+      if( strlen( dir ) <= root || !slash || (size_t)(slash - dir) < root )
+         break;
+      *slash = '\0';
+   }
+   return cpus;
+}
+
+static int cgroup_cpu_quota()
+{
+   FILE* f = fopen( "/proc/self/cgroup", "r" );
+   if( !f )
+      return 0;
+
+   char line[4096];
+   int cpus = 0;
+   while( !cpus && fgets( line, sizeof(line), f ) )
+   {
+      // hierarchy-id:controllers:path, with an empty controller list for cgroup v2
+      char* controllers = strchr( line, ':' );
+      char* path = controllers ? strchr( controllers + 1, ':' ) : NULL;
+      if( !path )
+         continue;
+      *path++ = '\0';
+      controllers++;
+      path[strcspn( path, "\n" )] = '\0';
+
+      if( *controllers == '\0' )
+      {
+         cpus = cgroup_quota( "/sys/fs/cgroup", path, true );
+         continue;
+      }
+
+      for( char* c = strtok( controllers, "," ); c; c = strtok( NULL, "," ) )
+      {
+         if( strcmp( c, "cpu" ) == 0 )
+         {
+            cpus = cgroup_quota( "/sys/fs/cgroup/cpu,cpuacct", path, false );
+            if( !cpus )
+               cpus = cgroup_quota( "/sys/fs/cgroup/cpu", path, false );
+            break;
+         }
+      }
+   }
+   fclose( f );
+   return cpus;
+}
+
+int effective_cpus( int* quota )
+{
+   // The affinity mask already reflects the cgroup cpuset, as well as taskset
+   cpu_set_t allowed;
+   int cpus = sched_getaffinity( 0, sizeof(allowed), &allowed ) ? 0 : CPU_COUNT( &allowed );
+   if( cpus < 1 )
+      cpus = (int)sysconf( _SC_NPROCESSORS_ONLN );
+   if( cpus < 1 )
+      cpus = 1;
+
+   *quota = cgroup_cpu_quota();
+   return (*quota && *quota < cpus) ? *quota : cpus;
+}
+
+int pin_thread( int cpu )
+{
+   cpu_set_t set;
+   CPU_ZERO( &set );
+   CPU_SET( cpu, &set );
+   return pthread_setaffinity_np( pthread_self(), sizeof(set), &set ) == 0;
+}
+
+int current_domain( struct topology* topo )
+{
+   int cpu = sched_getcpu();
+   return (cpu >= 0 && cpu < topo->cpus) ? topo->cpu_domain[cpu] : 0;
+}
+
+int detect_topology( struct topology* topo, enum topology_policy policy, bool lock )
+{
+   topo->cpus = (int)sysconf( _SC_NPROCESSORS_CONF );
+   if( topo->cpus < 1 )
+      topo->cpus = 1;
+   topo->cpu_domain = calloc( topo->cpus, sizeof(int) );
+   topo->replicas = NULL;
+   topo->replicated = false;
+   topo->domains = 1;
+   topo->kind = "machine";
+
+   if( !topo->cpu_domain )
+      return 0;
+
+   if( policy == TOPOLOGY_AUTO || policy == TOPOLOGY_NUMA )
+   {
+      int domains = detect_numa( topo );
+      if( domains > 1 || policy == TOPOLOGY_NUMA )
+      {
+         topo->domains = domains > 0 ? domains : 1;
+         topo->kind = "NUMA node";
+      }
+   }
+
+   if( policy == TOPOLOGY_L3 || (policy == TOPOLOGY_AUTO && topo->domains == 1) )
+   {
+      int domains = detect_l3( topo );
+      topo->domains = domains > 0 ? domains : 1;
+      topo->kind = "L3";
+   }
+
+   if( policy == TOPOLOGY_OFF || topo->domains == 1 )
+   {
+      memset( topo->cpu_domain, 0, topo->cpus * sizeof(int) );
+      topo->domains = 1;
+      return 1;
+   }
+
+   topo->replicas = calloc( topo->domains, sizeof(struct word_buffer_alloc) );
+   struct first_touch* touches = calloc( topo->domains, sizeof(struct first_touch) );
+   if( !topo->replicas || !touches )
+   {
+      free( touches );
+      return 0;
+   }
+   for( int d = 0; d < topo->domains; d++ )
+   {
+      touches[d].topo = topo;
+      touches[d].domain = d;
+      touches[d].lock = lock;
+   }
+   run_in_domains( topo, alloc_replica, touches );
+
+   int ok = 1;
+   for( int d = 0; d < topo->domains; d++ )
+      ok &= touches[d].ok;
+   free( touches );
+   return ok;
+}
+
+#else
+
+int plan_placement( struct topology* topo, const char* cpu_list, enum smt_policy smt, int threads, int** placement )
+{
+   fprintf(stderr, "[C] Thread placement is not supported on this platform\n");
+   return 0;
+}
+
+int pin_thread( int cpu )
+{
+   return 0;
+}
+
+int effective_cpus( int* quota )
+{
+   *quota = 0;
+   return omp_get_num_procs();
+}
+
+void replicate_word_buffer( struct topology* topo, struct bn* words, struct bn* seed )
+{
+}
+
+int current_domain( struct topology* topo )
+{
+   return 0;
+}
+
+int detect_topology( struct topology* topo, enum topology_policy policy, bool lock )
+{
+   topo->cpus = 1;
+   topo->cpu_domain = NULL;
+   topo->replicas = NULL;
+   topo->replicated = false;
+   topo->domains = 1;
+   topo->kind = "machine";
+   return 1;
+}
+
+#endif
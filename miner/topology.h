@@ -0,0 +1,73 @@
+#ifndef __TOPOLOGY_H__
+#define __TOPOLOGY_H__
+
+#include "bn.h"
+#include "word_buffer.h"
+
+#include <stdbool.h>
+
+enum topology_policy
+{
+   TOPOLOGY_AUTO,   // NUMA nodes when there is more than one, otherwise L3 domains
+   TOPOLOGY_NUMA,
+   TOPOLOGY_L3,
+   TOPOLOGY_OFF
+};
+
+/*
+ * The memory domains of the machine, read from sysfs, and a replica of the current
+ * word buffer in each of them. Every replica is allocated, locked and first touched
+ * by a thread running in its domain, so each worker gathers from local memory. With
+ * a single domain, or on platforms without sysfs, no replicas are made and
+ * everyone reads the buffer itself.
+ */
+struct topology
+{
+   const char*                kind;         // "NUMA node", "L3" or "machine"
+   int                        domains;
+   int                        cpus;
+   int*                       cpu_domain;   // Domain of every cpu, indexed by cpu number
+   struct word_buffer_alloc*  replicas;
+   struct bn                  seed;         // Seed of the words the replicas hold
+   bool                       replicated;
+};
+
+int detect_topology( struct topology* topo, enum topology_policy policy, bool lock );
+
+// Copy the words of seed into every domain's replica unless they already hold them
+void replicate_word_buffer( struct topology* topo, struct bn* words, struct bn* seed );
+
+// The domain of the cpu the calling thread runs on
+int current_domain( struct topology* topo );
+
+enum smt_policy
+{
+   SMT_ALL,    // Use every hardware thread, filling one per core before the siblings
+   SMT_CORE    // One thread per physical core
+};
+
+/*
+ * Where the search threads run. cpu_list restricts the cpus (sysfs list syntax, NULL
+ * for every cpu the process may use), smt picks hardware threads within them, and
+ * threads caps the team (0 for one thread per chosen cpu). Returns the team size,
+ * with the cpu of thread t in placement[t], or 0 on error.
+ */
+int plan_placement( struct topology* topo, const char* cpu_list, enum smt_policy smt, int threads, int** placement );
+
+// Bind the calling thread to one cpu
+int pin_thread( int cpu );
+
+/*
+ * The cpus the miner can actually keep busy: those in its affinity mask, which
+ * includes any cgroup cpuset, capped by the CFS bandwidth quota of its cgroup (v1
+ * or v2, rounded up to whole cpus). *quota is set to the quota alone, 0 without one.
+ */
+int effective_cpus( int* quota );
+
+// The replica local to domain, or words itself without replicas
+static inline struct bn* local_word_buffer( struct topology* topo, struct bn* words, int domain )
+{
+   return topo->replicas ? topo->replicas[domain].words : words;
+}
+
+#endif /* #ifndef __TOPOLOGY_H__ */
@@ -0,0 +1,389 @@
+#include "word_buffer.h"
+#include "keccak256.h"
+#include "work.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#define WORD_BUFFER_BATCH  16
+
+#define HUGE_PAGE_BYTES  (2 << 20)
+#define CACHE_LINE_BYTES 64
+
+#if !defined(_WIN32) && defined(MAP_HUGETLB)
+static int alloc_hugetlb( struct word_buffer_alloc* alloc )
+{
+   size_t length = (WORD_BUFFER_BYTES + HUGE_PAGE_BYTES - 1) & ~(size_t)(HUGE_PAGE_BYTES - 1);
+   void* p = mmap( NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+   if( p == MAP_FAILED )
+      return 0;
+
+   alloc->words = p;
+   alloc->base = p;
+   alloc->length = length;
+   alloc->mode = WORD_BUFFER_HUGETLB;
+   return 1;
+}
+#endif
+
+#if !defined(_WIN32) && defined(MADV_HUGEPAGE)
+static int alloc_transparent( struct word_buffer_alloc* alloc )
+{
+   // Over-allocate by one huge page so the buffer can start on a huge page boundary,
+   // which the kernel needs before it can back it with one
+   size_t length = WORD_BUFFER_BYTES + HUGE_PAGE_BYTES;
+   void* p = mmap( NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+   if( p == MAP_FAILED )
+      return 0;
+
+   uintptr_t aligned = ((uintptr_t)p + HUGE_PAGE_BYTES - 1) & ~(uintptr_t)(HUGE_PAGE_BYTES - 1);
+   if( madvise( (void*)aligned, WORD_BUFFER_BYTES, MADV_HUGEPAGE ) )
+   {
+      munmap( p, length );
+      return 0;
+   }
+
+   alloc->words = (struct bn*)aligned;
+   alloc->base = p;
+   alloc->length = length;
+   alloc->mode = WORD_BUFFER_TRANSPARENT;
+   return 1;
+}
+#endif
+
+static int alloc_aligned( struct word_buffer_alloc* alloc )
+{
+#ifdef _WIN32
+   void* p = _aligned_malloc( WORD_BUFFER_BYTES, CACHE_LINE_BYTES );
+#else
+   void* p = NULL;
+   if( posix_memalign( &p, CACHE_LINE_BYTES, WORD_BUFFER_BYTES ) )
+      p = NULL;
+#endif
+   if( !p )
+      return 0;
+
+   alloc->words = p;
+   alloc->base = p;
+   alloc->length = WORD_BUFFER_BYTES;
+   alloc->mode = WORD_BUFFER_ALIGNED;
+   return 1;
+}
+
+int alloc_word_buffer( struct word_buffer_alloc* alloc, bool lock )
+{
+   alloc->locked = false;
+
+   if(
+#if !defined(_WIN32) && defined(MAP_HUGETLB)
+      !alloc_hugetlb( alloc ) &&
+#endif
+#if !defined(_WIN32) && defined(MADV_HUGEPAGE)
+      !alloc_transparent( alloc ) &&
+#endif
+      !alloc_aligned( alloc ) )
+   {
+      return 0;
+   }
+
+   if( lock )
+   {
+#ifndef _WIN32
+      if( mlock( alloc->words, WORD_BUFFER_BYTES ) == 0 )
+         alloc->locked = true;
+      else
+         perror( "[C] mlock" );
+#else
+      fprintf(stderr, "[C] Locking the word buffer is not supported on this platform\n");
+#endif
+   }
+
+   return 1;
+}
+
+void free_word_buffer( struct word_buffer_alloc* alloc )
+{
+#ifndef _WIN32
+   if( alloc->locked )
+      munlock( alloc->words, WORD_BUFFER_BYTES );
+
+   if( alloc->mode != WORD_BUFFER_ALIGNED )
+      munmap( alloc->base, alloc->length );
+   else
+      free( alloc->base );
+#else
+   _aligned_free( alloc->base );
+#endif
+
+   alloc->words = NULL;
+   alloc->base = NULL;
+}
+
+const char* word_buffer_mode_name( enum word_buffer_mode mode )
+{
+   switch( mode )
+   {
+      case WORD_BUFFER_HUGETLB:
+         return "huge page";
+      case WORD_BUFFER_TRANSPARENT:
+         return "transparent huge page";
+      default:
+         return "aligned";
+   }
+}
+
+void generate_word_buffer( struct bn* word_buffer, struct bn* seed, bool parallel )
+{
+   // Procedurally generate word buffer w[i] from a seed
+   // Each word buffer element is computed by w[i] = H(seed, i)
+   // The same thread team that runs the search splits the buffer into one contiguous
+   // range per thread, and hashes it WORD_BUFFER_BATCH words at a time with the
+   // single block Keccak path
+   #pragma omp parallel for schedule(static) if(parallel)
+   for( long i = 0; i < (long)WORD_BUFFER_LENGTH; i += WORD_BUFFER_BATCH )
+   {
+      keccak256_64B( (unsigned char*)(word_buffer + i), (unsigned char*)seed, i, WORD_BUFFER_BATCH );
+      for( int k = 0; k < WORD_BUFFER_BATCH; k++ )
+      {
+         bignum_endian_swap( word_buffer + i + k );
+      }
+   }
+}
+
+static int find_entry( struct word_buffers* buffers, struct bn* seed )
+{
+   for( unsigned e = 0; e < buffers->count; e++ )
+   {
+      if( buffers->entries[e].state != BUFFER_EMPTY && bignum_cmp( &buffers->entries[e].seed, seed ) == 0 )
+         return e;
+   }
+   return -1;
+}
+
+// The entry to refill: empty if possible, otherwise the least recently used one that
+// neither the search nor the generator is using
+static int evict_entry( struct word_buffers* buffers )
+{
+   int victim = -1;
+   for( unsigned e = 0; e < buffers->count; e++ )
+   {
+      struct word_buffer_entry* entry = buffers->entries + e;
+      if( (int)e == buffers->current || entry->state == BUFFER_GENERATING )
+         continue;
+      if( entry->state == BUFFER_EMPTY )
+         return e;
+      if( victim < 0 || entry->last_used < buffers->entries[victim].last_used )
+         victim = e;
+   }
+   return victim;
+}
+
+// Fill the words of a buffer from the disk cache if possible, or generate them
+static const char* fill_words( struct word_buffers* buffers, struct bn* words, struct bn* seed, bool parallel )
+{
+   struct cache_mapping cached;
+   if( buffers->cache && buffer_cache_map( buffers->cache, seed, &cached ) )
+   {
+      memcpy( words, cached.words, WORD_BUFFER_BYTES );
+      buffer_cache_unmap( &cached );
+      return "copied from disk";
+   }
+
+   generate_word_buffer( words, seed, parallel );
+   if( buffers->cache )
+      buffer_cache_store( buffers->cache, seed, words );
+   return "generated";
+}
+
+// Fill an entry claimed as BUFFER_GENERATING, returns where the words came from
+static const char* fill_entry( struct word_buffers* buffers, struct word_buffer_entry* entry, struct bn* seed, bool parallel )
+{
+   buffer_cache_unmap( &entry->mapping );
+   shared_buffer_release( &entry->shared );
+   entry->words = entry->alloc.words;
+
+   if( buffers->shared )
+   {
+      switch( shared_buffer_acquire( &entry->shared, seed ) )
+      {
+         case SHARED_MAPPED:
+            entry->words = entry->shared.words;
+            return "shared by another process";
+         case SHARED_CREATED:
+         {
+            const char* source = fill_words( buffers, entry->shared.words, seed, parallel );
+            shared_buffer_publish( &entry->shared );
+            entry->words = entry->shared.words;
+            return source;
+         }
+      }
+      // Fall back to private memory
+   }
+
+   if( buffers->cache && buffer_cache_map( buffers->cache, seed, &entry->mapping ) )
+   {
+      entry->words = entry->mapping.words;
+      return "mapped from disk";
+   }
+
+   return fill_words( buffers, entry->alloc.words, seed, parallel );
+}
+
+static void* generate_hinted( void* arg )
+{
+   struct word_buffers* buffers = arg;
+   struct bn seed;
+
+   pthread_mutex_lock( &buffers->lock );
+   while( true )
+   {
+      while( !buffers->hinted )
+         pthread_cond_wait( &buffers->changed, &buffers->lock );
+
+      buffers->hinted = false;
+      int e = evict_entry( buffers );
+      if( e < 0 || find_entry( buffers, &buffers->hint ) >= 0 )
+         continue;
+
+      // The entry is handed to the generator only while nobody else touches it
+      struct word_buffer_entry* entry = buffers->entries + e;
+      bignum_assign( &seed, &buffers->hint );
+      bignum_assign( &entry->seed, &seed );
+      entry->state = BUFFER_GENERATING;
+      pthread_mutex_unlock( &buffers->lock );
+
+      // One thread, so the search keeps the rest of the machine
+      fill_entry( buffers, entry, &seed, false );
+
+      pthread_mutex_lock( &buffers->lock );
+      entry->state = BUFFER_READY;
+      entry->last_used = ++buffers->tick;
+      pthread_cond_broadcast( &buffers->changed );
+   }
+
+   return NULL;
+}
+
+int init_word_buffers( struct word_buffers* buffers, unsigned count, bool lock, bool shared, struct buffer_cache* cache )
+{
+   buffers->entries = calloc( count, sizeof(struct word_buffer_entry) );
+   if( !buffers->entries )
+      return 0;
+
+   for( unsigned e = 0; e < count; e++ )
+   {
+      struct word_buffer_entry* entry = buffers->entries + e;
+      if( !alloc_word_buffer( &entry->alloc, lock ) )
+         return 0;
+      entry->words = entry->alloc.words;
+      entry->state = BUFFER_EMPTY;
+   }
+
+   buffers->count = count;
+   buffers->current = -1;
+   buffers->tick = 0;
+   buffers->cache = cache;
+   buffers->shared = shared;
+   buffers->hinted = false;
+   buffers->hits = 0;
+   buffers->misses = 0;
+
+   pthread_mutex_init( &buffers->lock, NULL );
+   pthread_cond_init( &buffers->changed, NULL );
+
+   return pthread_create( &buffers->generator, NULL, generate_hinted, buffers ) == 0;
+}
+
+void hint_word_buffer( struct word_buffers* buffers, struct bn* seed )
+{
+   pthread_mutex_lock( &buffers->lock );
+
+   if( find_entry( buffers, seed ) < 0 && !(buffers->hinted && bignum_cmp( &buffers->hint, seed ) == 0) )
+   {
+      bignum_assign( &buffers->hint, seed );
+      buffers->hinted = true;
+      pthread_cond_broadcast( &buffers->changed );
+   }
+
+   pthread_mutex_unlock( &buffers->lock );
+}
+
+struct bn* use_word_buffer( struct word_buffers* buffers, struct bn* seed )
+{
+   pthread_mutex_lock( &buffers->lock );
+
+   // A hint the generator has not picked up yet is generated here instead
+   if( buffers->hinted && bignum_cmp( &buffers->hint, seed ) == 0 )
+      buffers->hinted = false;
+
+   int e = find_entry( buffers, seed );
+   while( e >= 0 && buffers->entries[e].state == BUFFER_GENERATING )
+   {
+      pthread_cond_wait( &buffers->changed, &buffers->lock );
+      e = find_entry( buffers, seed );
+   }
+
+   bool hit = e >= 0;
+   if( hit )
+   {
+      buffers->hits++;
+   }
+   else
+   {
+      buffers->misses++;
+
+      // Nothing searches while a request is being set up, so the current entry may go too
+      buffers->current = -1;
+      while( (e = evict_entry( buffers )) < 0 )
+         pthread_cond_wait( &buffers->changed, &buffers->lock );
+
+      bignum_assign( &buffers->entries[e].seed, seed );
+      buffers->entries[e].state = BUFFER_GENERATING;
+   }
+
+   struct word_buffer_entry* entry = buffers->entries + e;
+   buffers->current = e;
+   entry->last_used = ++buffers->tick;
+   uint64_t hits = buffers->hits, misses = buffers->misses;
+   pthread_mutex_unlock( &buffers->lock );
+
+   if( hit )
+   {
+      fprintf(stderr, "[C] Word buffer cache hit (%" PRIu64 " hits, %" PRIu64 " misses)\n", hits, misses);
+   }
+   else
+   {
+      const char* source = fill_entry( buffers, entry, seed, true );
+      fprintf(stderr, "[C] Word buffer cache miss, %s (%" PRIu64 " hits, %" PRIu64 " misses)\n", source, hits, misses);
+
+      pthread_mutex_lock( &buffers->lock );
+      entry->state = BUFFER_READY;
+      pthread_cond_broadcast( &buffers->changed );
+      pthread_mutex_unlock( &buffers->lock );
+   }
+
+   return entry->words;
+}
+
+void release_shared_buffers( struct word_buffers* buffers )
+{
+   pthread_mutex_lock( &buffers->lock );
+   for( unsigned e = 0; e < buffers->count; e++ )
+   {
+      if( buffers->entries[e].state == BUFFER_READY )
+      {
+         shared_buffer_release( &buffers->entries[e].shared );
+         buffers->entries[e].state = BUFFER_EMPTY;
+      }
+   }
+   pthread_mutex_unlock( &buffers->lock );
+}
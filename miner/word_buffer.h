@@ -0,0 +1,110 @@
+#ifndef __WORD_BUFFER_H__
+#define __WORD_BUFFER_H__
+
+#include "bn.h"
+#include "buffer_cache.h"
+#include "shared_buffer.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum word_buffer_mode
+{
+   WORD_BUFFER_HUGETLB,      // Explicit 2 MB huge page (MAP_HUGETLB)
+   WORD_BUFFER_TRANSPARENT,  // 2 MB aligned mapping advised for transparent huge pages
+   WORD_BUFFER_ALIGNED       // 64 byte aligned heap allocation with regular pages
+};
+
+/*
+ * Memory for one word buffer. Every word is sampled at random on every hash, so the
+ * allocator prefers a single huge page (one TLB entry for the whole buffer) and falls
+ * back to cache line aligned memory.
+ */
+struct word_buffer_alloc
+{
+   struct bn*             words;
+   enum word_buffer_mode  mode;
+   bool                   locked;
+   void*                  base;
+   size_t                 length;
+};
+
+/*
+ * Allocate WORD_BUFFER_BYTES trying MAP_HUGETLB, then MADV_HUGEPAGE, then an aligned
+ * heap allocation. With lock set the buffer is also mlock()ed. Returns 0 on failure.
+ */
+int alloc_word_buffer( struct word_buffer_alloc* alloc, bool lock );
+void free_word_buffer( struct word_buffer_alloc* alloc );
+
+const char* word_buffer_mode_name( enum word_buffer_mode mode );
+
+// w[i] = H(seed, i), on the whole OpenMP team when parallel is set
+void generate_word_buffer( struct bn* word_buffer, struct bn* seed, bool parallel );
+
+enum buffer_state
+{
+   BUFFER_EMPTY,
+   BUFFER_GENERATING,
+   BUFFER_READY
+};
+
+// One cached word buffer: owned memory, or a read-only mapping of the disk cache or
+// of a buffer shared between processes
+struct word_buffer_entry
+{
+   struct word_buffer_alloc  alloc;
+   struct cache_mapping      mapping;
+   struct shared_buffer      shared;
+   struct bn*                words;      // alloc.words, mapping.words or shared.words
+   struct bn                 seed;
+   enum buffer_state         state;
+   uint64_t                  last_used;
+};
+
+/*
+ * An in-memory LRU cache of word buffers keyed by seed, so switching back to a
+ * recently used block costs nothing. Seeds are also known ahead of the requests that
+ * use them (the wrapper mines on a block a few confirmations behind head), so a
+ * hinted seed is generated into the least recently used entry on a background
+ * thread while the search goes on.
+ */
+struct word_buffers
+{
+   pthread_mutex_t            lock;
+   pthread_cond_t             changed;
+   pthread_t                  generator;
+
+   struct word_buffer_entry*  entries;
+   unsigned                   count;
+   int                        current;    // Entry the search uses, -1 before the first request
+   uint64_t                   tick;
+
+   struct buffer_cache*       cache;      // NULL without a cache directory
+   bool                       shared;     // Share buffers with other processes
+
+   struct bn                  hint;
+   bool                       hinted;
+
+   uint64_t                   hits;
+   uint64_t                   misses;
+};
+
+int init_word_buffers( struct word_buffers* buffers, unsigned count, bool lock, bool shared, struct buffer_cache* cache );
+
+// Start generating the buffer for seed in the background, unless it is already at hand
+void hint_word_buffer( struct word_buffers* buffers, struct bn* seed );
+
+/*
+ * The buffer for seed: a cached entry, waiting for it if it is being pregenerated,
+ * or else the least recently used entry refilled from shared memory, from the disk
+ * cache, or generated on the calling thread's OpenMP team. Must not be called while a
+ * search uses the current buffer.
+ */
+struct bn* use_word_buffer( struct word_buffers* buffers, struct bn* seed );
+
+// Remove the shared memory segments this process created, before exiting
+void release_shared_buffers( struct word_buffers* buffers );
+
+#endif /* #ifndef __WORD_BUFFER_H__ */
@@ -0,0 +1,645 @@
+#include "work.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <omp.h>
+
+uint32_t coprimes[SAMPLE_INDICES];
+uint64_t coprime_magic[SAMPLE_INDICES];
+
+uint32_t bignum_mod_small( struct bn* b, uint32_t m )
+{
+   // Compute b % m
+   uint64_t tmp = 0;
+   for( int i=BN_ARRAY_SIZE-1; i>=0; i-- )
+   {
+      for( int k=WORD_SIZE*8-32; k>=0; k-=32 )
+      {
+         tmp = (tmp << 32) | (uint32_t)(b->array[i] >> k);
+         tmp %= m;
+      }
+   }
+   return (uint32_t) tmp;
+}
+
+uint32_t bignum_mod_coprime( struct bn* b, int j )
+{
+   // Compute b % coprimes[j] 16 bits at a time, keeping every step within fastmod_u32()
+   uint32_t tmp = 0;
+   for( int i=BN_ARRAY_SIZE-1; i>=0; i-- )
+   {
+      for( int k=WORD_SIZE*8-16; k>=0; k-=16 )
+      {
+         tmp = fastmod_u32( (tmp << 16) | (uint32_t)((b->array[i] >> k) & 0xffff), coprime_magic[j], coprimes[j] );
+      }
+   }
+   return tmp;
+}
+
+void bignum_add_small( struct bn* b, uint32_t n )
+{
+
+   DTYPE tmp = b->array[0];
+   b->array[0] += n;
+   int i = 0;
+   while( i < BN_ARRAY_SIZE - 1 && tmp > b->array[i] )
+   {
+      tmp = b->array[i+1];
+      b->array[i+1]++;
+      i++;
+   }
+}
+
+void init_work_constants()
+{
+   size_t i;
+
+   coprimes[0] = 0x0000fffd;
+   coprimes[1] = 0x0000fffb;
+   coprimes[2] = 0x0000fff7;
+   coprimes[3] = 0x0000fff1;
+   coprimes[4] = 0x0000ffef;
+   coprimes[5] = 0x0000ffe5;
+   coprimes[6] = 0x0000ffdf;
+   coprimes[7] = 0x0000ffd9;
+   coprimes[8] = 0x0000ffd3;
+   coprimes[9] = 0x0000ffd1;
+
+   for( i = 0; i < SAMPLE_INDICES; i++ )
+   {
+      coprime_magic[i] = UINT64_C(0xFFFFFFFFFFFFFFFF) / coprimes[i] + 1;
+   }
+}
+
+int verify_fast_reductions()
+{
+   // Check the divide-free reductions against the division path they replace, over
+   // the full range of values the Horner steps and the bignum reduction produce
+   uint64_t y;
+   struct bn b;
+   int i, j;
+
+   for( y = 0; y < (UINT64_C(1) << 20); y++ )
+   {
+      if( mod_word_index( y ) != y % WORD_INDEX_MODULUS )
+         return 0;
+   }
+
+   for( y = UINT64_C(1) << 20; y < (UINT64_C(1) << 48); y += 0x10000fff )
+   {
+      if( mod_word_index( y ) != y % WORD_INDEX_MODULUS )
+         return 0;
+   }
+
+   for( j = 0; j < SAMPLE_INDICES; j++ )
+   {
+      uint32_t d = coprimes[j];
+      uint32_t a;
+      for( a = 0; a < (1 << 17); a++ )
+      {
+         if( fastmod_u32( a, coprime_magic[j], d ) != a % d )
+            return 0;
+      }
+
+      for( y = 0; y < (UINT64_C(1) << 32); y += 0x10001 + j )
+      {
+         a = (uint32_t)y;
+         if( fastmod_u32( a, coprime_magic[j], d ) != a % d )
+            return 0;
+         if( fastmod_u32( ~a, coprime_magic[j], d ) != ~a % d )
+            return 0;
+      }
+
+      for( y = 0; y < 4096; y++ )
+      {
+         for( i = 0; i < BN_ARRAY_SIZE; i++ )
+         {
+            b.array[i] = (DTYPE)((y + i) * UINT64_C(0x9E3779B97F4A7C15) >> (y & 31));
+         }
+         if( bignum_mod_coprime( &b, j ) != bignum_mod_small( &b, d ) )
+            return 0;
+      }
+   }
+
+   return 1;
+}
+
+void init_work_data( struct work_data* wdata, struct bn* secured_struct_hash )
+{
+   size_t i, j;
+   for( i=0; i<SAMPLE_INDICES; i++ )
+   {
+      wdata->x[i] = bignum_mod_coprime( secured_struct_hash, i );
+   }
+
+   for( i=0; i<SAMPLE_INDICES; i++ )
+   {
+      uint64_t x_pow = 1; // x^j
+      uint32_t step = 0;
+      for( j=0; j<WORK_COEFFICIENTS; j++ )
+      {
+         step = word_index_add( step, x_pow );
+         uint32_t wrap = mod_word_index( coprimes[j] * x_pow );
+         wdata->index_wrap[j][i] = wrap ? WORD_INDEX_MODULUS - wrap : 0;
+         x_pow = mod_word_index( x_pow * wdata->x[i] );
+      }
+      wdata->index_step[i] = step;
+   }
+}
+
+void init_nonce_state( struct nonce_state* ns, const struct work_data* wdata, struct bn* nonce )
+{
+   uint32_t coefficients[WORK_COEFFICIENTS];
+
+   int i;
+   for( i = 0; i < WORK_COEFFICIENTS; ++i )
+   {
+      ns->residue[i] = bignum_mod_coprime( nonce, i );
+      coefficients[i] = 1 + ns->residue[i];
+   }
+
+   for( i = 0; i < SAMPLE_INDICES; ++i )
+   {
+      ns->index[i] = word_index( wdata->x[i], coefficients );
+   }
+}
+
+
+void find_word( struct bn* result, uint32_t x, uint32_t* coefficients, struct bn* word_buffer )
+{
+   bignum_assign( result, word_buffer + word_index( x, coefficients ) );
+}
+
+
+void find_and_xor_word( struct bn* result, uint32_t x, uint32_t* coefficients, struct bn* word_buffer )
+{
+   bignum_fast_xor( result, word_buffer + word_index( x, coefficients ), result );
+}
+
+
+void work( struct bn* result, struct bn* secured_struct_hash, struct bn* nonce, struct bn* word_buffer )
+{
+   struct work_data wdata;
+   init_work_data( &wdata, secured_struct_hash );
+
+   bignum_assign( result, secured_struct_hash ); // result = secured_struct_hash;
+
+   uint32_t coefficients[WORK_COEFFICIENTS];
+
+   int i;
+   for( i = 0; i < WORK_COEFFICIENTS; ++i )
+   {
+      coefficients[i] = 1 + bignum_mod_coprime( nonce, i );
+   }
+
+   for( i = 0; i < SAMPLE_INDICES; ++i )
+   {
+      find_and_xor_word( result, wdata.x[i], coefficients, word_buffer );
+   }
+}
+
+
+int words_are_unique( struct bn* secured_struct_hash, struct bn* nonce, struct bn* word_buffer )
+{
+   struct work_data wdata;
+   struct bn w[SAMPLE_INDICES];
+   init_work_data( &wdata, secured_struct_hash );
+
+   uint32_t coefficients[WORK_COEFFICIENTS];
+
+   int i, j;
+   for( i = 0; i < WORK_COEFFICIENTS; ++i )
+   {
+      coefficients[i] = 1 + bignum_mod_coprime( nonce, i );
+   }
+
+   for( i = 0; i < SAMPLE_INDICES; ++i )
+   {
+      find_word( w+i, wdata.x[i], coefficients, word_buffer );
+      for( j = 0; j < i; j++ )
+      {
+         if( bignum_cmp( w+i, w+j ) == 0 )
+            return 0;
+      }
+   }
+   return 1;
+}
+
+
+/*
+ * A search kernel is split in two so the search loop can software-pipeline it:
+ * the index kernel derives the word indices of a batch of nonces into an index
+ * block laid out as indices[i * lanes + l], and the gather kernel XORs the words
+ * of a block and compares them against the target.
+ */
+typedef void (*index_kernel_t)( const struct work_data* wdata, const struct nonce_state* ns, uint32_t* indices );
+typedef uint32_t (*gather_kernel_t)( const uint32_t* indices, struct bn* secured_struct_hash, struct bn* word_buffer, uint64_t target_top );
+
+#define SEARCH_MAX_LANES   16
+
+// Index blocks in flight, bounds the prefetch distance to PREFETCH_RING - 1 batches
+#define PREFETCH_RING      32
+
+// The scalar reference kernel, one nonce per batch
+static void index_kernel_x1( const struct work_data* wdata, const struct nonce_state* ns, uint32_t* indices )
+{
+   (void)wdata;
+   memcpy( indices, ns->index, sizeof(ns->index) );
+}
+
+static uint32_t gather_kernel_x1( const uint32_t* indices, struct bn* secured_struct_hash, struct bn* word_buffer, uint64_t target_top )
+{
+   struct bn result;
+   bignum_assign( &result, secured_struct_hash );
+
+   for( int i = 0; i < SAMPLE_INDICES; i++ )
+   {
+      bignum_fast_xor( &result, word_buffer + indices[i], &result );
+   }
+
+   return bignum_top64( &result ) <= target_top;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WORK_HAVE_SIMD_KERNELS
+
+typedef uint64_t word_vector __attribute__((vector_size(32)));
+
+/*
+ * Defines index_kernel_x<lanes>() and gather_kernel_x<lanes>(). Lane k handles
+ * nonce n + k: its indices are index + k * index_step, plus index_wrap[j] for every
+ * coefficient j that wraps within the batch, i.e. when k >= coprimes[j] - residue[j].
+ * Each nonce's words are XOR-accumulated in one 256-bit vector and the top 64 bits
+ * of all results are compared against the target together.
+ */
+#define SEARCH_KERNELS( lanes, isa ) \
+__attribute__((target(isa))) \
+static void index_kernel_x##lanes( const struct work_data* wdata, const struct nonce_state* ns, uint32_t* indices ) \
+{ \
+   typedef uint32_t index_vector __attribute__((vector_size(4 * lanes))); \
+   index_vector k, index[SAMPLE_INDICES]; \
+   int i, j, l; \
+   for( l = 0; l < lanes; l++ ) \
+      k[l] = l; \
+   for( i = 0; i < SAMPLE_INDICES; i++ ) \
+   { \
+      index_vector y = ns->index[i] + k * wdata->index_step[i]; \
+      y = (y & 0xffff) + (y >> 16); \
+      y = (y & 0xffff) + (y >> 16); \
+      index[i] = y - ((index_vector)(y >= WORD_INDEX_MODULUS) & WORD_INDEX_MODULUS); \
+   } \
+   for( j = 0; j < WORK_COEFFICIENTS; j++ ) \
+   { \
+      uint32_t left = coprimes[j] - ns->residue[j]; \
+      if( left >= lanes ) \
+         continue; \
+      index_vector wrapped = (index_vector)(k >= left); \
+      for( i = 0; i < SAMPLE_INDICES; i++ ) \
+      { \
+         index_vector y = index[i] + (wrapped & wdata->index_wrap[j][i]); \
+         index[i] = y - ((index_vector)(y >= WORD_INDEX_MODULUS) & WORD_INDEX_MODULUS); \
+      } \
+   } \
+   memcpy( indices, index, sizeof(index) ); \
+} \
+\
+__attribute__((target(isa))) \
+static uint32_t gather_kernel_x##lanes( const uint32_t* indices, struct bn* secured_struct_hash, struct bn* word_buffer, uint64_t target_top ) \
+{ \
+   typedef uint64_t top_vector __attribute__((vector_size(8 * lanes))); \
+   top_vector top; \
+   word_vector seed, w; \
+   uint32_t candidates = 0; \
+   int i, l; \
+   memcpy( &seed, secured_struct_hash, sizeof(seed) ); \
+   for( l = 0; l < lanes; l++ ) \
+   { \
+      word_vector acc = seed; \
+      for( i = 0; i < SAMPLE_INDICES; i++ ) \
+      { \
+         memcpy( &w, word_buffer + indices[i * lanes + l], sizeof(w) ); \
+         acc ^= w; \
+      } \
+      top[l] = acc[3]; \
+   } \
+   top = (top_vector)(top <= target_top); \
+   for( l = 0; l < lanes; l++ ) \
+      candidates |= (uint32_t)(top[l] & 1) << l; \
+   return candidates; \
+}
+
+SEARCH_KERNELS( 8, "avx2" )
+SEARCH_KERNELS( 16, "avx512f" )
+#endif
+
+// The kernels from the most to the least preferred, each one used only where the cpu supports it
+struct search_kernel
+{
+   const char*      name;
+   unsigned         lanes;
+   int              (*supported)();
+   index_kernel_t   index;
+   gather_kernel_t  gather;
+};
+
+#ifdef WORK_HAVE_SIMD_KERNELS
+static int cpu_has_avx512()
+{
+   __builtin_cpu_init();
+   return __builtin_cpu_supports( "avx512f" );
+}
+
+static int cpu_has_avx2()
+{
+   __builtin_cpu_init();
+   return __builtin_cpu_supports( "avx2" );
+}
+#endif
+
+static const struct search_kernel search_kernels[] =
+{
+#ifdef WORK_HAVE_SIMD_KERNELS
+   { "avx512", 16, cpu_has_avx512, index_kernel_x16, gather_kernel_x16 },
+   { "avx2", 8, cpu_has_avx2, index_kernel_x8, gather_kernel_x8 },
+#endif
+   { "scalar", 1, NULL, index_kernel_x1, gather_kernel_x1 }
+};
+
+#define SEARCH_KERNEL_COUNT (sizeof(search_kernels) / sizeof(search_kernels[0]))
+
+static index_kernel_t index_kernel = index_kernel_x1;
+static gather_kernel_t gather_kernel = gather_kernel_x1;
+static unsigned search_lanes = 1;
+static const char* search_kernel_id = "scalar";
+
+// Prefetch distance in batches of search_lanes nonces
+static unsigned prefetch_batches = 0;
+
+// The prefetch distance in nonces is kept across the change of batch size
+static void use_search_kernel( const struct search_kernel* k )
+{
+   unsigned distance = get_prefetch_distance();
+   index_kernel = k->index;
+   gather_kernel = k->gather;
+   search_lanes = k->lanes;
+   search_kernel_id = k->name;
+   set_prefetch_distance( distance );
+}
+
+void select_search_kernel()
+{
+   for( size_t i = 0; i < SEARCH_KERNEL_COUNT; i++ )
+   {
+      if( !search_kernels[i].supported || search_kernels[i].supported() )
+      {
+         use_search_kernel( search_kernels + i );
+         return;
+      }
+   }
+}
+
+int select_search_kernel_named( const char* name )
+{
+   for( size_t i = 0; i < SEARCH_KERNEL_COUNT; i++ )
+   {
+      if( strcmp( search_kernels[i].name, name ) == 0 )
+      {
+         if( search_kernels[i].supported && !search_kernels[i].supported() )
+            return 0;
+         use_search_kernel( search_kernels + i );
+         return 1;
+      }
+   }
+   return 0;
+}
+
+const char* search_kernel_name_at( unsigned i )
+{
+   return i < SEARCH_KERNEL_COUNT ? search_kernels[i].name : NULL;
+}
+
+const char* search_kernel_name()
+{
+   return search_kernel_id;
+}
+
+unsigned search_kernel_lanes()
+{
+   return search_lanes;
+}
+
+void set_prefetch_distance( unsigned nonces )
+{
+   prefetch_batches = (nonces + search_lanes - 1) / search_lanes;
+   if( prefetch_batches > PREFETCH_RING - 1 )
+      prefetch_batches = PREFETCH_RING - 1;
+}
+
+unsigned get_prefetch_distance()
+{
+   return prefetch_batches * search_lanes;
+}
+
+void init_share_sink( struct share_sink* shares, struct bn* target, void (*on_share)( void*, struct bn*, struct bn* ), void* context )
+{
+   bignum_assign( &shares->target, target );
+   bignum_init( &shares->best_nonce );
+   memset( shares->best.array, 0xFF, sizeof(shares->best.array) );
+   shares->on_share = on_share;
+   shares->context = context;
+}
+
+// Confirm a kernel candidate on the scalar path: full compare, then uniqueness
+static int check_candidate( struct bn* nonce, const struct nonce_state* ns, struct bn* secured_struct_hash,
+   struct bn* target, struct share_sink* shares, struct bn* word_buffer, struct bn* result )
+{
+   work_from_state( result, secured_struct_hash, ns, word_buffer );
+
+   bool share = false;
+   if( shares )
+   {
+      if( bignum_fast_cmp( result, &shares->best ) < 0 )
+      {
+         bignum_assign( &shares->best, result );
+         bignum_assign( &shares->best_nonce, nonce );
+      }
+      share = bignum_fast_cmp( result, &shares->target ) <= 0;
+   }
+
+   int proof = bignum_fast_cmp( result, target ) <= 0;
+   if( !proof && !share )
+      return 0;
+
+   if( !words_are_unique( secured_struct_hash, nonce, word_buffer ) )
+   {
+      // Non-unique, do nothing
+      // This is normal
+      if( proof )
+         fprintf( stderr, "[C] Possible proof failed uniqueness check\n");
+      return 0;
+   }
+
+   if( share )
+      shares->on_share( shares->context, nonce, result );
+   return proof;
+}
+
+// Only the owning thread writes a hash counter, other threads just sample it
+static inline void count_hashes( atomic_uint_fast64_t* hashes, uint64_t n )
+{
+   atomic_store_explicit( hashes, atomic_load_explicit( hashes, memory_order_relaxed ) + n, memory_order_relaxed );
+}
+
+/*
+ * Run whole kernel batches, software-pipelined: the indices of the batch
+ * prefetch_batches ahead are derived and their words prefetched while the words
+ * of the current batch, whose indices were derived earlier, are gathered.
+ */
+static int search_batches( struct bn* nonce, struct nonce_state* ns, uint64_t batches, const struct work_data* wdata,
+   struct bn* secured_struct_hash, struct bn* target, struct share_sink* shares, struct bn* word_buffer,
+   const atomic_bool* stop, atomic_uint_fast64_t* hashes, struct bn* result )
+{
+   uint32_t ring[PREFETCH_RING][SAMPLE_INDICES * SEARCH_MAX_LANES];
+   uint64_t target_top = bignum_top64( target );
+   if( shares && bignum_top64( &shares->target ) > target_top )
+      target_top = bignum_top64( &shares->target );
+   struct nonce_state ahead = *ns;
+   uint64_t ahead_batch = 0;
+   unsigned words = SAMPLE_INDICES * search_lanes;
+
+   for( uint64_t b = 0; b < batches; b++ )
+   {
+      if( atomic_load_explicit( stop, memory_order_relaxed ) )
+         return 0;
+
+      for( ; ahead_batch < batches && ahead_batch <= b + prefetch_batches; ahead_batch++ )
+      {
+         uint32_t* indices = ring[ahead_batch % PREFETCH_RING];
+         index_kernel( wdata, &ahead, indices );
+         advance_nonce_state( &ahead, wdata, search_lanes );
+
+         if( prefetch_batches )
+         {
+            for( unsigned w = 0; w < words; w++ )
+               __builtin_prefetch( word_buffer + indices[w], 0, 3 );
+         }
+      }
+
+      // In share mode anything that may beat the best result so far is a candidate too
+      uint64_t filter_top = target_top;
+      if( shares && bignum_top64( &shares->best ) > filter_top )
+         filter_top = bignum_top64( &shares->best );
+
+      uint32_t candidates = gather_kernel( ring[b % PREFETCH_RING], secured_struct_hash, word_buffer, filter_top );
+
+      for( ; candidates; candidates &= candidates - 1 )
+      {
+         uint32_t k = __builtin_ctz( candidates );
+         struct nonce_state candidate_ns = *ns;
+         struct bn candidate_nonce;
+
+         advance_nonce_state( &candidate_ns, wdata, k );
+         bignum_assign( &candidate_nonce, nonce );
+         bignum_add_small( &candidate_nonce, k );
+
+         if( check_candidate( &candidate_nonce, &candidate_ns, secured_struct_hash, target, shares, word_buffer, result ) )
+         {
+            bignum_assign( nonce, &candidate_nonce );
+            count_hashes( hashes, k + 1 );
+            return 1;
+         }
+      }
+
+      advance_nonce_state( ns, wdata, search_lanes );
+      bignum_add_small( nonce, search_lanes );
+      count_hashes( hashes, search_lanes );
+   }
+
+   return 0;
+}
+
+int search_range( struct bn* nonce, uint64_t count, const struct work_data* wdata, struct bn* secured_struct_hash,
+   struct bn* target, struct share_sink* shares, struct bn* word_buffer, const atomic_bool* stop,
+   atomic_uint_fast64_t* hashes, struct bn* result )
+{
+   struct nonce_state ns;
+   uint64_t i = 0;
+
+   init_nonce_state( &ns, wdata, nonce );
+
+   while( i < count && !atomic_load_explicit( stop, memory_order_relaxed ) )
+   {
+      // Whole batches go through the kernels up to the point where the low limb of
+      // the nonce would wrap, the remainder and the wrapping nonce take the scalar path
+      uint64_t batches = (count - i) / search_lanes;
+      uint64_t room = (uint64_t)(MAX_VAL - nonce->array[0]) / search_lanes;
+      if( room < batches )
+         batches = room;
+
+      if( batches )
+      {
+         if( search_batches( nonce, &ns, batches, wdata, secured_struct_hash, target, shares, word_buffer, stop, hashes, result ) )
+            return 1;
+         i += batches * search_lanes;
+      }
+      else
+      {
+         count_hashes( hashes, 1 );
+         if( check_candidate( nonce, &ns, secured_struct_hash, target, shares, word_buffer, result ) )
+            return 1;
+
+         next_nonce( nonce, &ns, wdata );
+         i++;
+      }
+   }
+
+   return 0;
+}
+
+unsigned tune_prefetch_distance( const struct work_data* wdata, struct bn* secured_struct_hash, struct bn* word_buffer )
+{
+   // Time every candidate distance on the whole thread team, so the memory system is
+   // as loaded as during the search, and keep the fastest
+   static const unsigned candidates[] = { 0, 1, 2, 4, 8, 16, 24 };
+   const unsigned count = sizeof(candidates) / sizeof(candidates[0]);
+   const uint64_t nonces = 1 << 17;
+   double best_time = 0;
+   unsigned best = 0;
+   struct bn target;
+   atomic_bool stop = false;
+
+   bignum_init( &target );
+
+   for( unsigned c = 0; c < 2 * count; c++ )
+   {
+      unsigned distance = candidates[c % count] * search_lanes;
+      double start;
+      set_prefetch_distance( distance );
+
+      #pragma omp parallel
+      {
+         struct bn t_nonce, t_result;
+         atomic_uint_fast64_t t_hashes = 0;
+         bignum_from_int( &t_nonce, (uint64_t)omp_get_thread_num() * nonces );
+
+         #pragma omp barrier
+         #pragma omp master
+         start = omp_get_wtime();
+
+         search_range( &t_nonce, nonces, wdata, secured_struct_hash, &target, NULL, word_buffer, &stop, &t_hashes, &t_result );
+      }
+
+      double elapsed = omp_get_wtime() - start;
+      if( c == 0 || elapsed < best_time )
+      {
+         best_time = elapsed;
+         best = distance;
+      }
+   }
+
+   set_prefetch_distance( best );
+   return get_prefetch_distance();
+}
@@ -0,0 +1,233 @@
+#ifndef __WORK_H__
+#define __WORK_H__
+
+#include "bn.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define WORD_BUFFER_BYTES  (2 << 20) // 2 MB
+#define WORD_BUFFER_LENGTH (WORD_BUFFER_BYTES / sizeof(struct bn))
+
+// Word indices are polynomials evaluated mod WORD_BUFFER_LENGTH - 1
+#define WORD_INDEX_MODULUS (WORD_BUFFER_LENGTH - 1)
+
+#define SAMPLE_INDICES     10
+#define WORK_COEFFICIENTS   5
+
+extern uint32_t coprimes[SAMPLE_INDICES];
+extern uint64_t coprime_magic[SAMPLE_INDICES];
+
+_Static_assert( WORD_INDEX_MODULUS == 0xffff, "mod_word_index() folds 16-bit digits" );
+
+/*
+ * y % WORD_INDEX_MODULUS for y < 2^48 without a divide. Since 2^16 = 1 mod 2^16 - 1,
+ * adding the 16-bit digits of y (end-around carry) preserves the residue.
+ */
+static inline uint32_t mod_word_index( uint64_t y )
+{
+   y = (y & 0xffff) + (y >> 16); // < 2^32 + 2^16
+   y = (y & 0xffff) + (y >> 16); // < 2^17
+   y = (y & 0xffff) + (y >> 16); // <= 2^16
+   return (uint32_t)(y >= WORD_INDEX_MODULUS ? y - WORD_INDEX_MODULUS : y);
+}
+
+/*
+ * a % d for a < 2^32 and d < 2^16 with Lemire's fastmod, where magic = 2^64 / d + 1.
+ * The high half of the 64x16-bit product is assembled from two 32x16-bit products.
+ */
+static inline uint32_t fastmod_u32( uint32_t a, uint64_t magic, uint32_t d )
+{
+   uint64_t lowbits = magic * a;
+   return (uint32_t)(((lowbits >> 32) * d + (((lowbits & 0xffffffff) * d) >> 32)) >> 32);
+}
+
+uint32_t bignum_mod_small( struct bn* b, uint32_t m );
+uint32_t bignum_mod_coprime( struct bn* b, int j );
+void bignum_add_small( struct bn* b, uint32_t n );
+
+void init_work_constants();
+int verify_fast_reductions();
+
+// Index of the word sampled at x: sum_j coefficients[j] * x^j mod WORD_INDEX_MODULUS
+static inline uint32_t word_index( uint32_t x, const uint32_t* coefficients )
+{
+   uint64_t y = coefficients[4];
+   y = mod_word_index( y * x + coefficients[3] );
+   y = mod_word_index( y * x + coefficients[2] );
+   y = mod_word_index( y * x + coefficients[1] );
+   y = mod_word_index( y * x + coefficients[0] );
+   return (uint32_t)y;
+}
+
+/*
+ * Everything about the sampled words that depends only on the secured struct hash.
+ *
+ * Word i of a nonce is found at index[i] = sum_j c_j * x[i]^j mod WORD_INDEX_MODULUS,
+ * with coefficients c_j = 1 + nonce % coprimes[j]. Incrementing the nonce increments
+ * every coefficient, moving each index by index_step[i], except for a coefficient
+ * that wraps from coprimes[j] back to 1, which additionally moves it by index_wrap[j][i].
+ */
+struct work_data
+{
+   uint32_t x[SAMPLE_INDICES];
+   uint32_t index_step[SAMPLE_INDICES];
+   uint32_t index_wrap[WORK_COEFFICIENTS][SAMPLE_INDICES];
+};
+
+void init_work_data( struct work_data* wdata, struct bn* secured_struct_hash );
+
+/*
+ * Per-thread stepping state of the search: the nonce residues that make up the
+ * coefficients, and the word index of every sample for the current nonce.
+ */
+struct nonce_state
+{
+   uint32_t residue[WORK_COEFFICIENTS];
+   uint32_t index[SAMPLE_INDICES];
+};
+
+void init_nonce_state( struct nonce_state* ns, const struct work_data* wdata, struct bn* nonce );
+
+static inline uint32_t word_index_add( uint32_t a, uint32_t b )
+{
+   a += b;
+   return a >= WORD_INDEX_MODULUS ? a - WORD_INDEX_MODULUS : a;
+}
+
+// Advance ns from nonce n to nonce n + 1
+static inline void step_nonce_state( struct nonce_state* ns, const struct work_data* wdata )
+{
+   int i, j;
+   for( i = 0; i < SAMPLE_INDICES; i++ )
+   {
+      ns->index[i] = word_index_add( ns->index[i], wdata->index_step[i] );
+   }
+
+   for( j = 0; j < WORK_COEFFICIENTS; j++ )
+   {
+      if( ++ns->residue[j] == coprimes[j] )
+      {
+         ns->residue[j] = 0;
+         for( i = 0; i < SAMPLE_INDICES; i++ )
+         {
+            ns->index[i] = word_index_add( ns->index[i], wdata->index_wrap[j][i] );
+         }
+      }
+   }
+}
+
+// Advance ns from nonce n to nonce n + count, count < every coprime
+static inline void advance_nonce_state( struct nonce_state* ns, const struct work_data* wdata, uint32_t count )
+{
+   int i, j;
+   for( i = 0; i < SAMPLE_INDICES; i++ )
+   {
+      ns->index[i] = mod_word_index( ns->index[i] + (uint64_t)count * wdata->index_step[i] );
+   }
+
+   for( j = 0; j < WORK_COEFFICIENTS; j++ )
+   {
+      ns->residue[j] += count;
+      if( ns->residue[j] >= coprimes[j] )
+      {
+         ns->residue[j] -= coprimes[j];
+         for( i = 0; i < SAMPLE_INDICES; i++ )
+         {
+            ns->index[i] = word_index_add( ns->index[i], wdata->index_wrap[j][i] );
+         }
+      }
+   }
+}
+
+// Advance the nonce together with its stepping state. The state is rebuilt from the
+// nonce whenever the low limb wraps, so it stays exact across a wrap of the nonce itself
+static inline void next_nonce( struct bn* nonce, struct nonce_state* ns, const struct work_data* wdata )
+{
+   bignum_fast_inc( nonce );
+   if( nonce->array[0] == 0 )
+      init_nonce_state( ns, wdata, nonce );
+   else
+      step_nonce_state( ns, wdata );
+}
+
+// result = secured_struct_hash ^ the words sampled by ns
+static inline void work_from_state( struct bn* result, struct bn* secured_struct_hash, const struct nonce_state* ns, struct bn* word_buffer )
+{
+   bignum_assign( result, secured_struct_hash );
+
+   for( int i = 0; i < SAMPLE_INDICES; i++ )
+   {
+      bignum_fast_xor( result, word_buffer + ns->index[i], result );
+   }
+}
+
+// The most significant 64 bits of a 256-bit number
+static inline uint64_t bignum_top64( struct bn* n )
+{
+   uint64_t top;
+   memcpy( &top, (unsigned char*)n + sizeof(struct bn) - sizeof(top), sizeof(top) );
+   return top;
+}
+
+/*
+ * Batched search kernels.
+ *
+ * A kernel batch covers search_kernel_lanes() consecutive nonces: all of their word
+ * indices are derived in SIMD integer lanes, the sampled words of every nonce are
+ * XOR-accumulated and the most significant 64 bits of each result are compared
+ * against the target's. Nonces that may be at or under the target are confirmed on
+ * the scalar path.
+ */
+void select_search_kernel();
+// Use the kernel of that name, returns 0 if there is none or the cpu lacks it
+int select_search_kernel_named( const char* name );
+// The name of kernel i, most preferred first, NULL past the last one
+const char* search_kernel_name_at( unsigned i );
+const char* search_kernel_name();
+unsigned search_kernel_lanes();
+
+/*
+ * The search loop derives indices and prefetches words this many nonces ahead of the
+ * nonces it is hashing, rounded up to whole kernel batches. tune_prefetch_distance()
+ * measures a range of distances on the current word buffer and keeps the fastest.
+ */
+void set_prefetch_distance( unsigned nonces );
+unsigned get_prefetch_distance();
+unsigned tune_prefetch_distance( const struct work_data* wdata, struct bn* secured_struct_hash, struct bn* word_buffer );
+
+/*
+ * Share mode of a search. Every result <= target whose sampled words are unique is
+ * passed to on_share as it is found, proofs included, and the lowest result of all
+ * the nonces searched is kept in best. Nothing else is skipped by the kernels until
+ * best has come down, which takes a few batches.
+ */
+struct share_sink
+{
+   struct bn  target;
+   struct bn  best_nonce;
+   struct bn  best;          // All ones until a nonce is searched
+   void     (*on_share)( void* context, struct bn* nonce, struct bn* result );
+   void*      context;
+};
+
+void init_share_sink( struct share_sink* shares, struct bn* target, void (*on_share)( void*, struct bn*, struct bn* ), void* context );
+
+/*
+ * Search count nonces starting at *nonce for a result <= target whose sampled words
+ * are unique, checking *stop once per kernel batch. Every nonce evaluated is added
+ * to *hashes as it completes, and fed to shares unless it is NULL. Returns 1 with the
+ * proof in *nonce and *result, or 0 once the range is exhausted or stop is set.
+ */
+int search_range( struct bn* nonce, uint64_t count, const struct work_data* wdata, struct bn* secured_struct_hash,
+   struct bn* target, struct share_sink* shares, struct bn* word_buffer, const atomic_bool* stop,
+   atomic_uint_fast64_t* hashes, struct bn* result );
+
+void find_word( struct bn* result, uint32_t x, uint32_t* coefficients, struct bn* word_buffer );
+void find_and_xor_word( struct bn* result, uint32_t x, uint32_t* coefficients, struct bn* word_buffer );
+void work( struct bn* result, struct bn* secured_struct_hash, struct bn* nonce, struct bn* word_buffer );
+int words_are_unique( struct bn* secured_struct_hash, struct bn* nonce, struct bn* word_buffer );
+
+#endif /* #ifndef __WORK_H__ */
@@ -0,0 +1,125 @@
+'use strict';
+
+const { fieldToBuffer } = require("./protocol.js");
+
+/**
+ * Runs the search engine in this process through the koinos_miner.node addon.
+ *
+ * Takes the place of a miner process behind MiningRequestQueue and produces the
+ * same messages as the protocol decoders. Like the miner, a newer request preempts
+ * the search in progress, and hash reports are sampled from the engine's counters.
+ */
+class NativeTransport {
+   constructor( addon, onMessage, reportInterval = 1000 ) {
+      this.addon = addon;
+      this.onMessage = onMessage;
+      this.reportInterval = reportInterval;
+      this.current = null;
+      this.next = null;
+      this.counters = null;
+      this.reportTimer = null;
+   }
+
+   start( options ) {
+      let threads = this.addon.init(options || {});
+      this.counters = this.addon.counters();
+      this.last = new Array(threads).fill(0n);
+      this.lastReport = Date.now();
+      this.reportTimer = setInterval( () => this.report(), this.reportInterval );
+      this.onMessage({ type: "threads", threads: threads });
+   }
+
+   stop() {
+      if( this.reportTimer !== null ) {
+         clearInterval(this.reportTimer);
+         this.reportTimer = null;
+      }
+      this.next = null;
+      this.addon.cancel();
+   }
+
+   request( req ) {
+      if( this.current === null ) {
+         this.run(req);
+         return;
+      }
+
+      // A request that never started is answered right away, as the miner would
+      if( this.next !== null )
+         this.onMessage({ type: "preempted", id: this.next.id, hashes: 0 });
+      this.next = req;
+      this.addon.cancel();
+   }
+
+   hint( blockHash ) {
+      this.addon.hint(fieldToBuffer(blockHash));
+   }
+
+   run( req ) {
+      var self = this;
+      this.current = req;
+      this.last.fill(0n);
+      this.lastReport = Date.now();
+
+      this.addon.search({
+         minerAddress: fieldToBuffer(req.minerAddress),
+         tipAddress: fieldToBuffer(req.tipAddress),
+         blockHash: fieldToBuffer(req.block.hash),
+         target: fieldToBuffer(req.difficulty),
+         nonceOffset: fieldToBuffer(req.nonceOffset),
+         blockNumber: Number(req.block.number),
+         tip: Number(req.tipAmount),
+         powHeight: Number(req.powHeight),
+         threadIterations: Math.trunc(req.threadIterations),
+         hashLimit: Math.trunc(req.hashLimit)
+      }, function(err, result) {
+         self.current = null;
+
+         // Start the waiting request first, a new one sent while handling this
+         // result then preempts it in turn
+         let next = self.next;
+         self.next = null;
+         if( next !== null )
+            self.run(next);
+
+         if( result.status === "found" )
+            self.onMessage({ type: "nonce", id: req.id, nonce: BigInt("0x" + result.nonce.toString("hex")) });
+         else if( result.status === "finished" )
+            self.onMessage({ type: "finished", id: req.id });
+         else
+            self.onMessage({ type: "preempted", id: req.id, hashes: result.hashes });
+      });
+   }
+
+   report() {
+      if( this.current === null )
+         return;
+
+      let now = Date.now();
+      let elapsed = Math.max(now - this.lastReport, 1) / 1000;
+      let hashes = 0;
+      let threadRates = [];
+      for( let t = 0; t < this.last.length; t++ ) {
+         let count = this.counters[t * this.addon.counterStride];
+         // The counters restart with every search, which the worker may only just have begun
+         if( count < this.last[t] )
+            this.last[t] = 0n;
+         threadRates.push(Number(count - this.last[t]) / elapsed);
+         hashes += Number(count);
+         this.last[t] = count;
+      }
+      this.lastReport = now;
+
+      this.onMessage({
+         type: "hashReport",
+         id: this.current.id,
+         time: now,
+         hashes: hashes,
+         rate: threadRates.reduce( (a, b) => a + b, 0 ),
+         threadRates: threadRates });
+   }
+}
+
+module.exports = {
+   NativeTransport : NativeTransport
+   };
@@ -0,0 +1,309 @@
+'use strict';
+
+/**
+ * Encoding of the messages exchanged with the C miner, see miner/protocol.h.
+ *
+ * Both decoders take stdout chunks as they arrive, which may hold several messages
+ * or only part of one, and call onMessage once for every complete message with
+ * one of:
+ *
+ *    { type: "threads", threads }
+ *    { type: "hashReport", id, time, hashes, rate, threadRates }
+ *    { type: "share", id, nonce, result }
+ *    { type: "best", id, nonce, result }
+ *    { type: "nonce", id, nonce }
+ *    { type: "finished", id }
+ *    { type: "preempted", id, hashes }
+ *
+ * The text protocol carries no request ids, its messages have id === undefined.
+ */
+
+const PROTOCOL_VERSION = 1;
+const HEADER_BYTES = 12;
+const FIELD_BYTES = 32;
+// Requests are capped at 4096 bytes by the miner, hash reports grow with the thread count
+const MAX_FRAME_BYTES = 1 << 20;
+
+const FrameType = {
+   REQUEST: 0x01,
+   HINT: 0x02,
+   WEIGHT: 0x03,
+   THREADS: 0x81,
+   HASH_REPORT: 0x82,
+   NONCE: 0x83,
+   FINISHED: 0x84,
+   PREEMPTED: 0x85,
+   SHARE: 0x86,
+   BEST: 0x87
+};
+
+// Request flags, see REQUEST_JOIN in miner/protocol.h
+const RequestFlags = {
+   JOIN: 0x1
+};
+
+function fieldToBuffer( value ) {
+   // A 32 byte big endian field from a BigInt or a hex string, right aligned
+   let hex = typeof value === "bigint" ? value.toString(16) : value.toString();
+   if( hex.startsWith("0x") )
+      hex = hex.substring(2);
+   return Buffer.from("0".repeat(2 * FIELD_BYTES - hex.length) + hex, "hex");
+}
+
+function requestWeight( req ) {
+   // Requests without a weight get 1, a weight of 0 starts the job paused
+   return req.weight === undefined ? 1 : req.weight;
+}
+
+function encodeFrame( type, id, payload ) {
+   let header = Buffer.alloc(HEADER_BYTES);
+   header.writeUInt32BE(HEADER_BYTES - 4 + payload.length, 0);
+   header.writeUInt8(PROTOCOL_VERSION, 4);
+   header.writeUInt8(type, 5);
+   header.writeUInt32BE(id, 8);
+   return Buffer.concat([header, payload]);
+}
+
+function encodeRequest( id, req ) {
+   let numbers = Buffer.alloc(5 * 8);
+   numbers.writeBigUInt64BE(BigInt(req.block.number), 0);
+   numbers.writeBigUInt64BE(BigInt(req.tipAmount), 8);
+   numbers.writeBigUInt64BE(BigInt(req.powHeight), 16);
+   numbers.writeBigUInt64BE(BigInt(Math.trunc(req.threadIterations)), 24);
+   numbers.writeBigUInt64BE(BigInt(Math.trunc(req.hashLimit)), 32);
+   let job = Buffer.alloc(2 * 4);
+   job.writeUInt32BE(requestWeight(req), 0);
+   job.writeUInt32BE(req.join ? RequestFlags.JOIN : 0, 4);
+   // A share target searches the request in share mode, zero is none
+   let shareTarget = fieldToBuffer(req.shareTarget || 0n);
+   return encodeFrame(FrameType.REQUEST, id, Buffer.concat([
+      fieldToBuffer(req.minerAddress),
+      fieldToBuffer(req.tipAddress),
+      fieldToBuffer(req.block.hash),
+      fieldToBuffer(req.difficulty),
+      fieldToBuffer(req.nonceOffset),
+      numbers,
+      job,
+      shareTarget ]));
+}
+
+function encodeHint( blockHash ) {
+   return encodeFrame(FrameType.HINT, 0, fieldToBuffer(blockHash));
+}
+
+function encodeWeight( weight, id = 0 ) {
+   // With an id the weight is that of the request's job, else the wrapper's in a daemon
+   let payload = Buffer.alloc(4);
+   payload.writeUInt32BE(weight, 0);
+   return encodeFrame(FrameType.WEIGHT, id, payload);
+}
+
+function encodeTextRequest( req, difficultyStr ) {
+   // The job fields are only sent when needed, older miners reject them
+   let job = "";
+   if( req.join || requestWeight(req) !== 1 || req.shareTarget )
+      job = " " + requestWeight(req) + " " + (req.join ? RequestFlags.JOIN : 0);
+   if( req.shareTarget )
+      job += " 0x" + fieldToBuffer(req.shareTarget).toString("hex");
+   return req.minerAddress + " " +
+      req.tipAddress + " " +
+      req.block.hash + " " +
+      req.block.number.toString() + " " +
+      difficultyStr + " " +
+      req.tipAmount + " " +
+      req.powHeight + " " +
+      req.threadIterations + " " +
+      req.hashLimit + " " +
+      req.nonceOffset + job + ";\n";
+}
+
+function encodeTextHint( blockHash ) {
+   return "hint " + blockHash + ";\n";
+}
+
+function encodeTextWeight( weight, id ) {
+   return "weight " + weight + (id !== undefined ? " " + id : "") + ";\n";
+}
+
+/**
+ * Sends requests to a miner process over its stdin, or to a miner daemon over its socket.
+ */
+class PipeTransport {
+   constructor( stream, binary ) {
+      this.stream = stream;
+      this.binary = binary;
+   }
+
+   request( req, difficultyStr ) {
+      if( this.binary )
+         this.stream.write(encodeRequest(req.id, req));
+      else
+         this.stream.write(encodeTextRequest(req, difficultyStr));
+   }
+
+   hint( blockHash ) {
+      if( this.binary )
+         this.stream.write(encodeHint(blockHash));
+      else
+         this.stream.write(encodeTextHint(blockHash));
+   }
+
+   weight( weight, id ) {
+      if( this.binary )
+         this.stream.write(encodeWeight(weight, id));
+      else
+         this.stream.write(encodeTextWeight(weight, id));
+   }
+}
+
+class BinaryDecoder {
+   constructor( onMessage, onError ) {
+      this.onMessage = onMessage;
+      this.onError = onError;
+      this.pending = Buffer.alloc(0);
+   }
+
+   push( chunk ) {
+      this.pending = this.pending.length ? Buffer.concat([this.pending, chunk]) : chunk;
+
+      while( this.pending.length >= 4 ) {
+         let length = this.pending.readUInt32BE(0);
+         if( length < HEADER_BYTES - 4 || length > MAX_FRAME_BYTES ) {
+            // Out of step with the miner, nothing after this can be trusted
+            this.pending = Buffer.alloc(0);
+            this.onError("Invalid frame length " + length + " from the C mining application.");
+            return;
+         }
+         if( this.pending.length < 4 + length )
+            break;
+
+         let frame = this.pending.subarray(0, 4 + length);
+         this.pending = this.pending.subarray(4 + length);
+         this.decode(frame);
+      }
+   }
+
+   decode( frame ) {
+      let version = frame.readUInt8(4);
+      let type = frame.readUInt8(5);
+      let id = frame.readUInt32BE(8);
+      let payload = frame.subarray(HEADER_BYTES);
+
+      if( version !== PROTOCOL_VERSION ) {
+         this.onError("Unsupported protocol version " + version + " from the C mining application.");
+         return;
+      }
+
+      switch( type ) {
+         case FrameType.THREADS:
+            this.onMessage({ type: "threads", threads: payload.readUInt32BE(0) });
+            break;
+         case FrameType.HASH_REPORT: {
+            let threads = payload.readUInt32BE(24);
+            let threadRates = [];
+            for( let t = 0; t < threads; t++ )
+               threadRates.push(Number(payload.readBigUInt64BE(28 + 8 * t)));
+            this.onMessage({
+               type: "hashReport",
+               id: id,
+               time: Number(payload.readBigUInt64BE(0)),
+               hashes: Number(payload.readBigUInt64BE(8)),
+               rate: Number(payload.readBigUInt64BE(16)),
+               threadRates: threadRates });
+            break;
+         }
+         case FrameType.NONCE:
+            this.onMessage({ type: "nonce", id: id, nonce: BigInt("0x" + payload.subarray(0, FIELD_BYTES).toString("hex")) });
+            break;
+         case FrameType.FINISHED:
+            this.onMessage({ type: "finished", id: id });
+            break;
+         case FrameType.PREEMPTED:
+            this.onMessage({ type: "preempted", id: id, hashes: Number(payload.readBigUInt64BE(0)) });
+            break;
+         case FrameType.SHARE:
+         case FrameType.BEST:
+            this.onMessage({
+               type: type === FrameType.SHARE ? "share" : "best",
+               id: id,
+               nonce: BigInt("0x" + payload.subarray(0, FIELD_BYTES).toString("hex")),
+               result: BigInt("0x" + payload.subarray(FIELD_BYTES, 2 * FIELD_BYTES).toString("hex")) });
+            break;
+         default:
+            this.onError("Unrecognized frame type " + type + " from the C mining application.");
+      }
+   }
+}
+
+class TextDecoder {
+   constructor( onMessage, onError ) {
+      this.onMessage = onMessage;
+      this.onError = onError;
+      this.pending = "";
+   }
+
+   push( chunk ) {
+      this.pending += chunk.toString();
+      let lines = this.pending.split("\n");
+      this.pending = lines.pop();
+      for( let i = 0; i < lines.length; i++ ) {
+         if( lines[i].length )
+            this.decode(lines[i]);
+      }
+   }
+
+   decode( line ) {
+      let value = line.substring(2, line.indexOf(";"));
+      switch( line.substring(0, 2) ) {
+         case "T:":
+            this.onMessage({ type: "threads", threads: parseInt(value) });
+            break;
+         case "H:": {
+            let ret = value.split(" ");
+            this.onMessage({
+               type: "hashReport",
+               time: Date.parse(ret[0]),
+               hashes: parseInt(ret[1]),
+               rate: parseFloat(ret[2]),
+               threadRates: ret.length > 3 ? ret[3].split(",").map(parseFloat) : [] });
+            break;
+         }
+         case "N:":
+            this.onMessage({ type: "nonce", nonce: BigInt("0x" + value) });
+            break;
+         case "F:":
+            this.onMessage({ type: "finished" });
+            break;
+         case "P:":
+            this.onMessage({ type: "preempted", hashes: parseInt(value) });
+            break;
+         case "S:":
+         case "B:": {
+            let ret = value.split(" ");
+            this.onMessage({
+               type: line.startsWith("S:") ? "share" : "best",
+               nonce: BigInt("0x" + ret[0]),
+               result: BigInt("0x" + ret[1]) });
+            break;
+         }
+         default:
+            this.onError("Unrecognized response from the C mining application.");
+      }
+   }
+}
+
+module.exports = {
+   PROTOCOL_VERSION : PROTOCOL_VERSION,
+   FrameType : FrameType,
+   RequestFlags : RequestFlags,
+   fieldToBuffer : fieldToBuffer,
+   encodeRequest : encodeRequest,
+   encodeHint : encodeHint,
+   encodeWeight : encodeWeight,
+   encodeTextRequest : encodeTextRequest,
+   encodeTextHint : encodeTextHint,
+   encodeTextWeight : encodeTextWeight,
+   PipeTransport : PipeTransport,
+   BinaryDecoder : BinaryDecoder,
+   TextDecoder : TextDecoder
+   };
@@ -0,0 +1,188 @@
+#include "bn.h"
+#include "test.h"
+
+#include <string.h>
+
+/*
+ * Built once per limb size, see CMakeLists.txt. The known answers are the same for
+ * every WORD_SIZE, computed with arbitrary precision integers mod 2^256.
+ */
+static const char* A = "8f3a1c2d4e5f60718293a4b5c6d7e8f90a1b2c3d4e5f60718293a4b5c6d7e8f9";
+static const char* B = "000000000000000000000000000000001c2d3e4f5a6b7c8d9eafb0c1d2e3f405";
+static const char* C = "00000000fedcba9876543210ffffffffffffffff0123456789abcdef00000001";
+
+static void from_hex( struct bn* n, const char* hex )
+{
+   char copy[65];
+   strcpy( copy, hex );
+   bignum_from_string( n, copy, 64 );
+}
+
+static bool equals_hex( struct bn* n, const char* hex )
+{
+   char str[78];
+   bignum_to_string( n, str, sizeof(str), true );
+   return strcmp( str, hex ) == 0;
+}
+
+static void test_known_answers()
+{
+   struct bn a, b, c, r, q, three, hundred;
+   from_hex( &a, A );
+   from_hex( &b, B );
+   from_hex( &c, C );
+
+   CHECK( equals_hex( &a, A ) );
+
+   bignum_add( &a, &b, &r );
+   CHECK( equals_hex( &r, "8f3a1c2d4e5f60718293a4b5c6d7e8f926486a8ca8cadcff2143557799bbdcfe" ) );
+   bignum_sub( &b, &a, &r );
+   CHECK( equals_hex( &r, "70c5e3d2b1a09f8e7d6c5b4a39281707121212120c0c1c1c1c1c0c0c0c0c0b0c" ) );
+   bignum_mul( &a, &b, &r );
+   CHECK( equals_hex( &r, "00c456b302f0bc052c31245564511cc6478c24efd0ec3afab954bb5b830fe0dd" ) );
+   bignum_mul( &a, &c, &r );
+   CHECK( equals_hex( &r, "8f3a1c2d444fb3d4e72f006db059e14588a9b9bac3a5ed75eb088a2cc6d7e8f9" ) );
+
+   bignum_div( &a, &b, &r );
+   CHECK( equals_hex( &r, "00000000000000000000000000000005154a55bec4b380645f9277d9ad4b2e10" ) );
+   bignum_mod( &a, &b, &r );
+   CHECK( equals_hex( &r, "00000000000000000000000000000000186b12af6d1b50518206c4c6c448c2a9" ) );
+   bignum_divmod( &a, &c, &q, &r );
+   CHECK( equals_hex( &q, "000000000000000000000000000000000000000000000000000000008fddcc4d" ) );
+   CHECK( equals_hex( &r, "00000000819293a41bae0998c6d7e8f99955486a1b2c2d3ee9793fd236fa1cac" ) );
+
+   bignum_and( &a, &c, &r );
+   CHECK( equals_hex( &r, "000000004e5c201002102010c6d7e8f90a1b2c3d00034061808384a500000001" ) );
+   bignum_or( &a, &c, &r );
+   CHECK( equals_hex( &r, "8f3a1c2dfedffaf9f6d7b6b5ffffffffffffffff4f7f65778bbbedffc6d7e8f9" ) );
+   bignum_xor( &a, &c, &r );
+   CHECK( equals_hex( &r, "8f3a1c2db083dae9f4c796a539281706f5e4d3c24f7c25160b38695ac6d7e8f8" ) );
+   bignum_fast_xor( &a, &c, &r );
+   CHECK( equals_hex( &r, "8f3a1c2db083dae9f4c796a539281706f5e4d3c24f7c25160b38695ac6d7e8f8" ) );
+
+   bignum_lshift( &a, &r, 37 );
+   CHECK( equals_hex( &r, "cbec0e30527496b8dafd1f21436587a9cbec0e30527496b8dafd1f2000000000" ) );
+   bignum_lshift( &a, &r, 130 );
+   CHECK( equals_hex( &r, "286cb0f5397d81c60a4e92d71b5fa3e400000000000000000000000000000000" ) );
+   bignum_rshift( &a, &r, 37 );
+   CHECK( equals_hex( &r, "000000000479d0e16a72fb038c149d25ae36bf47c850d961ea72fb038c149d25" ) );
+   bignum_rshift( &a, &r, 200 );
+   CHECK( equals_hex( &r, "000000000000000000000000000000000000000000000000008f3a1c2d4e5f60" ) );
+
+   // The square root squares its guesses mod 2^256, it is only exact below 2^129
+   bignum_isqrt( &b, &r );
+   CHECK( equals_hex( &r, "00000000000000000000000000000000000000000000000054ee49ea6979a9f5" ) );
+   bignum_from_int( &three, 3 );
+   bignum_from_int( &hundred, 100 );
+   bignum_pow( &three, &hundred, &r );
+   CHECK( equals_hex( &r, "0000000000000000000000005a4653ca673768565b41f775d6947d55cf3813d1" ) );
+
+   r = a;
+   bignum_endian_swap( &r );
+   CHECK( equals_hex( &r, "f9e8d7c6b5a4938271605f4e3d2c1b0af9e8d7c6b5a4938271605f4e2d1c3a8f" ) );
+
+   CHECK( bignum_cmp( &a, &b ) == LARGER );
+   CHECK( bignum_cmp( &b, &a ) == SMALLER );
+   CHECK( bignum_cmp( &a, &a ) == EQUAL );
+   CHECK( bignum_fast_cmp( &a, &b ) > 0 );
+   CHECK( bignum_fast_cmp( &b, &a ) < 0 );
+   CHECK( bignum_fast_cmp( &a, &a ) == 0 );
+}
+
+// Carries and borrows through every limb, whatever its size
+static void test_carries()
+{
+   struct bn n, fast, one;
+   from_hex( &n, "00000000000000000000000000000000ffffffffffffffffffffffffffffffff" );
+   fast = n;
+   bignum_inc( &n );
+   bignum_fast_inc( &fast );
+   CHECK( equals_hex( &n, "0000000000000000000000000000000100000000000000000000000000000000" ) );
+   CHECK( bignum_cmp( &n, &fast ) == EQUAL );
+   bignum_dec( &n );
+   CHECK( equals_hex( &n, "00000000000000000000000000000000ffffffffffffffffffffffffffffffff" ) );
+
+   // All ones wraps to zero
+   from_hex( &n, "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff" );
+   bignum_from_int( &one, 1 );
+   bignum_add( &n, &one, &n );
+   CHECK( bignum_is_zero( &n ) );
+   bignum_dec( &n );
+   CHECK( equals_hex( &n, "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff" ) );
+
+   bignum_from_int( &n, (DTYPE_TMP)0xfedcba9876543210ull );
+   CHECK( equals_hex( &n, "000000000000000000000000000000000000000000000000fedcba9876543210" ) );
+   bignum_from_int( &n, 123456 );
+   CHECK( bignum_to_int( &n ) == 123456 );
+}
+
+// Identities that tie the operations to each other on random operands
+static void test_identities()
+{
+   uint64_t state = 10;
+
+   for( int i = 0; i < 2000; i++ )
+   {
+      struct bn a, b, q, r, t, u;
+      for( int k = 0; k < BN_ARRAY_SIZE; k++ )
+      {
+         a.array[k] = (DTYPE)test_random( &state );
+         b.array[k] = (DTYPE)test_random( &state );
+      }
+      // Divisors of every length, never zero
+      bignum_rshift( &b, &b, (int)(test_random( &state ) % 255) );
+      if( bignum_is_zero( &b ) )
+         bignum_inc( &b );
+
+      bignum_add( &a, &b, &t );
+      bignum_sub( &t, &b, &u );
+      CHECK( bignum_cmp( &u, &a ) == EQUAL );
+
+      bignum_mul( &a, &b, &t );
+      bignum_mul( &b, &a, &u );
+      CHECK( bignum_cmp( &t, &u ) == EQUAL );
+
+      bignum_divmod( &a, &b, &q, &r );
+      CHECK( bignum_cmp( &r, &b ) == SMALLER );
+      bignum_mul( &q, &b, &t );
+      bignum_add( &t, &r, &u );
+      CHECK( bignum_cmp( &u, &a ) == EQUAL );
+
+      bignum_div( &a, &b, &t );
+      CHECK( bignum_cmp( &t, &q ) == EQUAL );
+      bignum_mod( &a, &b, &t );
+      CHECK( bignum_cmp( &t, &r ) == EQUAL );
+
+      int bits = (int)(test_random( &state ) % 256);
+      struct bn power, one;
+      bignum_from_int( &one, 1 );
+      bignum_lshift( &one, &power, bits );
+      bignum_lshift( &a, &t, bits );
+      bignum_mul( &a, &power, &u );
+      CHECK( bignum_cmp( &t, &u ) == EQUAL );
+      bignum_rshift( &a, &t, bits );
+      bignum_div( &a, &power, &u );
+      CHECK( bignum_cmp( &t, &u ) == EQUAL );
+
+      bignum_fast_xor( &a, &b, &t );
+      bignum_xor( &a, &b, &u );
+      CHECK( bignum_cmp( &t, &u ) == EQUAL );
+      CHECK( (bignum_fast_cmp( &a, &b ) > 0) == (bignum_cmp( &a, &b ) == LARGER) );
+
+      t = a;
+      bignum_endian_swap( &t );
+      bignum_endian_swap( &t );
+      CHECK( bignum_cmp( &t, &a ) == EQUAL );
+   }
+}
+
+int main()
+{
+   printf("Limb size: %d bytes\n", WORD_SIZE);
+
+   test_known_answers();
+   test_carries();
+   test_identities();
+
+   return TEST_RESULT();
+}
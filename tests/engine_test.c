@@ -0,0 +1,162 @@
+#include "engine.h"
+#include "test.h"
+
+#include <string.h>
+
+/*
+ * Jobs through the whole engine, from set_job() to search_job(), against the answers
+ * of the original miner on the same requests. Run with the thread count as argument: a
+ * single thread finds the same nonce, with more any valid proof may win the race.
+ */
+struct known_answer
+{
+   const char* tip_address;
+   const char* block_hash;
+   uint64_t    block_num;
+   const char* target;
+   uint64_t    pow_height;
+   uint64_t    thread_iterations;
+   uint64_t    hash_limit;
+   const char* nonce_offset;
+   const char* nonce;         // NULL when every nonce is searched without a proof
+};
+
+static const struct known_answer known_answers[] =
+{
+   {
+      "000000000000000000000000292b59941ae124acfca9a759892ae5ce246eaad2",
+      "1a2b3c4d5e6f708192a3b4c5d6e7f8091a2b3c4d5e6f708192a3b4c5d6e7f809", 11000000,
+      "003fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff", 1, 7, 100000,
+      "0000000000000000000000000000000000000000000000000000000000001234",
+      "1a2b3c4d5e6f708192a3b4c5d6e7f8091a2b3c4d5e6f708192a3b4c5d6e80ad5"
+   },
+   {
+      "000000000000000000000000292b59941ae124acfca9a759892ae5ce246eaad2",
+      "1a2b3c4d5e6f708192a3b4c5d6e7f8091a2b3c4d5e6f708192a3b4c5d6e7f809", 11000000,
+      "00000000ffffffffffffffffffffffffffffffffffffffffffffffffffffffff", 1, 1000, 20000,
+      "0000000000000000000000000000000000000000000000000000000000001234",
+      NULL
+   },
+   {
+      "000000000000000000000000407a73626697fd22b1717d294e6b39437531013d",
+      "fedcba9876543210fedcba9876543210fedcba9876543210fedcba9876543210", 11000001,
+      "0000ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff", 2, 5000, 2000000,
+      "00000000000000000000000000000000ffffffffffffffffffffffffffffff00",
+      "fedcba9876543210fedcba9876543211fedcba9876543210fedcba987655dc05"
+   }
+};
+
+static void from_hex( struct bn* n, const char* hex )
+{
+   char copy[65];
+   strcpy( copy, hex );
+   bignum_from_string( n, copy, 64 );
+}
+
+static void job_from_answer( struct miner_job* job, const struct known_answer* ka )
+{
+   memset( job, 0, sizeof(*job) );
+   from_hex( &job->miner_address, "00000000000000000000000098047645bf61644caa0c24daabd118cc1d640f62" );
+   from_hex( &job->tip_address, ka->tip_address );
+   from_hex( &job->block_hash, ka->block_hash );
+   from_hex( &job->target, ka->target );
+   from_hex( &job->nonce_offset, ka->nonce_offset );
+   job->block_num = ka->block_num;
+   job->tip = 500;
+   job->pow_height = ka->pow_height;
+   job->thread_iterations = ka->thread_iterations;
+   job->hash_limit = ka->hash_limit;
+   bignum_init( &job->share_target );
+}
+
+// The nonce found for ka is its known answer, or with several threads any proof in its ranges
+static void check_proof( struct miner_engine* engine, int slot, const struct known_answer* ka, struct bn* nonce )
+{
+   struct bn expected;
+   from_hex( &expected, ka->nonce );
+   if( engine->threads == 1 )
+   {
+      CHECK( bignum_cmp( nonce, &expected ) == EQUAL );
+      return;
+   }
+
+   struct job_slot* s = &engine->slots[slot];
+   struct bn result, offset, searched;
+   work( &result, &s->secured_struct_hash, nonce, engine->word_buffer );
+   CHECK( bignum_cmp( &result, &s->job.target ) <= 0 );
+   CHECK( words_are_unique( &s->secured_struct_hash, nonce, engine->word_buffer ) );
+
+   // Ranges are claimed up to an offset of hash_limit
+   bignum_from_int( &searched, (ka->hash_limit / ka->thread_iterations + 1) * ka->thread_iterations );
+   CHECK( bignum_cmp( nonce, &s->nonce ) >= 0 );
+   bignum_sub( nonce, &s->nonce, &offset );
+   CHECK( bignum_cmp( &offset, &searched ) < 0 );
+}
+
+static void test_known_answers( struct miner_engine* engine )
+{
+   for( size_t k = 0; k < sizeof(known_answers) / sizeof(known_answers[0]); k++ )
+   {
+      const struct known_answer* ka = known_answers + k;
+      struct miner_job job;
+      struct bn nonce;
+      int slot = -1;
+
+      job_from_answer( &job, ka );
+      set_job( engine, &job );
+      enum engine_status status = search_job( engine, &nonce, &slot );
+      CHECK( slot == 0 );
+
+      if( ka->nonce )
+      {
+         CHECK( status == ENGINE_FOUND );
+         check_proof( engine, 0, ka, &nonce );
+      }
+      else
+      {
+         CHECK( status == ENGINE_FINISHED );
+         // As in the original miner
+         CHECK( engine_hashes( engine, 0 ) == (ka->hash_limit / ka->thread_iterations + 1) * ka->thread_iterations );
+      }
+   }
+}
+
+// A cancel before the search stops it, and set_job() clears it
+static void test_cancel( struct miner_engine* engine )
+{
+   struct miner_job job;
+   struct bn nonce;
+   int slot = -1;
+
+   job_from_answer( &job, known_answers );
+   set_job( engine, &job );
+   cancel_search( engine );
+   CHECK( search_job( engine, &nonce, &slot ) == ENGINE_CANCELLED );
+
+   set_job( engine, &job );
+   CHECK( search_job( engine, &nonce, &slot ) == ENGINE_FOUND );
+   check_proof( engine, 0, known_answers, &nonce );
+}
+
+int main( int argc, char** argv )
+{
+   struct engine_options opts;
+   struct miner_engine engine;
+
+   // One engine per process, without a reporter or disk cache
+   default_engine_options( &opts );
+   opts.report_interval_ms = 0;
+   opts.topology = TOPOLOGY_OFF;
+   opts.threads = argc > 1 ? atoi( argv[1] ) : 1;
+   opts.buffer_count = 2;
+
+   CHECK( init_engine( &engine, &opts ) );
+   if( test_failures )
+      return TEST_RESULT();
+
+   test_known_answers( &engine );
+   test_cancel( &engine );
+
+   release_engine( &engine );
+   return TEST_RESULT();
+}
@@ -0,0 +1,146 @@
+#include "bn.h"
+#include "work.h"
+#include "test.h"
+
+#define RANDOM_VALUES 1000000
+
+// Division based references of the fast reductions in work.h
+static uint32_t word_index_by_division( uint32_t x, const uint32_t* coefficients )
+{
+   uint64_t y = 0;
+   for( int j = WORK_COEFFICIENTS - 1; j >= 0; j-- )
+      y = (y * x + coefficients[j]) % WORD_INDEX_MODULUS;
+   return (uint32_t)y;
+}
+
+static void random_bignum( uint64_t* state, struct bn* n )
+{
+   for( int i = 0; i < BN_ARRAY_SIZE; i++ )
+      n->array[i] = (DTYPE)test_random( state );
+}
+
+static void test_mod_word_index( uint64_t* state )
+{
+   // Multiples of the modulus and the top of the range carry out of every digit
+   for( uint64_t k = 0; k < 8; k++ )
+   {
+      uint64_t edges[] = { k * WORD_INDEX_MODULUS, k * WORD_INDEX_MODULUS + 1, (UINT64_C(1) << 48) - 1 - k };
+      for( int e = 0; e < 3; e++ )
+         CHECK( mod_word_index( edges[e] ) == edges[e] % WORD_INDEX_MODULUS );
+   }
+
+   for( int i = 0; i < RANDOM_VALUES; i++ )
+   {
+      uint64_t y = test_random( state ) >> 16;
+      CHECK( mod_word_index( y ) == y % WORD_INDEX_MODULUS );
+   }
+}
+
+static void test_fastmod( uint64_t* state )
+{
+   for( int j = 0; j < SAMPLE_INDICES; j++ )
+   {
+      uint32_t d = coprimes[j];
+      CHECK( fastmod_u32( 0xffffffff, coprime_magic[j], d ) == 0xffffffff % d );
+      for( int i = 0; i < RANDOM_VALUES / SAMPLE_INDICES; i++ )
+      {
+         uint32_t a = (uint32_t)test_random( state );
+         CHECK( fastmod_u32( a, coprime_magic[j], d ) == a % d );
+      }
+   }
+
+   // Any divisor under 2^16, not only the coprimes
+   for( int i = 0; i < RANDOM_VALUES; i++ )
+   {
+      uint32_t d = 2 + (uint32_t)(test_random( state ) % 0xfffe);
+      uint64_t magic = UINT64_C(0xFFFFFFFFFFFFFFFF) / d + 1;
+      uint32_t a = (uint32_t)test_random( state );
+      CHECK( fastmod_u32( a, magic, d ) == a % d );
+   }
+}
+
+static void test_bignum_mod( uint64_t* state )
+{
+   for( int i = 0; i < RANDOM_VALUES / 100; i++ )
+   {
+      struct bn b, divisor, remainder;
+      random_bignum( state, &b );
+      // Small values too, where the leading limbs are zero
+      if( i % 4 == 0 )
+         bignum_rshift( &b, &b, (int)(test_random( state ) % 256) );
+
+      for( int j = 0; j < SAMPLE_INDICES; j++ )
+      {
+         bignum_from_int( &divisor, coprimes[j] );
+         bignum_mod( &b, &divisor, &remainder );
+         CHECK( bignum_mod_coprime( &b, j ) == (uint32_t)bignum_to_int( &remainder ) );
+         CHECK( bignum_mod_small( &b, coprimes[j] ) == (uint32_t)bignum_to_int( &remainder ) );
+      }
+   }
+}
+
+static void test_word_index( uint64_t* state )
+{
+   for( int i = 0; i < RANDOM_VALUES / 10; i++ )
+   {
+      uint32_t coefficients[WORK_COEFFICIENTS];
+      uint32_t x = (uint32_t)(test_random( state ) % WORD_INDEX_MODULUS);
+      for( int j = 0; j < WORK_COEFFICIENTS; j++ )
+         coefficients[j] = 1 + (uint32_t)(test_random( state ) % coprimes[j]);
+      CHECK( word_index( x, coefficients ) == word_index_by_division( x, coefficients ) );
+   }
+}
+
+// Stepping the nonce state must land where rebuilding it from the nonce does
+static void test_nonce_state( uint64_t* state )
+{
+   struct bn secured_struct_hash, nonce, start;
+   struct work_data wdata;
+   struct nonce_state stepped, advanced, rebuilt;
+
+   random_bignum( state, &secured_struct_hash );
+   init_work_data( &wdata, &secured_struct_hash );
+
+   // Close to a wrap of the low limb, which rebuilds the state
+   random_bignum( state, &start );
+   start.array[0] = MAX_VAL - 70000;
+   nonce = start;
+   init_nonce_state( &stepped, &wdata, &nonce );
+
+   for( int i = 1; i <= 140000; i++ )
+   {
+      next_nonce( &nonce, &stepped, &wdata );
+      if( i % 997 == 0 || nonce.array[0] < 2 )
+      {
+         init_nonce_state( &rebuilt, &wdata, &nonce );
+         CHECK( memcmp( &stepped, &rebuilt, sizeof(rebuilt) ) == 0 );
+      }
+   }
+
+   nonce = start;
+   nonce.array[0] = 12345;
+   init_nonce_state( &advanced, &wdata, &nonce );
+   for( uint32_t count = 1; count < 0xffd1; count = count * 3 + 1 )
+   {
+      advance_nonce_state( &advanced, &wdata, count );
+      bignum_add_small( &nonce, count );
+      init_nonce_state( &rebuilt, &wdata, &nonce );
+      CHECK( memcmp( &advanced, &rebuilt, sizeof(rebuilt) ) == 0 );
+   }
+}
+
+int main()
+{
+   uint64_t state = 6;
+
+   init_work_constants();
+   CHECK( verify_fast_reductions() );
+
+   test_mod_word_index( &state );
+   test_fastmod( &state );
+   test_bignum_mod( &state );
+   test_word_index( &state );
+   test_nonce_state( &state );
+
+   return TEST_RESULT();
+}
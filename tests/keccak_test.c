@@ -0,0 +1,150 @@
+#include "keccak256.h"
+#include "test.h"
+
+#include <string.h>
+
+#define MAX_LANES 8
+
+struct known_answer
+{
+   const char* message;   // NULL for the generated message of the given size
+   uint16_t    size;
+   const char* digest;
+};
+
+// Published Keccak-256 digests, and the sizes around the 136 byte rate
+static const struct known_answer known_answers[] =
+{
+   { "", 0, "c5d2460186f7233c927e7db2dcc703c0e500b653ca82273b7bfad8045d85a470" },
+   { "abc", 3, "4e03657aea45a94fc7d47ba826c8d667c0d1e6e33a64a036ec44f58fa12d6c45" },
+   { "The quick brown fox jumps over the lazy dog", 43, "4d741b6f1eb29cb2a9b9911c82f56fa8d73b04959d3d9d222895df6c0b28aa15" },
+   { NULL, 135, "34bd7bed52ea092f88bc887256e7f06500ee814afa9a5566e22030af2ef1c5c0" },
+   { NULL, 136, "2b31811a93dfc4bdc41b6aa7790e784b987c25a2c8a0e101cfa694552dc8ae39" },
+   { NULL, 137, "a6103b089a404974c2b460048bfddd45108748fbdd9bad451f54d1fe95f8f284" },
+   { NULL, 300, "c679632f366575cf2a1dad1f4a5de16e09def44390e346ad45cca63f4509c93f" }
+};
+
+static void keccak256( unsigned char* digest, const unsigned char* msg, uint16_t size )
+{
+   SHA3_CTX ctx;
+   keccak_init( &ctx );
+   keccak_update( &ctx, msg, size );
+   keccak_final( &ctx, digest );
+}
+
+static void to_hex( char* dest, const unsigned char* bytes, int count )
+{
+   for( int i = 0; i < count; i++ )
+      sprintf( dest + 2 * i, "%02x", bytes[i] );
+}
+
+static void test_known_answers()
+{
+   unsigned char generated[300];
+   for( int i = 0; i < (int)sizeof(generated); i++ )
+      generated[i] = (unsigned char)(i * 7 + 1);
+
+   for( size_t k = 0; k < sizeof(known_answers) / sizeof(known_answers[0]); k++ )
+   {
+      const struct known_answer* ka = known_answers + k;
+      const unsigned char* msg = ka->message ? (const unsigned char*)ka->message : generated;
+      unsigned char digest[32];
+      char hex[65];
+
+      keccak256( digest, msg, ka->size );
+      to_hex( hex, digest, 32 );
+      CHECK( strcmp( hex, ka->digest ) == 0 );
+
+      // Fed in pieces, the buffered path must agree
+      SHA3_CTX ctx;
+      keccak_init( &ctx );
+      for( uint16_t done = 0; done < ka->size; done += 13 )
+         keccak_update( &ctx, msg + done, ka->size - done < 13 ? ka->size - done : 13 );
+      keccak_final( &ctx, digest );
+      to_hex( hex, digest, 32 );
+      CHECK( strcmp( hex, ka->digest ) == 0 );
+   }
+}
+
+// The selected multi-buffer kernels against the scalar context, on every lane count up to a full batch and beyond
+static void test_kernels()
+{
+   static const uint16_t sizes[] = { 0, 32, 64, 135, 136, 137, 200 };
+   uint64_t state = 1;
+
+   for( size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++ )
+   {
+      for( unsigned n = 1; n <= 2 * MAX_LANES + 1; n++ )
+      {
+         unsigned char msgs[2 * MAX_LANES + 1][200];
+         unsigned char results[2 * MAX_LANES + 1][32];
+         const unsigned char* msg_ptrs[2 * MAX_LANES + 1];
+         unsigned char* result_ptrs[2 * MAX_LANES + 1];
+
+         for( unsigned i = 0; i < n; i++ )
+         {
+            test_random_bytes( &state, msgs[i], sizes[s] );
+            msg_ptrs[i] = msgs[i];
+            result_ptrs[i] = results[i];
+         }
+         keccak256_xN( result_ptrs, msg_ptrs, sizes[s], n );
+
+         for( unsigned i = 0; i < n; i++ )
+         {
+            unsigned char expected[32];
+            keccak256( expected, msgs[i], sizes[s] );
+            CHECK( memcmp( results[i], expected, 32 ) == 0 );
+         }
+      }
+   }
+
+   // H(seed || be256(index)) for consecutive indices, across a carry out of the low byte
+   unsigned char seed[32];
+   test_random_bytes( &state, seed, sizeof(seed) );
+   for( unsigned n = 1; n <= 2 * MAX_LANES + 1; n++ )
+   {
+      uint64_t first_index = 0xfffffff8ull + n;
+      unsigned char results[(2 * MAX_LANES + 1) * 32];
+      keccak256_64B( results, seed, first_index, n );
+
+      for( unsigned i = 0; i < n; i++ )
+      {
+         unsigned char msg[64] = { 0 }, expected[32];
+         uint64_t index = first_index + i;
+         memcpy( msg, seed, 32 );
+         for( int b = 0; b < 8; b++ )
+            msg[63 - b] = (unsigned char)(index >> (8 * b));
+         keccak256( expected, msg, sizeof(msg) );
+         CHECK( memcmp( results + 32 * i, expected, 32 ) == 0 );
+      }
+   }
+}
+
+int main()
+{
+   test_known_answers();
+
+   // Every kernel this cpu runs, not only the one selected for it
+   const char* preferred = NULL;
+   for( unsigned k = 0; keccak_kernel_name_at( k ); k++ )
+   {
+      const char* name = keccak_kernel_name_at( k );
+      if( !keccak_select_kernel_named( name ) )
+      {
+         printf("Keccak kernel: %s (not supported)\n", name);
+         continue;
+      }
+      if( !preferred )
+         preferred = name;
+      CHECK( strcmp( keccak_kernel_name(), name ) == 0 );
+      CHECK( keccak_kernel_lanes() <= MAX_LANES );
+      printf("Keccak kernel: %s (%u lanes)\n", keccak_kernel_name(), keccak_kernel_lanes());
+      test_kernels();
+   }
+   CHECK( !keccak_select_kernel_named( "none" ) );
+
+   keccak_select_kernel();
+   CHECK( preferred && strcmp( keccak_kernel_name(), preferred ) == 0 );
+
+   return TEST_RESULT();
+}
@@ -0,0 +1,369 @@
+#include "protocol.h"
+#include "engine.h"
+#include "test.h"
+
+#include <string.h>
+#include <time.h>
+
+/*
+ * Both encodings of protocol.c on golden frames, the same ones protocol_test.js checks
+ * the wrapper's encoder and decoder against, so the two ends cannot drift apart.
+ */
+
+// encodeRequest( 0x01020304, ... ) of protocol_test.js, with a weight, the join flag and a share target
+static const char* REQUEST_FRAME =
+   "000000f80101000001020304"
+   "00000000000000000000000098047645bf61644caa0c24daabd118cc1d640f62"
+   "000000000000000000000000292b59941ae124acfca9a759892ae5ce246eaad2"
+   "1a2b3c4d5e6f708192a3b4c5d6e7f8091a2b3c4d5e6f708192a3b4c5d6e7f809"
+   "003fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"
+   "0000000000000000000000000000000000000000000000000000000000001234"
+   "0000000000a7d8c0" "00000000000001f4" "0000000000000002" "0000000000000007" "00000000000186a0"
+   "00000003" "00000001"
+   "0000ffff00000000000000000000000000000000000000000000000000000000";
+
+static const char* HINT_FRAME =
+   "000000280102000000000000"
+   "fedcba9876543210fedcba9876543210fedcba9876543210fedcba9876543210";
+
+static const char* WEIGHT_FRAME = "0000000c010300000000000700000000";
+
+static const char* TEXT_REQUEST =
+   "0x98047645bf61644caa0c24daabd118cc1d640f62 0x292B59941aE124acFca9a759892Ae5Ce246eaAD2 "
+   "0x1a2b3c4d5e6f708192a3b4c5d6e7f8091a2b3c4d5e6f708192a3b4c5d6e7f809 11000000 "
+   "0x003fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff 500 2 7 100000 "
+   "0x0000000000000000000000000000000000000000000000000000000000001234 3 1 "
+   "0x0000ffff00000000000000000000000000000000000000000000000000000000;\n";
+
+static const char* MINER_ADDRESS = "0x98047645bf61644caa0c24daabd118cc1d640f62";
+static const char* TIP_ADDRESS = "0x292b59941ae124acfca9a759892ae5ce246eaad2";
+static const char* BLOCK_HASH = "0x1a2b3c4d5e6f708192a3b4c5d6e7f8091a2b3c4d5e6f708192a3b4c5d6e7f809";
+static const char* TARGET = "0x003fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff";
+static const char* NONCE_OFFSET = "0x0000000000000000000000000000000000000000000000000000000000001234";
+static const char* SHARE_TARGET = "0x0000ffff00000000000000000000000000000000000000000000000000000000";
+static const char* HINT_HASH = "0xfedcba9876543210fedcba9876543210fedcba9876543210fedcba9876543210";
+
+// The responses below, the 8 bytes at RESPONSE_TIME_OFFSET are the clock and left out
+static const char* NONCE = "1a2b3c4d5e6f708192a3b4c5d6e7f8091a2b3c4d5e6f708192a3b4c5d6e80ad5";
+static const char* RESULT = "00000000000000ff00000000000000000000000000000000000000000000abcd";
+
+static const char* RESPONSE_FRAMES =
+   "0000000c018100000000000000000003"
+   "0000003c0182000000000009" "0000000000000000" "0000001cbe991a14" "0000000000000bb9"
+   "00000003" "00000000000003e8" "00000000000007d1" "0000000000000000"
+   "000000480186000000000009"
+   "1a2b3c4d5e6f708192a3b4c5d6e7f8091a2b3c4d5e6f708192a3b4c5d6e80ad5"
+   "00000000000000ff00000000000000000000000000000000000000000000abcd"
+   "000000480187000000000009"
+   "1a2b3c4d5e6f708192a3b4c5d6e7f8091a2b3c4d5e6f708192a3b4c5d6e80ad5"
+   "00000000000000ff00000000000000000000000000000000000000000000abcd"
+   "000000280183000000000009"
+   "1a2b3c4d5e6f708192a3b4c5d6e7f8091a2b3c4d5e6f708192a3b4c5d6e80ad5"
+   "00000008018400000000000a"
+   "00000010018500000000000b" "0000000100000005";
+
+#define RESPONSE_TIME_OFFSET 28
+
+static size_t from_hex( unsigned char* bytes, const char* hex )
+{
+   size_t count = strlen( hex ) / 2;
+   for( size_t i = 0; i < count; i++ )
+      sscanf( hex + 2 * i, "%2hhx", bytes + i );
+   return count;
+}
+
+static void bignum_from_hex( struct bn* n, const char* hex )
+{
+   char copy[65];
+   strcpy( copy, hex );
+   bignum_from_string( n, copy, 64 );
+}
+
+// Writes a frame with its payload cut to payload_bytes, the length field to match
+static void write_frame( FILE* f, const char* hex, size_t payload_bytes )
+{
+   unsigned char frame[FRAME_MAX_BYTES];
+   size_t bytes = from_hex( frame, hex );
+   if( payload_bytes > bytes - FRAME_HEADER_BYTES )
+      payload_bytes = bytes - FRAME_HEADER_BYTES;
+
+   uint32_t length = FRAME_HEADER_BYTES - 4 + payload_bytes;
+   frame[0] = length >> 24;
+   frame[1] = length >> 16;
+   frame[2] = length >> 8;
+   frame[3] = length;
+   fwrite( frame, 1, FRAME_HEADER_BYTES + payload_bytes, f );
+}
+
+static void check_golden_request( struct input_data* d )
+{
+   CHECK( strcmp( d->block_hash, BLOCK_HASH ) == 0 );
+   CHECK( d->block_num == 11000000 );
+   CHECK( strcmp( d->difficulty_str, TARGET ) == 0 );
+   CHECK( d->tip == 500 );
+   CHECK( d->pow_height == 2 );
+   CHECK( d->thread_iterations == 7 );
+   CHECK( d->hash_limit == 100000 );
+   CHECK( strcmp( d->nonce_offset, NONCE_OFFSET ) == 0 );
+}
+
+static void test_binary_input()
+{
+   FILE* in = tmpfile();
+   struct channel ch;
+   struct input_data d;
+   CHECK( in != NULL );
+   if( !in )
+      return;
+
+   write_frame( in, REQUEST_FRAME, FRAME_MAX_BYTES );
+   write_frame( in, HINT_FRAME, FRAME_MAX_BYTES );
+   write_frame( in, WEIGHT_FRAME, FRAME_MAX_BYTES );
+   // The requests of older wrappers, without a share target and without a weight
+   write_frame( in, REQUEST_FRAME, 5 * FRAME_FIELD_BYTES + 5 * 8 + 2 * 4 );
+   write_frame( in, REQUEST_FRAME, 5 * FRAME_FIELD_BYTES + 5 * 8 );
+   // A request cut short is ignored, as are other versions and unknown types
+   write_frame( in, REQUEST_FRAME, 5 * FRAME_FIELD_BYTES );
+   {
+      unsigned char frame[FRAME_MAX_BYTES];
+      size_t bytes = from_hex( frame, HINT_FRAME );
+      frame[4] = PROTOCOL_VERSION + 1;
+      fwrite( frame, 1, bytes, in );
+      bytes = from_hex( frame, HINT_FRAME );
+      frame[5] = 0x7f;
+      fwrite( frame, 1, bytes, in );
+   }
+   write_frame( in, WEIGHT_FRAME, FRAME_MAX_BYTES );
+   // A request without thread iterations is rejected
+   {
+      unsigned char frame[FRAME_MAX_BYTES];
+      size_t bytes = from_hex( frame, REQUEST_FRAME );
+      memset( frame + FRAME_HEADER_BYTES + 5 * FRAME_FIELD_BYTES + 3 * 8, 0, 8 );
+      fwrite( frame, 1, bytes, in );
+   }
+   // A length under the header's, then a frame that must not be read
+   fwrite( "\x00\x00\x00\x03", 1, 4, in );
+   write_frame( in, HINT_FRAME, FRAME_MAX_BYTES );
+   rewind( in );
+
+   open_channel( &ch, in, NULL, PROTOCOL_BINARY );
+
+   memset( &d, 0, sizeof(d) );
+   CHECK( read_data( &ch, &d ) == INPUT_REQUEST );
+   CHECK( d.request_id == 0x01020304 );
+   CHECK( strcmp( d.miner_address, MINER_ADDRESS ) == 0 );
+   CHECK( strcmp( d.tip_address, TIP_ADDRESS ) == 0 );
+   check_golden_request( &d );
+   CHECK( d.weight == 3 );
+   CHECK( d.flags == REQUEST_JOIN );
+   CHECK( strcmp( d.share_target_str, SHARE_TARGET ) == 0 );
+
+   // The job parsed from the strings holds the values of the frame
+   {
+      struct miner_job job;
+      struct bn expected;
+      job_from_input( &job, &ch, &d );
+      CHECK( job.channel == &ch );
+      CHECK( job.request_id == 0x01020304 );
+      bignum_from_hex( &expected, "00000000000000000000000098047645bf61644caa0c24daabd118cc1d640f62" );
+      CHECK( bignum_cmp( &job.miner_address, &expected ) == EQUAL );
+      bignum_from_hex( &expected, "000000000000000000000000292b59941ae124acfca9a759892ae5ce246eaad2" );
+      CHECK( bignum_cmp( &job.tip_address, &expected ) == EQUAL );
+      bignum_from_hex( &expected, BLOCK_HASH + 2 );
+      CHECK( bignum_cmp( &job.block_hash, &expected ) == EQUAL );
+      bignum_from_hex( &expected, TARGET + 2 );
+      CHECK( bignum_cmp( &job.target, &expected ) == EQUAL );
+      bignum_from_hex( &expected, SHARE_TARGET + 2 );
+      CHECK( bignum_cmp( &job.share_target, &expected ) == EQUAL );
+      CHECK( bignum_to_int( &job.nonce_offset ) == 0x1234 );
+      CHECK( job.block_num == 11000000 );
+      CHECK( job.hash_limit == 100000 );
+   }
+
+   CHECK( read_data( &ch, &d ) == INPUT_HINT );
+   CHECK( strcmp( d.block_hash, HINT_HASH ) == 0 );
+
+   CHECK( read_data( &ch, &d ) == INPUT_WEIGHT );
+   CHECK( d.weight == 0 );
+   CHECK( d.request_id == 7 );
+
+   CHECK( read_data( &ch, &d ) == INPUT_REQUEST );
+   check_golden_request( &d );
+   CHECK( d.weight == 3 );
+   CHECK( d.flags == REQUEST_JOIN );
+   CHECK( d.share_target_str[0] == '\0' );
+
+   CHECK( read_data( &ch, &d ) == INPUT_REQUEST );
+   check_golden_request( &d );
+   CHECK( d.weight == 1 );
+   CHECK( d.flags == 0 );
+   CHECK( d.share_target_str[0] == '\0' );
+
+   // Skips the short request, the other version and the unknown type
+   CHECK( read_data( &ch, &d ) == INPUT_WEIGHT );
+   CHECK( d.request_id == 7 );
+
+   CHECK( read_data( &ch, &d ) == INPUT_INVALID );
+   CHECK( d.request_id == 0x01020304 );
+
+   CHECK( read_data( &ch, &d ) == INPUT_CLOSED );
+
+   close_channel( &ch );
+   fclose( in );
+}
+
+static void test_text_input()
+{
+   FILE* in = tmpfile();
+   struct channel ch;
+   struct input_data d;
+   CHECK( in != NULL );
+   if( !in )
+      return;
+
+   fputs( TEXT_REQUEST, in );
+   fprintf( in, "hint %s;\n", HINT_HASH );
+   fputs( "weight 2 5;\n", in );
+   fputs( "weight 4;\n", in );
+   // The ten fields of older wrappers, split over reads as a pipe may deliver them
+   fputs( "0x98047645bf61644caa0c24daabd118cc1d640f62 0x292b59941ae124acfca9a759892ae5ce246eaad2 ", in );
+   fprintf( in, "%s 11000000 %s 500 2 7 100000 %s;\n", BLOCK_HASH, TARGET, NONCE_OFFSET );
+   fprintf( in, "%s %s %s 11000000 %s 500 2 0 100000 %s;\n", MINER_ADDRESS, TIP_ADDRESS, BLOCK_HASH, TARGET, NONCE_OFFSET );
+   // A line without its ';' when the input ends
+   fputs( "weight 1", in );
+   rewind( in );
+
+   open_channel( &ch, in, NULL, PROTOCOL_TEXT );
+
+   memset( &d, 0, sizeof(d) );
+   CHECK( read_data( &ch, &d ) == INPUT_REQUEST );
+   CHECK( d.request_id == 1 );
+   CHECK( strcmp( d.miner_address, MINER_ADDRESS ) == 0 );
+   CHECK( strcmp( d.tip_address, "0x292B59941aE124acFca9a759892Ae5Ce246eaAD2" ) == 0 );
+   check_golden_request( &d );
+   CHECK( d.weight == 3 );
+   CHECK( d.flags == REQUEST_JOIN );
+   CHECK( strcmp( d.share_target_str, SHARE_TARGET ) == 0 );
+
+   CHECK( read_data( &ch, &d ) == INPUT_HINT );
+   CHECK( strcmp( d.block_hash, HINT_HASH ) == 0 );
+
+   CHECK( read_data( &ch, &d ) == INPUT_WEIGHT );
+   CHECK( d.weight == 2 );
+   CHECK( d.request_id == 5 );
+
+   CHECK( read_data( &ch, &d ) == INPUT_WEIGHT );
+   CHECK( d.weight == 4 );
+   CHECK( d.request_id == 0 );
+
+   CHECK( read_data( &ch, &d ) == INPUT_REQUEST );
+   CHECK( d.request_id == 2 );
+   CHECK( strcmp( d.tip_address, TIP_ADDRESS ) == 0 );
+   check_golden_request( &d );
+   CHECK( d.weight == 1 );
+   CHECK( d.flags == 0 );
+   CHECK( d.share_target_str[0] == '\0' );
+
+   // Rejected, though it takes up a request id
+   CHECK( read_data( &ch, &d ) == INPUT_INVALID );
+   CHECK( d.request_id == 3 );
+
+   CHECK( read_data( &ch, &d ) == INPUT_CLOSED );
+
+   close_channel( &ch );
+   fclose( in );
+}
+
+// Sends one of every response, as the engine would for requests 9, 10 and 11
+static void send_responses( struct channel* ch )
+{
+   struct bn nonce, result;
+   double rates[3] = { 1000.4, 2000.6, 0 };
+   bignum_from_hex( &nonce, NONCE );
+   bignum_from_hex( &result, RESULT );
+
+   send_thread_count( ch, 3 );
+   send_hash_report( ch, 9, 123456789012ull, 3001.0, rates, 3 );
+   send_share( ch, 9, &nonce, &result );
+   send_best( ch, 9, &nonce, &result );
+   send_nonce( ch, 9, &nonce );
+   send_finished( ch, 10 );
+   send_preempted( ch, 11, 4294967301ull );
+}
+
+static void test_binary_output()
+{
+   FILE* out = tmpfile();
+   struct channel ch;
+   unsigned char expected[FRAME_MAX_BYTES], sent[FRAME_MAX_BYTES];
+   CHECK( out != NULL );
+   if( !out )
+      return;
+
+   open_channel( &ch, NULL, out, PROTOCOL_BINARY );
+   uint64_t before = (uint64_t)time( NULL ) * 1000;
+   send_responses( &ch );
+   uint64_t after = (uint64_t)time( NULL ) * 1000 + 1000;
+   CHECK( !ch.failed );
+   close_channel( &ch );
+
+   size_t bytes = from_hex( expected, RESPONSE_FRAMES );
+   rewind( out );
+   CHECK( fread( sent, 1, sizeof(sent), out ) == bytes );
+
+   uint64_t ms = 0;
+   for( int i = 0; i < 8; i++ )
+      ms = (ms << 8) | sent[RESPONSE_TIME_OFFSET + i];
+   CHECK( ms >= before && ms <= after );
+
+   memset( sent + RESPONSE_TIME_OFFSET, 0, 8 );
+   CHECK( memcmp( sent, expected, bytes ) == 0 );
+
+   fclose( out );
+}
+
+static void test_text_output()
+{
+   FILE* out = tmpfile();
+   struct channel ch;
+   char line[256], expected[256];
+   CHECK( out != NULL );
+   if( !out )
+      return;
+
+   open_channel( &ch, NULL, out, PROTOCOL_TEXT );
+   send_responses( &ch );
+   CHECK( !ch.failed );
+   close_channel( &ch );
+   rewind( out );
+
+   CHECK( fgets( line, sizeof(line), out ) && strcmp( line, "T:3;\n" ) == 0 );
+
+   // The local time, then the totals and the per thread rates rounded
+   int year, month, day, hour, minute, second, end = 0;
+   CHECK( fgets( line, sizeof(line), out ) );
+   CHECK( sscanf( line, "H:%4d-%2d-%2dT%2d:%2d:%2d%n", &year, &month, &day, &hour, &minute, &second, &end ) == 6 );
+   CHECK( end == 21 && strcmp( line + end, " 123456789012 3001 1000,2001,0;\n" ) == 0 );
+
+   sprintf( expected, "S:%s %s;\n", NONCE, RESULT );
+   CHECK( fgets( line, sizeof(line), out ) && strcmp( line, expected ) == 0 );
+   sprintf( expected, "B:%s %s;\n", NONCE, RESULT );
+   CHECK( fgets( line, sizeof(line), out ) && strcmp( line, expected ) == 0 );
+   sprintf( expected, "N:%s;\n", NONCE );
+   CHECK( fgets( line, sizeof(line), out ) && strcmp( line, expected ) == 0 );
+   CHECK( fgets( line, sizeof(line), out ) && strcmp( line, "F:1;\n" ) == 0 );
+   CHECK( fgets( line, sizeof(line), out ) && strcmp( line, "P:4294967301;\n" ) == 0 );
+   CHECK( !fgets( line, sizeof(line), out ) );
+
+   fclose( out );
+}
+
+int main()
+{
+   test_binary_input();
+   test_text_input();
+   test_binary_output();
+   test_text_output();
+
+   return TEST_RESULT();
+}
@@ -0,0 +1,153 @@
+'use strict';
+
+/**
+ * The wrapper's side of the protocol on the golden frames of protocol_test.c, which
+ * checks the miner's side against the same bytes. Run by ctest when node is found.
+ */
+
+const assert = require("assert");
+const path = require("path");
+const protocol = require(path.join(__dirname, "..", "protocol.js"));
+
+const request = {
+   id: 0x01020304,
+   minerAddress: "0x98047645bf61644caa0c24daabd118cc1d640f62",
+   tipAddress: "0x292B59941aE124acFca9a759892Ae5Ce246eaAD2",
+   block: { hash: "0x1a2b3c4d5e6f708192a3b4c5d6e7f8091a2b3c4d5e6f708192a3b4c5d6e7f809", number: 11000000 },
+   difficulty: 0x003fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffn,
+   tipAmount: 500,
+   powHeight: 2,
+   threadIterations: 7,
+   hashLimit: 100000,
+   nonceOffset: "0x0000000000000000000000000000000000000000000000000000000000001234",
+   weight: 3,
+   join: true,
+   shareTarget: 0x0000ffff00000000000000000000000000000000000000000000000000000000n
+};
+
+const REQUEST_FRAME =
+   "000000f80101000001020304" +
+   "00000000000000000000000098047645bf61644caa0c24daabd118cc1d640f62" +
+   "000000000000000000000000292b59941ae124acfca9a759892ae5ce246eaad2" +
+   "1a2b3c4d5e6f708192a3b4c5d6e7f8091a2b3c4d5e6f708192a3b4c5d6e7f809" +
+   "003fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff" +
+   "0000000000000000000000000000000000000000000000000000000000001234" +
+   "0000000000a7d8c0" + "00000000000001f4" + "0000000000000002" + "0000000000000007" + "00000000000186a0" +
+   "00000003" + "00000001" +
+   "0000ffff00000000000000000000000000000000000000000000000000000000";
+
+const HINT_HASH = "0xfedcba9876543210fedcba9876543210fedcba9876543210fedcba9876543210";
+const HINT_FRAME = "000000280102000000000000" + HINT_HASH.substring(2);
+
+const TEXT_REQUEST =
+   "0x98047645bf61644caa0c24daabd118cc1d640f62 0x292B59941aE124acFca9a759892Ae5Ce246eaAD2 " +
+   "0x1a2b3c4d5e6f708192a3b4c5d6e7f8091a2b3c4d5e6f708192a3b4c5d6e7f809 11000000 " +
+   "0x003fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff 500 2 7 100000 " +
+   "0x0000000000000000000000000000000000000000000000000000000000001234 3 1 " +
+   "0x0000ffff00000000000000000000000000000000000000000000000000000000;\n";
+
+// The responses protocol_test.c sends, with the hash report's time set to 1600000000123
+const NONCE = 0x1a2b3c4d5e6f708192a3b4c5d6e7f8091a2b3c4d5e6f708192a3b4c5d6e80ad5n;
+const RESULT = 0x00000000000000ff00000000000000000000000000000000000000000000abcdn;
+const NONCE_HEX = NONCE.toString(16);
+const RESULT_HEX = RESULT.toString(16).padStart(64, "0");
+
+const RESPONSE_FRAMES =
+   "0000000c018100000000000000000003" +
+   "0000003c0182000000000009" + "00000174876e807b" + "0000001cbe991a14" + "0000000000000bb9" +
+   "00000003" + "00000000000003e8" + "00000000000007d1" + "0000000000000000" +
+   "000000480186000000000009" + NONCE_HEX + RESULT_HEX +
+   "000000480187000000000009" + NONCE_HEX + RESULT_HEX +
+   "000000280183000000000009" + NONCE_HEX +
+   "00000008018400000000000a" +
+   "00000010018500000000000b" + "0000000100000005";
+
+const RESPONSE_LINES =
+   "T:3;\n" +
+   "H:2020-09-13T12:26:40 123456789012 3001 1000,2001,0;\n" +
+   "S:" + NONCE_HEX + " " + RESULT_HEX + ";\n" +
+   "B:" + NONCE_HEX + " " + RESULT_HEX + ";\n" +
+   "N:" + NONCE_HEX + ";\n" +
+   "F:1;\n" +
+   "P:4294967301;\n";
+
+function testEncoding() {
+   assert.strictEqual(protocol.encodeRequest(request.id, request).toString("hex"), REQUEST_FRAME);
+   assert.strictEqual(protocol.encodeHint(HINT_HASH).toString("hex"), HINT_FRAME);
+   assert.strictEqual(protocol.encodeWeight(0, 7).toString("hex"), "0000000c010300000000000700000000");
+   assert.strictEqual(protocol.encodeWeight(2).toString("hex"), "0000000c010300000000000000000002");
+
+   let difficultyStr = "0x" + protocol.fieldToBuffer(request.difficulty).toString("hex");
+   assert.strictEqual(protocol.encodeTextRequest(request, difficultyStr), TEXT_REQUEST);
+   assert.strictEqual(protocol.encodeTextHint(HINT_HASH), "hint " + HINT_HASH + ";\n");
+   assert.strictEqual(protocol.encodeTextWeight(2, 5), "weight 2 5;\n");
+   assert.strictEqual(protocol.encodeTextWeight(4), "weight 4;\n");
+
+   // Without the job fields, a request is what older miners read
+   let plain = Object.assign({}, request, { weight: undefined, join: false, shareTarget: undefined });
+   assert.strictEqual(protocol.encodeTextRequest(plain, difficultyStr), TEXT_REQUEST.replace(/ 3 1 0x[0-9a-f]+;/, ";"));
+   let frame = protocol.encodeRequest(request.id, plain);
+   assert.strictEqual(frame.subarray(12 + 200, 12 + 208).toString("hex"), "0000000100000000");
+   assert.strictEqual(frame.subarray(12 + 208).toString("hex"), "0".repeat(64));
+
+   // A weight of 0 is kept, it starts the job paused
+   let paused = Object.assign({}, request, { weight: 0 });
+   assert.strictEqual(protocol.encodeRequest(request.id, paused).readUInt32BE(12 + 200), 0);
+}
+
+function decodeAll( decoder, chunks ) {
+   let messages = [], errors = [];
+   let d = new decoder(( m ) => messages.push(m), ( e ) => errors.push(e));
+   for( let i = 0; i < chunks.length; i++ )
+      d.push(chunks[i]);
+   assert.deepStrictEqual(errors, []);
+   return messages;
+}
+
+function checkResponses( messages, id ) {
+   // The text protocol has no ids and its hash reports only carry the local time
+   let ids = id ? { first: 9, finished: 10, preempted: 11 } : {};
+   let time = id ? 1600000000123 : Date.parse("2020-09-13T12:26:40");
+   assert.deepStrictEqual(messages, [
+      { type: "threads", threads: 3 },
+      { type: "hashReport", id: ids.first, time: time, hashes: 123456789012, rate: 3001, threadRates: [1000, 2001, 0] },
+      { type: "share", id: ids.first, nonce: NONCE, result: RESULT },
+      { type: "best", id: ids.first, nonce: NONCE, result: RESULT },
+      { type: "nonce", id: ids.first, nonce: NONCE },
+      { type: "finished", id: ids.finished },
+      { type: "preempted", id: ids.preempted, hashes: 4294967301 } ].map(( m ) => {
+         if( !id )
+            delete m.id;
+         return m;
+      }));
+}
+
+function chunksOf( buffer, size ) {
+   let chunks = [];
+   for( let i = 0; i < buffer.length; i += size )
+      chunks.push(buffer.subarray(i, i + size));
+   return chunks;
+}
+
+function testDecoding() {
+   let frames = Buffer.from(RESPONSE_FRAMES, "hex");
+   let lines = Buffer.from(RESPONSE_LINES);
+
+   // Whole, and split at every size a pipe might hand over
+   for( let size of [frames.length, 1, 5, 13, 64] )
+      checkResponses(decodeAll(protocol.BinaryDecoder, chunksOf(frames, size)), true);
+   for( let size of [lines.length, 1, 7, 50] )
+      checkResponses(decodeAll(protocol.TextDecoder, chunksOf(lines, size)), false);
+
+   // Out of step or from another version, the decoder reports it
+   let errors = [];
+   new protocol.BinaryDecoder(() => {}, ( e ) => errors.push(e)).push(Buffer.from("00000003", "hex"));
+   let newer = Buffer.from(frames.subarray(0, 16));
+   newer[4] = protocol.PROTOCOL_VERSION + 1;
+   new protocol.BinaryDecoder(() => {}, ( e ) => errors.push(e)).push(newer);
+   assert.strictEqual(errors.length, 2);
+}
+
+testEncoding();
+testDecoding();
+console.log("[JS] Protocol tests passed");
@@ -0,0 +1,215 @@
+#include "bn.h"
+#include "work.h"
+#include "test.h"
+
+#include <string.h>
+
+#define RANGE_NONCES     3000
+#define MAX_SHARES       RANGE_NONCES
+
+/*
+ * The batched search against a nonce by nonce scan with work(), on a random word
+ * buffer and fixed seeds, with every kernel the cpu supports at several prefetch
+ * distances.
+ */
+struct expected
+{
+   int        proof;          // Offset of the first proof in the range, -1 for none
+   struct bn  proof_result;
+   int        share_count;
+   int        shares[MAX_SHARES];
+   struct bn  best;
+   int        best_offset;
+};
+
+struct collected
+{
+   struct bn  first;
+   int        count;
+   int        shares[MAX_SHARES];
+   struct bn  results[MAX_SHARES];
+};
+
+static struct bn* word_buffer;
+
+static void on_share( void* context, struct bn* nonce, struct bn* result )
+{
+   struct collected* c = context;
+   struct bn offset;
+   bignum_sub( nonce, &c->first, &offset );
+   if( c->count < MAX_SHARES )
+   {
+      c->shares[c->count] = bignum_to_int( &offset );
+      c->results[c->count] = *result;
+   }
+   c->count++;
+}
+
+static void top_bits_target( struct bn* target, int zero_bits )
+{
+   memset( target->array, 0xFF, sizeof(target->array) );
+   bignum_rshift( target, target, zero_bits );
+}
+
+static void scan( struct expected* e, struct bn* secured_struct_hash, struct bn* first, int count, struct bn* target, struct bn* share_target )
+{
+   e->proof = -1;
+   e->share_count = 0;
+   e->best_offset = -1;
+   memset( e->best.array, 0xFF, sizeof(e->best.array) );
+
+   struct bn nonce = *first;
+   for( int i = 0; i < count; i++, bignum_inc( &nonce ) )
+   {
+      struct bn result;
+      work( &result, secured_struct_hash, &nonce, word_buffer );
+      if( bignum_cmp( &result, &e->best ) < 0 )
+      {
+         e->best = result;
+         e->best_offset = i;
+      }
+
+      bool proof = bignum_cmp( &result, target ) <= 0;
+      bool share = bignum_cmp( &result, share_target ) <= 0;
+      if( (proof || share) && words_are_unique( secured_struct_hash, &nonce, word_buffer ) )
+      {
+         if( share )
+            e->shares[e->share_count++] = i;
+         if( proof )
+         {
+            e->proof = i;
+            e->proof_result = result;
+            break;
+         }
+      }
+   }
+}
+
+static void test_range( struct bn* secured_struct_hash, struct bn* first, int count, int target_bits )
+{
+   struct work_data wdata;
+   struct bn target, no_target, share_target;
+   struct expected e;
+   atomic_bool stop = false;
+
+   init_work_data( &wdata, secured_struct_hash );
+   top_bits_target( &target, target_bits );
+   bignum_init( &no_target );
+   top_bits_target( &share_target, target_bits - 2 );
+
+   // Proof mode, the first proof of the range or none
+   scan( &e, secured_struct_hash, first, count, &target, &no_target );
+   {
+      struct bn nonce = *first, result, offset;
+      atomic_uint_fast64_t hashes = 0;
+      int found = search_range( &nonce, count, &wdata, secured_struct_hash, &target, NULL, word_buffer, &stop, &hashes, &result );
+
+      CHECK( found == (e.proof >= 0) );
+      if( found && e.proof >= 0 )
+      {
+         bignum_sub( &nonce, first, &offset );
+         CHECK( bignum_to_int( &offset ) == e.proof );
+         CHECK( bignum_cmp( &result, &e.proof_result ) == 0 );
+         CHECK( hashes == (uint64_t)e.proof + 1 );
+      }
+      else
+      {
+         CHECK( hashes == (uint64_t)count );
+      }
+   }
+
+   // Share mode without a proof target: every share in order, and the lowest result
+   scan( &e, secured_struct_hash, first, count, &no_target, &share_target );
+   {
+      struct bn nonce = *first, result, offset;
+      struct share_sink shares;
+      struct collected c = { .first = *first, .count = 0 };
+      atomic_uint_fast64_t hashes = 0;
+
+      init_share_sink( &shares, &share_target, on_share, &c );
+      CHECK( !search_range( &nonce, count, &wdata, secured_struct_hash, &no_target, &shares, word_buffer, &stop, &hashes, &result ) );
+      CHECK( hashes == (uint64_t)count );
+      CHECK( c.count == e.share_count );
+      for( int i = 0; i < c.count && i < e.share_count; i++ )
+      {
+         struct bn expected_result, share_nonce, share_offset;
+         CHECK( c.shares[i] == e.shares[i] );
+         bignum_from_int( &share_offset, e.shares[i] );
+         bignum_add( first, &share_offset, &share_nonce );
+         work( &expected_result, secured_struct_hash, &share_nonce, word_buffer );
+         CHECK( bignum_cmp( &c.results[i], &expected_result ) == 0 );
+      }
+
+      bignum_sub( &shares.best_nonce, first, &offset );
+      CHECK( bignum_cmp( &shares.best, &e.best ) == 0 );
+      CHECK( bignum_to_int( &offset ) == e.best_offset );
+   }
+}
+
+static void test_kernel( const char* name )
+{
+   uint64_t state = 7;
+
+   printf("Search kernel: %s (%u nonces), prefetch distance %u\n", name, search_kernel_lanes(), get_prefetch_distance());
+   for( int s = 0; s < 4; s++ )
+   {
+      struct bn secured_struct_hash, first;
+      for( int i = 0; i < BN_ARRAY_SIZE; i++ )
+      {
+         secured_struct_hash.array[i] = (DTYPE)test_random( &state );
+         first.array[i] = (DTYPE)test_random( &state );
+      }
+
+      // A count that leaves a remainder after whole batches
+      test_range( &secured_struct_hash, &first, RANGE_NONCES - s, 8 + s );
+
+      // Nothing to find, the whole range is counted
+      test_range( &secured_struct_hash, &first, RANGE_NONCES, 40 );
+
+      // Across a wrap of the low limb, where batches stop short and the scalar path takes over
+      first.array[0] = MAX_VAL - 100 + s;
+      test_range( &secured_struct_hash, &first, 300, 6 );
+   }
+}
+
+int main()
+{
+   uint64_t state = 5;
+
+   word_buffer = malloc( WORD_BUFFER_BYTES );
+   CHECK( word_buffer != NULL );
+   if( !word_buffer )
+      return TEST_RESULT();
+   test_random_bytes( &state, (unsigned char*)word_buffer, WORD_BUFFER_BYTES );
+
+   init_work_constants();
+
+   // Every kernel this cpu runs, not only the one selected for it
+   const char* preferred = NULL;
+   for( unsigned k = 0; search_kernel_name_at( k ); k++ )
+   {
+      const char* name = search_kernel_name_at( k );
+      if( !select_search_kernel_named( name ) )
+      {
+         printf("Search kernel: %s (not supported)\n", name);
+         continue;
+      }
+      if( !preferred )
+         preferred = name;
+      CHECK( strcmp( search_kernel_name(), name ) == 0 );
+
+      static const unsigned batches[] = { 0, 1, 4 };
+      for( size_t d = 0; d < sizeof(batches) / sizeof(batches[0]); d++ )
+      {
+         set_prefetch_distance( batches[d] * search_kernel_lanes() );
+         test_kernel( search_kernel_name() );
+      }
+   }
+   CHECK( !select_search_kernel_named( "none" ) );
+
+   select_search_kernel();
+   CHECK( preferred && strcmp( search_kernel_name(), preferred ) == 0 );
+
+   free( word_buffer );
+   return TEST_RESULT();
+}
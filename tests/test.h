@@ -0,0 +1,41 @@
+#ifndef __TEST_H__
+#define __TEST_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Checks shared by the test programs. A failed check is reported and counted, the
+ * program goes on so one run shows every failure, and exits with TEST_RESULT().
+ */
+static int test_failures = 0;
+
+#define CHECK( cond ) \
+   do \
+   { \
+      if( !(cond) ) \
+      { \
+         fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+         test_failures++; \
+      } \
+   } while( 0 )
+
+#define TEST_RESULT() (test_failures ? EXIT_FAILURE : EXIT_SUCCESS)
+
+// Fixed seeds keep every run the same, splitmix64
+static inline uint64_t test_random( uint64_t* state )
+{
+   uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+   z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+   z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+   return z ^ (z >> 31);
+}
+
+static inline void test_random_bytes( uint64_t* state, unsigned char* bytes, size_t count )
+{
+   for( size_t i = 0; i < count; i++ )
+      bytes[i] = (unsigned char)test_random( state );
+}
+
+#endif /* #ifndef __TEST_H__ */